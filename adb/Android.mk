@@ -51,6 +51,8 @@ LIBADB_SRC_FILES := \
     adb_trace.cpp \
     adb_utils.cpp \
     fdevent.cpp \
+    packet_pool.cpp \
+    packet_queue.cpp \
     sockets.cpp \
     transport.cpp \
     transport_local.cpp \
@@ -60,6 +62,8 @@ LIBADB_TEST_SRCS := \
     adb_io_test.cpp \
     adb_utils_test.cpp \
     fdevent_test.cpp \
+    packet_pool_test.cpp \
+    packet_queue_test.cpp \
     socket_test.cpp \
     sysdeps_test.cpp \
     sysdeps/stat_test.cpp \
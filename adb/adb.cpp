@@ -44,6 +44,7 @@
 #include "adb_io.h"
 #include "adb_listeners.h"
 #include "adb_utils.h"
+#include "packet_pool.h"
 #include "transport.h"
 
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
@@ -82,20 +83,21 @@ void fatal_errno(const char* fmt, ...) {
     exit(-1);
 }
 
-apacket* get_apacket(void)
-{
-    apacket* p = reinterpret_cast<apacket*>(malloc(sizeof(apacket)));
-    if (p == nullptr) {
-      fatal("failed to allocate an apacket");
-    }
+static auto& g_packet_pool = *new PacketPool();
 
-    memset(p, 0, sizeof(apacket) - MAX_PAYLOAD);
-    return p;
+apacket* get_apacket(size_t payload)
+{
+    return g_packet_pool.Get(payload);
 }
 
 void put_apacket(apacket *p)
 {
-    free(p);
+    g_packet_pool.Put(p);
+}
+
+apacket* shrink_apacket(apacket* p)
+{
+    return g_packet_pool.Shrink(p);
 }
 
 void handle_online(atransport *t)
@@ -161,7 +163,7 @@ void print_packet(const char *label, apacket *p)
 static void send_ready(unsigned local, unsigned remote, atransport *t)
 {
     D("Calling send_ready");
-    apacket *p = get_apacket();
+    apacket *p = get_apacket(0);
     p->msg.command = A_OKAY;
     p->msg.arg0 = local;
     p->msg.arg1 = remote;
@@ -171,7 +173,7 @@ static void send_ready(unsigned local, unsigned remote, atransport *t)
 static void send_close(unsigned local, unsigned remote, atransport *t)
 {
     D("Calling send_close");
-    apacket *p = get_apacket();
+    apacket *p = get_apacket(0);
     p->msg.command = A_CLSE;
     p->msg.arg0 = local;
     p->msg.arg1 = remote;
@@ -206,7 +208,7 @@ std::string get_connection_string() {
 
 void send_connect(atransport* t) {
     D("Calling send_connect");
-    apacket* cp = get_apacket();
+    apacket* cp = get_apacket(MAX_PAYLOAD_V1);
     cp->msg.command = A_CNXN;
     cp->msg.arg0 = t->get_protocol_version();
     cp->msg.arg1 = t->get_max_payload();
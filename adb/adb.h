@@ -50,7 +50,7 @@ constexpr size_t MAX_PAYLOAD = MAX_PAYLOAD_V2;
 std::string adb_version();
 
 // Increment this when we want to force users to start a new adb server.
-#define ADB_SERVER_VERSION 36
+#define ADB_SERVER_VERSION 38
 
 class atransport;
 struct usb_handle;
@@ -71,6 +71,11 @@ struct apacket
     unsigned len;
     unsigned char *ptr;
 
+    /* room in data, smaller than MAX_PAYLOAD for packets
+    ** taken from the small size class of the pool
+    */
+    unsigned capacity;
+
     amessage msg;
     unsigned char data[MAX_PAYLOAD];
 };
@@ -186,9 +191,13 @@ void framebuffer_service(int fd, void *cookie);
 void set_verity_enabled_state_service(int fd, void* cookie);
 #endif
 
-/* packet allocator */
-apacket *get_apacket(void);
+/* packet allocator, packets may be smaller than sizeof(apacket),
+** only ask for less than MAX_PAYLOAD when the payload size is known
+*/
+apacket *get_apacket(size_t payload = MAX_PAYLOAD);
 void put_apacket(apacket *p);
+/* trade a full sized packet for a small one if its payload fits */
+apacket *shrink_apacket(apacket *p);
 
 // Define it if you want to dump packets.
 #define DEBUG_PACKETS 0
@@ -25,9 +25,14 @@
 #include <string.h>
 #include <unistd.h>
 
+#if defined(__linux__)
+#include <sys/epoll.h>
+#endif
+
 #include <atomic>
 #include <list>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include <android-base/logging.h>
@@ -54,6 +59,10 @@ int SHELL_EXIT_NOTIFY_FD = -1;
 struct PollNode {
   fdevent* fde;
   adb_pollfd pollfd;
+#if defined(__linux__)
+  // The events epoll was last given for this fd.
+  unsigned epoll_events = 0;
+#endif
 
   PollNode(fdevent* fde) : fde(fde) {
       memset(&pollfd, 0, sizeof(pollfd));
@@ -75,6 +84,70 @@ static std::atomic<bool> terminate_loop(false);
 static bool main_thread_valid;
 static unsigned long main_thread_id;
 
+#if defined(__linux__)
+// On Linux the fds are kept registered with epoll, so that a wakeup costs
+// O(ready fds) rather than O(installed fds). poll and epoll share their event
+// bits, pollfd.events is handed to epoll as is.
+static_assert(POLLIN == EPOLLIN && POLLOUT == EPOLLOUT && POLLERR == EPOLLERR &&
+              POLLHUP == EPOLLHUP && POLLRDHUP == EPOLLRDHUP,
+              "poll and epoll event bits differ");
+
+static int g_epoll_fd = -1;
+// fds that epoll refuses, like regular files or invalid fds. These are still
+// polled, so that they report the same events they would without epoll.
+static auto& g_unwatched_fds = *new std::unordered_set<int>();
+
+static int fdevent_epoll_fd() {
+    if (g_epoll_fd == -1) {
+        g_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (g_epoll_fd == -1) {
+            PLOG(FATAL) << "failed to create epoll fd";
+        }
+    }
+    return g_epoll_fd;
+}
+
+// A MOD that wouldn't change anything is skipped, fdevent_add and
+// fdevent_del are called for about every packet.
+static void fdevent_epoll_update(PollNode& node, bool install) {
+    int fd = node.pollfd.fd;
+    if (!install && (node.epoll_events == static_cast<unsigned>(node.pollfd.events) ||
+                     g_unwatched_fds.count(fd))) {
+        return;
+    }
+    epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = node.pollfd.events;
+    ev.data.fd = fd;
+    if (epoll_ctl(fdevent_epoll_fd(), install ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &ev) == 0) {
+        node.epoll_events = ev.events;
+        return;
+    }
+    if (install && errno == EEXIST) {
+        // Still registered, the fd was closed without fdevent_remove before.
+        if (epoll_ctl(g_epoll_fd, EPOLL_CTL_MOD, fd, &ev) == 0) {
+            node.epoll_events = ev.events;
+            return;
+        }
+    }
+    if (install) {
+        D("epoll_ctl(ADD) failed for fd %d (%s), falling back to poll", fd, strerror(errno));
+        g_unwatched_fds.insert(fd);
+    } else {
+        PLOG(ERROR) << "epoll_ctl(MOD) failed for fd " << fd;
+    }
+}
+
+static void fdevent_epoll_remove(int fd) {
+    if (g_unwatched_fds.erase(fd)) {
+        return;
+    }
+    if (epoll_ctl(g_epoll_fd, EPOLL_CTL_DEL, fd, nullptr) == -1) {
+        D("epoll_ctl(DEL) failed for fd %d: %s", fd, strerror(errno));
+    }
+}
+#endif  // defined(__linux__)
+
 static void check_main_thread() {
     if (main_thread_valid) {
         CHECK_EQ(main_thread_id, adb_thread_id());
@@ -149,6 +222,9 @@ void fdevent_install(fdevent* fde, int fd, fd_func func, void* arg) {
     }
     auto pair = g_poll_node_map.emplace(fde->fd, PollNode(fde));
     CHECK(pair.second) << "install existing fd " << fd;
+#if defined(__linux__)
+    fdevent_epoll_update(pair.first->second, true);
+#endif
     D("fdevent_install %s", dump_fde(fde).c_str());
 }
 
@@ -156,6 +232,9 @@ void fdevent_remove(fdevent* fde) {
     check_main_thread();
     D("fdevent_remove %s", dump_fde(fde).c_str());
     if (fde->state & FDE_ACTIVE) {
+#if defined(__linux__)
+        fdevent_epoll_remove(fde->fd);
+#endif
         g_poll_node_map.erase(fde->fd);
         if (fde->state & FDE_PENDING) {
             g_pending_list.remove(fde);
@@ -184,6 +263,9 @@ static void fdevent_update(fdevent* fde, unsigned events) {
     } else {
         node.pollfd.events &= ~POLLOUT;
     }
+#if defined(__linux__)
+    fdevent_epoll_update(node, false);
+#endif
     fde->state = (fde->state & FDE_STATEMASK) | events;
 }
 
@@ -232,16 +314,66 @@ static std::string dump_pollfds(const std::vector<adb_pollfd>& pollfds) {
     return result;
 }
 
-static void fdevent_process() {
-    std::vector<adb_pollfd> pollfds;
+#if defined(__linux__)
+// Fills |pollfds| with the fds that have events, with revents set.
+static bool fdevent_wait(std::vector<adb_pollfd>* pollfds) {
+    CHECK_GT(g_poll_node_map.size(), 0u);
+    int timeout = -1;
+    if (!g_unwatched_fds.empty()) {
+        for (int fd : g_unwatched_fds) {
+            pollfds->push_back(g_poll_node_map.find(fd)->second.pollfd);
+        }
+        D("poll(), pollfds = %s", dump_pollfds(*pollfds).c_str());
+        int ret = adb_poll(&(*pollfds)[0], pollfds->size(), 0);
+        if (ret == -1) {
+            PLOG(ERROR) << "poll(), ret = " << ret;
+            return false;
+        }
+        // Their state only changes with our own fdevent calls, so don't block
+        // if they have something but don't spin on them either.
+        if (ret > 0) {
+            timeout = 0;
+        }
+    }
+
+    // Level triggered like poll, fds beyond the batch get their turn next time.
+    epoll_event events[256];
+    D("epoll_wait(), %zu fds, timeout = %d", g_poll_node_map.size(), timeout);
+    int ret = epoll_wait(fdevent_epoll_fd(), events, arraysize(events), timeout);
+    if (ret == -1) {
+        if (errno != EINTR) {
+            PLOG(ERROR) << "epoll_wait(), ret = " << ret;
+        }
+        return !pollfds->empty();
+    }
+    for (int i = 0; i < ret; ++i) {
+        adb_pollfd pollfd;
+        pollfd.fd = events[i].data.fd;
+        pollfd.events = 0;
+        pollfd.revents = events[i].events;
+        pollfds->push_back(pollfd);
+    }
+    return true;
+}
+#else
+static bool fdevent_wait(std::vector<adb_pollfd>* pollfds) {
     for (const auto& pair : g_poll_node_map) {
-        pollfds.push_back(pair.second.pollfd);
+        pollfds->push_back(pair.second.pollfd);
     }
-    CHECK_GT(pollfds.size(), 0u);
-    D("poll(), pollfds = %s", dump_pollfds(pollfds).c_str());
-    int ret = adb_poll(&pollfds[0], pollfds.size(), -1);
+    CHECK_GT(pollfds->size(), 0u);
+    D("poll(), pollfds = %s", dump_pollfds(*pollfds).c_str());
+    int ret = adb_poll(&(*pollfds)[0], pollfds->size(), -1);
     if (ret == -1) {
         PLOG(ERROR) << "poll(), ret = " << ret;
+        return false;
+    }
+    return true;
+}
+#endif  // defined(__linux__)
+
+static void fdevent_process() {
+    std::vector<adb_pollfd> pollfds;
+    if (!fdevent_wait(&pollfds)) {
         return;
     }
     for (const auto& pollfd : pollfds) {
@@ -391,6 +523,13 @@ size_t fdevent_installed_count() {
 }
 
 void fdevent_reset() {
+#if defined(__linux__)
+    if (g_epoll_fd != -1) {
+        adb_close(g_epoll_fd);
+        g_epoll_fd = -1;
+    }
+    g_unwatched_fds.clear();
+#endif
     g_poll_node_map.clear();
     g_pending_list.clear();
     main_thread_valid = false;
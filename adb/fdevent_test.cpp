@@ -18,7 +18,13 @@
 
 #include <gtest/gtest.h>
 
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
+
+#include <chrono>
 #include <limits>
+#include <memory>
 #include <queue>
 #include <string>
 #include <vector>
@@ -137,6 +143,103 @@ TEST_F(FdeventTest, smoke) {
     ASSERT_EQ(0, adb_close(reader));
 }
 
+struct IdleThreadArg {
+    ThreadArg chain;
+    size_t idle_pair_count;
+};
+
+static void IdleFdEventCallback(int, unsigned events, void*) {
+    FAIL() << "unexpected events on an idle fd: " << events;
+}
+
+// Like FdEventThreadFunc, with many fds that are installed but never see any
+// events, like the sockets of quiet devices, forwards and track-devices clients
+// on a busy adb server.
+static void IdleFdEventThreadFunc(IdleThreadArg* arg) {
+    std::vector<int> peer_fds;
+    std::vector<std::unique_ptr<fdevent>> fdes;
+    for (size_t i = 0; i < arg->idle_pair_count; ++i) {
+        int fds[2];
+        ASSERT_EQ(0, adb_socketpair(fds));
+        fdes.push_back(std::unique_ptr<fdevent>(new fdevent));
+        fdevent_install(fdes.back().get(), fds[0], IdleFdEventCallback, nullptr);
+        fdevent_add(fdes.back().get(), FDE_READ);
+        peer_fds.push_back(fds[1]);
+    }
+
+    FdEventThreadFunc(&arg->chain);
+
+    for (auto& fde : fdes) {
+        fdevent_remove(fde.get());
+    }
+    for (int fd : peer_fds) {
+        adb_close(fd);
+    }
+}
+
+class FdeventIdleTest : public FdeventTest {
+  protected:
+    // Sets |seconds| to the average time a message takes to pass through a
+    // chain of handlers while |idle_pair_count| socketpairs sit idle.
+    void RoundTrips(size_t idle_pair_count, size_t count, double* seconds) {
+        fdevent_reset();
+        int fd_pair1[2];
+        int fd_pair2[2];
+        ASSERT_EQ(0, adb_socketpair(fd_pair1));
+        ASSERT_EQ(0, adb_socketpair(fd_pair2));
+        IdleThreadArg thread_arg;
+        thread_arg.chain.first_read_fd = fd_pair1[0];
+        thread_arg.chain.last_write_fd = fd_pair2[1];
+        thread_arg.chain.middle_pipe_count = 2;
+        thread_arg.idle_pair_count = idle_pair_count;
+        int writer = fd_pair1[1];
+        int reader = fd_pair2[0];
+
+        PrepareThread();
+        adb_thread_t thread;
+        ASSERT_TRUE(adb_thread_create(reinterpret_cast<void (*)(void*)>(IdleFdEventThreadFunc),
+                                      &thread_arg, &thread));
+
+        // The first trip also waits for the thread to install everything.
+        char c = 'x';
+        ASSERT_TRUE(WriteFdExactly(writer, &c, 1));
+        ASSERT_TRUE(ReadFdExactly(reader, &c, 1));
+
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < count; ++i) {
+            ASSERT_TRUE(WriteFdExactly(writer, &c, 1));
+            ASSERT_TRUE(ReadFdExactly(reader, &c, 1));
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        *seconds = elapsed.count() / count;
+
+        TerminateThread(thread);
+        ASSERT_EQ(0, adb_close(writer));
+        ASSERT_EQ(0, adb_close(reader));
+    }
+};
+
+TEST_F(FdeventIdleTest, idle_fds) {
+    double seconds;
+    RoundTrips(256, 100, &seconds);
+}
+
+// A benchmark rather than a test, run it with --gtest_also_run_disabled_tests.
+// With poll the time per message grows with the idle fds, with epoll it doesn't.
+TEST_F(FdeventIdleTest, DISABLED_idle_fds_scaling) {
+#if !defined(_WIN32)
+    rlimit limit;
+    ASSERT_EQ(0, getrlimit(RLIMIT_NOFILE, &limit));
+    limit.rlim_cur = limit.rlim_max;
+    ASSERT_EQ(0, setrlimit(RLIMIT_NOFILE, &limit));
+#endif
+    for (size_t idle_pair_count : {0, 500, 2000, 8000}) {
+        double seconds;
+        RoundTrips(idle_pair_count, 2000, &seconds);
+        printf("%6zu idle fds: %8.1f us per message\n", idle_pair_count, seconds * 1e6);
+    }
+}
+
 struct InvalidFdArg {
     fdevent fde;
     unsigned expected_events;
@@ -29,10 +29,12 @@
 #include <utime.h>
 
 #include <chrono>
+#include <deque>
 #include <functional>
 #include <memory>
 #include <sstream>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "sysdeps.h"
@@ -48,12 +50,6 @@
 #include <android-base/strings.h>
 #include <android-base/stringprintf.h>
 
-struct syncsendbuf {
-    unsigned id;
-    unsigned size;
-    char data[SYNC_DATA_MAX];
-};
-
 static void ensure_trailing_separators(std::string& local_path, std::string& remote_path) {
     if (!adb_is_separator(local_path.back())) {
         local_path.push_back(OS_PATH_SEPARATOR);
@@ -202,14 +198,25 @@ struct TransferLedger {
 
 class SyncConnection {
   public:
-    SyncConnection() : expect_done_(false) {
-        max = SYNC_DATA_MAX; // TODO: decide at runtime.
+    SyncConnection() : expect_done_(false), pipeline_(false), pending_copy_failed_(false) {
+        max = SYNC_DATA_MAX;
 
         std::string error;
+        FeatureSet features;
+        if (adb_get_feature_set(&features, &error)) {
+            pipeline_ = CanUseFeature(features, kFeaturePushPipeline);
+        }
+
         fd = adb_connect("sync:", &error);
         if (fd < 0) {
             Error("connect failed: %s", error.c_str());
+            return;
         }
+
+        if (CanUseFeature(features, kFeatureSyncChunk)) {
+            NegotiateChunkSize();
+        }
+        buffer.resize(sizeof(SyncRequest) + max);
     }
 
     ~SyncConnection() {
@@ -335,7 +342,7 @@ class SyncConnection {
         WriteOrDie(lpath, rpath, &buf[0], (p - &buf[0]));
         expect_done_ = true;
 
-        // RecordFilesTransferred gets called in CopyDone.
+        // RecordFilesTransferred gets called once the status comes in.
         RecordBytesTransferred(data_length);
         ReportProgress(rpath, data_length, data_length);
         return true;
@@ -364,10 +371,11 @@ class SyncConnection {
             return false;
         }
 
-        syncsendbuf sbuf;
-        sbuf.id = ID_DATA;
+        SyncRequest* req = reinterpret_cast<SyncRequest*>(&buffer[0]);
+        char* data = reinterpret_cast<char*>(req + 1);
+        req->id = ID_DATA;
         while (true) {
-            int bytes_read = adb_read(lfd, sbuf.data, max);
+            int bytes_read = adb_read(lfd, data, max);
             if (bytes_read == -1) {
                 Error("reading '%s' locally failed: %s", lpath, strerror(errno));
                 adb_close(lfd);
@@ -376,14 +384,23 @@ class SyncConnection {
                 break;
             }
 
-            sbuf.size = bytes_read;
-            WriteOrDie(lpath, rpath, &sbuf, sizeof(SyncRequest) + bytes_read);
+            req->path_length = bytes_read;
+            WriteOrDie(lpath, rpath, req, sizeof(SyncRequest) + bytes_read);
 
             RecordBytesTransferred(bytes_read);
             bytes_copied += bytes_read;
 
             // Check to see if we've received an error from the other side.
-            if (ReceivedError(lpath, rpath)) {
+            // Statuses of earlier files come first when they're pipelined.
+            bool received_error = false;
+            while (ReceivedError(lpath, rpath)) {
+                if (pending_copies_.empty()) {
+                    received_error = true;
+                    break;
+                }
+                ReadPendingCopyDone();
+            }
+            if (received_error) {
                 break;
             }
 
@@ -397,7 +414,7 @@ class SyncConnection {
         msg.data.size = mtime;
         expect_done_ = true;
 
-        // RecordFilesTransferred gets called in CopyDone.
+        // RecordFilesTransferred gets called once the status comes in.
         return WriteOrDie(lpath, rpath, &msg.data, sizeof(msg.data));
     }
 
@@ -424,6 +441,35 @@ class SyncConnection {
         return ReportCopyFailure(from, to, msg);
     }
 
+    // Called once a file has been sent. Without kFeaturePushPipeline this
+    // waits for its status. Otherwise the status is left to be read later,
+    // so that the next file can follow right away, and only the statuses that
+    // have already arrived are read. Returns false if a file has failed.
+    bool FinishCopy(const char* from, const char* to) {
+        if (!pipeline_) {
+            return CopyDone(from, to);
+        }
+        expect_done_ = false;
+        pending_copies_.emplace_back(from, to);
+
+        while (!pending_copies_.empty() &&
+               (pending_copies_.size() > kMaxPendingCopies || ReceivedError(from, to))) {
+            ReadPendingCopyDone();
+        }
+        return !pending_copy_failed_;
+    }
+
+    // Waits for the statuses of all files sent so far. Returns false if any
+    // of them failed since the last call.
+    bool FinishCopies() {
+        while (!pending_copies_.empty()) {
+            ReadPendingCopyDone();
+        }
+        bool success = !pending_copy_failed_;
+        pending_copy_failed_ = false;
+        return success;
+    }
+
     bool ReportCopyFailure(const char* from, const char* to, const syncmsg& msg) {
         std::vector<char> buf(msg.status.msglen + 1);
         if (!ReadFdExactly(fd, &buf[0], msg.status.msglen)) {
@@ -497,17 +543,73 @@ class SyncConnection {
         current_ledger_.expect_multiple_files = false;
     }
 
-    // TODO: add a char[max] buffer here, to replace syncsendbuf...
     int fd;
+    // The largest chunk of file data either side sends.
     size_t max;
+    // A chunk, preceded by room for its SyncRequest header.
+    std::vector<char> buffer;
 
   private:
+    // Bounds the statuses that the device may have queued up for us, so
+    // that it never ends up blocked writing them while we are still
+    // writing files to it.
+    static constexpr size_t kMaxPendingCopies = 1024;
+
     bool expect_done_;
+    bool pipeline_;
+    bool pending_copy_failed_;
+    // The files that were sent but whose status hasn't been read yet, oldest
+    // first, as the device answers them in order.
+    std::deque<std::pair<std::string, std::string>> pending_copies_;
 
     TransferLedger global_ledger_;
     TransferLedger current_ledger_;
     LinePrinter line_printer_;
 
+    void ReadPendingCopyDone() {
+        std::pair<std::string, std::string> copy = std::move(pending_copies_.front());
+        pending_copies_.pop_front();
+        const char* from = copy.first.c_str();
+        const char* to = copy.second.c_str();
+
+        syncmsg msg;
+        if (!ReadFdExactly(fd, &msg.status, sizeof(msg.status))) {
+            Error("failed to copy '%s' to '%s': couldn't read from device", from, to);
+            // Nothing more is coming, don't blame every other file still pending.
+            pending_copies_.clear();
+        } else if (msg.status.id == ID_OKAY) {
+            RecordFilesTransferred(1);
+            return;
+        } else if (msg.status.id != ID_FAIL) {
+            Error("failed to copy '%s' to '%s': unknown reason %d", from, to, msg.status.id);
+            pending_copies_.clear();
+        } else {
+            ReportCopyFailure(from, to, msg);
+        }
+        pending_copy_failed_ = true;
+    }
+
+    // Asks for chunks as large as a packet can be, adbd settles on what its
+    // transport allows. Any other answer leaves the stream out of step, so
+    // the connection is closed and IsValid() fails.
+    void NegotiateChunkSize() {
+        std::string size = std::to_string(MAX_PAYLOAD);
+        syncmsg msg;
+        if (!SendRequest(ID_CHNK, size.c_str()) ||
+                !ReadFdExactly(fd, &msg.data, sizeof(msg.data))) {
+            Error("failed to negotiate the chunk size: %s", strerror(errno));
+        } else if (msg.data.id != ID_CHNK || msg.data.size < SYNC_DATA_MAX ||
+                msg.data.size > MAX_PAYLOAD) {
+            Error("failed to negotiate the chunk size: bad response %#x (%u)",
+                  msg.data.id, msg.data.size);
+        } else {
+            max = msg.data.size;
+            return;
+        }
+        adb_close(fd);
+        fd = -1;
+    }
+
     bool SendQuit() {
         return SendRequest(ID_QUIT, ""); // TODO: add a SendResponse?
     }
@@ -518,7 +620,13 @@ class SyncConnection {
                 // Assume adbd told us why it was closing the connection, and
                 // try to read failure reason from adbd.
                 syncmsg msg;
-                if (!ReadFdExactly(fd, &msg.status, sizeof(msg.status))) {
+                bool response = ReadFdExactly(fd, &msg.status, sizeof(msg.status));
+                // Skip the successes of earlier files that were still pending.
+                while (response && msg.status.id == ID_OKAY && !pending_copies_.empty()) {
+                    pending_copies_.pop_front();
+                    response = ReadFdExactly(fd, &msg.status, sizeof(msg.status));
+                }
+                if (!response) {
                     Error("failed to copy '%s' to '%s': no response: %s", from, to, strerror(errno));
                 } else if (msg.status.id != ID_FAIL) {
                     Error("failed to copy '%s' to '%s': not ID_FAIL: %d", from, to, msg.status.id);
@@ -595,7 +703,7 @@ static bool sync_send(SyncConnection& sc, const char* lpath, const char* rpath,
         if (!sc.SendSmallFile(path_and_mode.c_str(), lpath, rpath, mtime, buf, data_length)) {
             return false;
         }
-        return sc.CopyDone(lpath, rpath);
+        return sc.FinishCopy(lpath, rpath);
 #endif
     }
 
@@ -604,7 +712,7 @@ static bool sync_send(SyncConnection& sc, const char* lpath, const char* rpath,
         sc.Error("failed to stat local file '%s': %s", lpath, strerror(errno));
         return false;
     }
-    if (st.st_size < SYNC_DATA_MAX) {
+    if (static_cast<uint64_t>(st.st_size) < sc.max) {
         std::string data;
         if (!android::base::ReadFileToString(lpath, &data)) {
             sc.Error("failed to read all of '%s': %s", lpath, strerror(errno));
@@ -619,7 +727,7 @@ static bool sync_send(SyncConnection& sc, const char* lpath, const char* rpath,
             return false;
         }
     }
-    return sc.CopyDone(lpath, rpath);
+    return sc.FinishCopy(lpath, rpath);
 }
 
 static bool sync_recv(SyncConnection& sc, const char* rpath, const char* lpath,
@@ -661,7 +769,7 @@ static bool sync_recv(SyncConnection& sc, const char* rpath, const char* lpath,
             return false;
         }
 
-        char buffer[SYNC_DATA_MAX];
+        char* buffer = &sc.buffer[0];
         if (!ReadFdExactly(sc.fd, buffer, msg.data.size)) {
             adb_close(lfd);
             adb_unlink(lpath);
@@ -808,6 +916,7 @@ static bool copy_local_dir_remote(SyncConnection& sc, std::string lpath,
                 sc.Println("would push: %s -> %s", ci.lpath.c_str(), ci.rpath.c_str());
             } else {
                 if (!sync_send(sc, ci.lpath.c_str(), ci.rpath.c_str(), ci.time, ci.mode)) {
+                    sc.FinishCopies();
                     return false;
                 }
             }
@@ -815,6 +924,9 @@ static bool copy_local_dir_remote(SyncConnection& sc, std::string lpath,
             skipped++;
         }
     }
+    if (!sc.FinishCopies()) {
+        return false;
+    }
 
     sc.RecordFilesSkipped(skipped);
     sc.ReportTransferRate(lpath, TransferDirection::push);
@@ -897,6 +1009,7 @@ bool do_sync_push(const std::vector<const char*>& srcs, const char* dst) {
         sc.NewTransfer();
         sc.SetExpectedTotalBytes(st.st_size);
         success &= sync_send(sc, src_path, dst_path, st.st_mtime, st.st_mode);
+        success &= sc.FinishCopies();
         sc.ReportTransferRate(src_path, TransferDirection::push);
     }
 
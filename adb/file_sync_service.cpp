@@ -21,25 +21,48 @@
 
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <log/log.h>
 #include <selinux/android.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <utime.h>
 
+#include <algorithm>
+
 #include "adb.h"
 #include "adb_io.h"
 #include "adb_utils.h"
 #include "private/android_filesystem_config.h"
 #include "security_log_tags.h"
 
+#include <android-base/parseint.h>
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
 
+// What a sync connection keeps from one request to the next.
+struct SyncState {
+    explicit SyncState(size_t max_payload) : buffer(SYNC_DATA_MAX), max_payload(max_payload) {
+    }
+
+    // Sized to the agreed chunk, SYNC_DATA_MAX unless raised with ID_CHNK.
+    std::vector<char> buffer;
+    // The largest chunk ID_CHNK may agree on, the transport's packet payload.
+    size_t max_payload;
+
+    // Pushed data goes from the socket through this pipe into the file with
+    // splice, so that it never has to be copied through user space. Opened
+    // on the first push, closed for good once splice turns out not to work.
+    unique_fd pipe_read;
+    unique_fd pipe_write;
+    bool use_splice = true;
+};
+
 static bool should_use_fs_config(const std::string& path) {
     // TODO: use fs_config to configure permissions on /data.
     return android::base::StartsWith(path, "/system/") ||
@@ -146,10 +169,122 @@ static bool SendSyncFailErrno(int fd, const std::string& reason) {
     return SendSyncFail(fd, android::base::StringPrintf("%s: %s", reason.c_str(), strerror(errno)));
 }
 
+// After a failure has been reported, reads and throws away the rest of the
+// file up to its ID_DONE. Returns true if the stream is still in step, in
+// which case the connection can go on with the next request.
+static bool discard_send_data(int s, std::vector<char>& buffer) {
+    syncmsg msg;
+    while (true) {
+        if (!ReadFdExactly(s, &msg.data, sizeof(msg.data))) return false;
+
+        if (msg.data.id == ID_DONE) {
+            return true;
+        } else if (msg.data.id != ID_DATA) {
+            char id[5];
+            memcpy(id, &msg.data.id, sizeof(msg.data.id));
+            id[4] = '\0';
+            D("handle_send_fail received unexpected id '%s' during failure", id);
+            return false;
+        }
+
+        if (msg.data.size > buffer.size()) {
+            D("handle_send_fail received oversized packet of length '%u' during failure",
+              msg.data.size);
+            return false;
+        }
+
+        if (!ReadFdExactly(s, &buffer[0], msg.data.size)) return false;
+    }
+}
+
+static bool open_splice_pipe(SyncState& state) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        PLOG(ERROR) << "sync: failed to create splice pipe";
+        return false;
+    }
+    state.pipe_read.reset(fds[0]);
+    state.pipe_write.reset(fds[1]);
+
+    // A default pipe holds 64KiB, make room for a whole chunk if we may.
+    fcntl(fds[1], F_SETPIPE_SZ, static_cast<int>(state.max_payload));
+    return true;
+}
+
+static void close_splice_pipe(SyncState& state) {
+    state.pipe_read.reset(-1);
+    state.pipe_write.reset(-1);
+    state.use_splice = false;
+}
+
+// Moves a chunk of 'size' bytes from the socket into the file, with splice
+// where the kernel allows it and with read/write otherwise. Returns false if
+// the socket failed. A file that can't be written is not an error here: the
+// rest of the chunk is read and thrown away, and the first errno is left in
+// '*write_errno' for the caller to report.
+static bool receive_chunk(int s, int fd, size_t size, SyncState& state, int* write_errno) {
+    *write_errno = 0;
+    if (state.use_splice && state.pipe_read == -1 && !open_splice_pipe(state)) {
+        state.use_splice = false;
+    }
+
+    // The pipe is empty at the top of every iteration.
+    while (size > 0 && state.use_splice && *write_errno == 0) {
+        ssize_t in = splice(s, nullptr, state.pipe_write, nullptr, size, SPLICE_F_MOVE);
+        if (in == -1 && errno == EINTR) continue;
+        if (in == -1 && (errno == EINVAL || errno == ENOSYS)) {
+            D("sync: can't splice from the socket: %s", strerror(errno));
+            close_splice_pipe(state);
+            break;
+        }
+        if (in <= 0) return false;
+        size -= in;
+
+        size_t pending = in;
+        ssize_t out = 0;
+        while (pending > 0) {
+            out = splice(state.pipe_read, nullptr, fd, nullptr, pending, SPLICE_F_MOVE);
+            if (out == -1 && errno == EINTR) continue;
+            if (out <= 0) break;
+            pending -= out;
+        }
+        if (pending > 0) {
+            // Empty the pipe, then either write what was in it the usual
+            // way if this file just can't be spliced to, or give up on it.
+            int saved_errno = (out == 0) ? ENOSPC : errno;
+            if (!ReadFdExactly(state.pipe_read, &state.buffer[0], pending)) {
+                PLOG(ERROR) << "sync: failed to empty splice pipe";
+                return false;
+            }
+            if (saved_errno == EINVAL) {
+                D("sync: can't splice to the file");
+                close_splice_pipe(state);
+                if (!WriteFdExactly(fd, &state.buffer[0], pending)) *write_errno = errno;
+            } else {
+                *write_errno = saved_errno;
+            }
+        }
+    }
+
+    if (size > 0) {
+        if (!ReadFdExactly(s, &state.buffer[0], size)) return false;
+        if (*write_errno == 0 && !WriteFdExactly(fd, &state.buffer[0], size)) {
+            *write_errno = errno;
+        }
+    }
+    return true;
+}
+
+// Returns false if the connection can't be used any more. A file that
+// couldn't be written is reported with ID_FAIL, but once the rest of it has
+// been read the connection carries on, so that a client streaming several
+// files (kFeaturePushPipeline) gets exactly one status per file.
 static bool handle_send_file(int s, const char* path, uid_t uid,
-                             gid_t gid, mode_t mode, std::vector<char>& buffer, bool do_unlink) {
+                             gid_t gid, mode_t mode, SyncState& state, bool do_unlink) {
+    std::vector<char>& buffer = state.buffer;
     syncmsg msg;
     unsigned int timestamp = 0;
+    int write_errno;
 
     __android_log_security_bswrite(SEC_TAG_ADB_SEND_FILE, path);
 
@@ -183,7 +318,7 @@ static bool handle_send_file(int s, const char* path, uid_t uid,
     }
 
     while (true) {
-        if (!ReadFdExactly(s, &msg.data, sizeof(msg.data))) goto fail;
+        if (!ReadFdExactly(s, &msg.data, sizeof(msg.data))) goto abort;
 
         if (msg.data.id != ID_DATA) {
             if (msg.data.id == ID_DONE) {
@@ -194,14 +329,15 @@ static bool handle_send_file(int s, const char* path, uid_t uid,
             goto abort;
         }
 
-        if (msg.data.size > buffer.size()) {  // TODO: resize buffer?
+        if (msg.data.size > buffer.size()) {
             SendSyncFail(s, "oversize data message");
             goto abort;
         }
 
-        if (!ReadFdExactly(s, &buffer[0], msg.data.size)) goto abort;
+        if (!receive_chunk(s, fd, msg.data.size, state, &write_errno)) goto abort;
 
-        if (!WriteFdExactly(fd, &buffer[0], msg.data.size)) {
+        if (write_errno != 0) {
+            errno = write_errno;
             SendSyncFailErrno(s, "write failed");
             goto fail;
         }
@@ -219,33 +355,12 @@ static bool handle_send_file(int s, const char* path, uid_t uid,
     return WriteFdExactly(s, &msg.status, sizeof(msg.status));
 
 fail:
-    // If there's a problem on the device, we'll send an ID_FAIL message and
-    // close the socket. Unfortunately the kernel will sometimes throw that
-    // data away if the other end keeps writing without reading (which is
-    // the case with old versions of adb). To maintain compatibility, keep
-    // reading and throwing away ID_DATA packets until the other side notices
-    // that we've reported an error.
-    while (true) {
-        if (!ReadFdExactly(s, &msg.data, sizeof(msg.data))) goto fail;
-
-        if (msg.data.id == ID_DONE) {
-            goto abort;
-        } else if (msg.data.id != ID_DATA) {
-            char id[5];
-            memcpy(id, &msg.data.id, sizeof(msg.data.id));
-            id[4] = '\0';
-            D("handle_send_fail received unexpected id '%s' during failure", id);
-            goto abort;
-        }
-
-        if (msg.data.size > buffer.size()) {
-            D("handle_send_fail received oversized packet of length '%u' during failure",
-              msg.data.size);
-            goto abort;
-        }
-
-        if (!ReadFdExactly(s, &buffer[0], msg.data.size)) goto abort;
-    }
+    // If there's a problem on the device, we'll send an ID_FAIL message.
+    // The other end keeps writing without reading until it notices, so
+    // keep reading and throwing away ID_DATA packets up to the ID_DONE.
+    if (fd >= 0) adb_close(fd);
+    if (do_unlink) adb_unlink(path);
+    return discard_send_data(s, buffer);
 
 abort:
     if (fd >= 0) adb_close(fd);
@@ -279,13 +394,13 @@ static bool handle_send_link(int s, const std::string& path, std::vector<char>&
     if (ret && errno == ENOENT) {
         if (!secure_mkdirs(adb_dirname(path))) {
             SendSyncFailErrno(s, "secure_mkdirs failed");
-            return false;
+            return discard_send_data(s, buffer);
         }
         ret = symlink(&buffer[0], path.c_str());
     }
     if (ret) {
         SendSyncFailErrno(s, "symlink failed");
-        return false;
+        return discard_send_data(s, buffer);
     }
 
     if (!ReadFdExactly(s, &msg.data, sizeof(msg.data))) return false;
@@ -303,12 +418,14 @@ static bool handle_send_link(int s, const std::string& path, std::vector<char>&
 }
 #endif
 
-static bool do_send(int s, const std::string& spec, std::vector<char>& buffer) {
+static bool do_send(int s, const std::string& spec, SyncState& state) {
+    std::vector<char>& buffer = state.buffer;
+
     // 'spec' is of the form "/some/path,0755". Break it up.
     size_t comma = spec.find_last_of(',');
     if (comma == std::string::npos) {
         SendSyncFail(s, "missing , in ID_SEND");
-        return false;
+        return discard_send_data(s, buffer);
     }
 
     std::string path = spec.substr(0, comma);
@@ -317,7 +434,7 @@ static bool do_send(int s, const std::string& spec, std::vector<char>& buffer) {
     mode_t mode = strtoul(spec.substr(comma + 1).c_str(), nullptr, 0);
     if (errno != 0) {
         SendSyncFail(s, "bad mode");
-        return false;
+        return discard_send_data(s, buffer);
     }
 
     // Don't delete files before copying if they are not "regular" or symlinks.
@@ -344,7 +461,56 @@ static bool do_send(int s, const std::string& spec, std::vector<char>& buffer) {
         fs_config(path.c_str(), 0, nullptr, &uid, &gid, &broken_api_hack, &cap);
         mode = broken_api_hack;
     }
-    return handle_send_file(s, path.c_str(), uid, gid, mode, buffer, do_unlink);
+    return handle_send_file(s, path.c_str(), uid, gid, mode, state, do_unlink);
+}
+
+// Sends a chunk of exactly 'size' bytes of the file, straight from the page
+// cache with sendfile. If sendfile can't do it, the rest of the chunk is read
+// the usual way and '*use_sendfile' is cleared. Returns false if the socket
+// failed, or if the file was truncated since the caller checked that the
+// chunk is there, which is then reported with ID_FAIL.
+static bool send_chunk(int s, int fd, size_t size, std::vector<char>& buffer,
+                       bool* use_sendfile) {
+    syncmsg msg;
+    msg.data.id = ID_DATA;
+    msg.data.size = size;
+    if (!WriteFdExactly(s, &msg.data, sizeof(msg.data))) return false;
+
+    while (size > 0) {
+        ssize_t sent = sendfile(s, fd, nullptr, size);
+        if (sent == -1 && errno == EINTR) continue;
+        if (sent == -1 && (errno == EINVAL || errno == ENOSYS)) {
+            D("sync: can't sendfile: %s", strerror(errno));
+            *use_sendfile = false;
+            break;
+        }
+        if (sent == -1) return false;
+        if (sent == 0) break;
+        size -= sent;
+    }
+    if (size == 0) return true;
+
+    // The header has promised 'size' more bytes, send them one way or another.
+    size_t count = 0;
+    int r = 0;
+    while (count < size) {
+        r = adb_read(fd, &buffer[count], size - count);
+        if (r <= 0) break;
+        count += r;
+    }
+    if (count < size) {
+        int saved_errno = errno;
+        memset(&buffer[count], 0, size - count);
+        if (!WriteFdExactly(s, &buffer[0], size)) return false;
+        if (r == 0) {
+            SendSyncFail(s, "file shrank while reading");
+        } else {
+            errno = saved_errno;
+            SendSyncFailErrno(s, "read failed");
+        }
+        return false;
+    }
+    return WriteFdExactly(s, &buffer[0], size);
 }
 
 static bool do_recv(int s, const char* path, std::vector<char>& buffer) {
@@ -356,6 +522,30 @@ static bool do_recv(int s, const char* path, std::vector<char>& buffer) {
         return false;
     }
 
+    // Regular files go out with sendfile, as far as their size is known.
+    // Whatever is left, and anything that isn't a regular file, is read.
+    struct stat st;
+    bool use_sendfile = (fstat(fd, &st) == 0 && S_ISREG(st.st_mode));
+    uint64_t offset = 0;
+    uint64_t left = use_sendfile ? st.st_size : 0;
+    while (left > 0 && use_sendfile) {
+        size_t size = std::min<uint64_t>(left, buffer.size());
+
+        // A DATA header can't be taken back, so only promise a chunk whose
+        // last byte is really there. st_size isn't always the truth: sysfs
+        // and debugfs claim 4096 bytes for attributes that hold a few, and
+        // the file may have been truncated since.
+        char last;
+        if (pread(fd, &last, 1, offset + size - 1) != 1) break;
+
+        if (!send_chunk(s, fd, size, buffer, &use_sendfile)) {
+            adb_close(fd);
+            return false;
+        }
+        offset += size;
+        left -= size;
+    }
+
     syncmsg msg;
     msg.data.id = ID_DATA;
     while (true) {
@@ -380,7 +570,26 @@ static bool do_recv(int s, const char* path, std::vector<char>& buffer) {
     return WriteFdExactly(s, &msg.data, sizeof(msg.data));
 }
 
-static bool handle_sync_command(int fd, std::vector<char>& buffer) {
+// Agrees on the largest chunk either side may send: as asked for in 'request',
+// but no larger than a packet of this transport, and no smaller than the
+// SYNC_DATA_MAX that every client and device supports.
+static bool do_chunk(int s, const char* request, SyncState& state) {
+    size_t size;
+    if (!android::base::ParseUint(request, &size)) {
+        SendSyncFail(s, android::base::StringPrintf("bad chunk size '%s'", request));
+        return false;
+    }
+    size = std::max<size_t>(SYNC_DATA_MAX, std::min(size, state.max_payload));
+    state.buffer.resize(size);
+    D("sync: chunk size %zu", size);
+
+    syncmsg msg;
+    msg.data.id = ID_CHNK;
+    msg.data.size = size;
+    return WriteFdExactly(s, &msg.data, sizeof(msg.data));
+}
+
+static bool handle_sync_command(int fd, SyncState& state) {
     D("sync: waiting for request");
 
     SyncRequest request;
@@ -411,10 +620,13 @@ static bool handle_sync_command(int fd, std::vector<char>& buffer) {
         if (!do_list(fd, name)) return false;
         break;
       case ID_SEND:
-        if (!do_send(fd, name, buffer)) return false;
+        if (!do_send(fd, name, state)) return false;
         break;
       case ID_RECV:
-        if (!do_recv(fd, name, buffer)) return false;
+        if (!do_recv(fd, name, state.buffer)) return false;
+        break;
+      case ID_CHNK:
+        if (!do_chunk(fd, name, state)) return false;
         break;
       case ID_QUIT:
         return false;
@@ -428,9 +640,10 @@ static bool handle_sync_command(int fd, std::vector<char>& buffer) {
 }
 
 void file_sync_service(int fd, void* cookie) {
-    std::vector<char> buffer(SYNC_DATA_MAX);
+    // The cookie is the transport's max payload, see service_to_fd.
+    SyncState state(reinterpret_cast<uintptr_t>(cookie));
 
-    while (handle_sync_command(fd, buffer)) {
+    while (handle_sync_command(fd, state)) {
     }
 
     D("sync: done");
@@ -32,6 +32,7 @@
 #define ID_OKAY MKID('O','K','A','Y')
 #define ID_FAIL MKID('F','A','I','L')
 #define ID_QUIT MKID('Q','U','I','T')
+#define ID_CHNK MKID('C','H','N','K')
 
 struct SyncRequest {
     uint32_t id;  // ID_STAT, et cetera.
@@ -71,6 +72,8 @@ bool do_sync_pull(const std::vector<const char*>& srcs, const char* dst,
 
 bool do_sync_sync(const std::string& lpath, const std::string& rpath, bool list_only);
 
+// The largest chunk of file data, unless a larger one was agreed on with
+// ID_CHNK (kFeatureSyncChunk).
 #define SYNC_DATA_MAX (64*1024)
 
 #endif
@@ -601,7 +601,7 @@ jdwp_socket_ready( asocket*  s )
     if (jdwp->pass == 0) {
         apacket*  p = get_apacket();
         p->len = jdwp_process_list((char*)p->data, s->get_max_payload());
-        peer->enqueue(peer, p);
+        peer->enqueue(peer, shrink_apacket(p));
         jdwp->pass = 1;
     }
     else {
@@ -652,7 +652,7 @@ jdwp_process_list_updated(void)
     len = jdwp_process_list_msg(buffer, sizeof(buffer));
 
     for ( ; t != &_jdwp_trackers_list; t = t->next ) {
-        apacket*  p    = get_apacket();
+        apacket*  p    = get_apacket(len);
         asocket*  peer = t->socket.peer;
         memcpy(p->data, buffer, len);
         p->len = len;
@@ -688,7 +688,7 @@ jdwp_tracker_ready( asocket*  s )
         apacket*  p = get_apacket();
         t->need_update = 0;
         p->len = jdwp_process_list_msg((char*)p->data, s->get_max_payload());
-        s->peer->enqueue(s->peer, p);
+        s->peer->enqueue(s->peer, shrink_apacket(p));
     }
 }
 
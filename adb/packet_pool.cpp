@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define TRACE_TAG TRANSPORT
+
+#include "sysdeps.h"
+#include "packet_pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+constexpr size_t PacketPool::kSmallPayload;
+constexpr size_t PacketPool::kLargePayload;
+
+// The payload is the last member, a small packet is simply cut short.
+static constexpr size_t kHeaderSize = offsetof(apacket, data);
+
+static constexpr size_t kPayloadSize[PacketPool::kSizeClassCount] = {
+    PacketPool::kSmallPayload,
+    PacketPool::kLargePayload,
+};
+
+PacketPool::PacketPool(size_t small_limit, size_t large_limit) {
+    lists_[kSmall].limit = small_limit;
+    lists_[kLarge].limit = large_limit;
+}
+
+PacketPool::~PacketPool() {
+    for (FreeList& list : lists_) {
+        while (list.head != nullptr) {
+            apacket* p = list.head;
+            list.head = p->next;
+            free(p);
+        }
+    }
+}
+
+apacket* PacketPool::Get(size_t payload) {
+    if (payload > kLargePayload) {
+        fatal("apacket payload of %zu bytes is too large", payload);
+    }
+    SizeClass size_class = ClassOf(payload);
+    FreeList& list = lists_[size_class];
+
+    apacket* p = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(list.mutex);
+        if (list.head != nullptr) {
+            p = list.head;
+            list.head = p->next;
+            --list.stats.free;
+            ++list.stats.hits;
+        } else {
+            ++list.stats.misses;
+        }
+    }
+
+    if (p == nullptr) {
+        p = reinterpret_cast<apacket*>(malloc(kHeaderSize + kPayloadSize[size_class]));
+        if (p == nullptr) {
+            fatal("failed to allocate an apacket");
+        }
+    }
+
+    memset(p, 0, kHeaderSize);
+    p->capacity = kPayloadSize[size_class];
+    return p;
+}
+
+void PacketPool::Put(apacket* p) {
+    if (p == nullptr) {
+        return;
+    }
+    FreeList& list = lists_[ClassOf(p->capacity)];
+    {
+        std::lock_guard<std::mutex> lock(list.mutex);
+        if (list.stats.free < list.limit) {
+            p->next = list.head;
+            list.head = p;
+            ++list.stats.free;
+            return;
+        }
+    }
+    free(p);
+}
+
+apacket* PacketPool::Shrink(apacket* p) {
+    size_t length = p->msg.data_length > p->len ? p->msg.data_length : p->len;
+    if (p->capacity <= kSmallPayload || length > kSmallPayload) {
+        return p;
+    }
+    apacket* small = Get(length);
+    small->len = p->len;
+    small->msg = p->msg;
+    memcpy(small->data, p->data, length);
+    Put(p);
+    return small;
+}
+
+PacketPool::Stats PacketPool::GetStats(SizeClass size_class) {
+    FreeList& list = lists_[size_class];
+    std::lock_guard<std::mutex> lock(list.mutex);
+    return list.stats;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __PACKET_POOL_H
+#define __PACKET_POOL_H
+
+#include <stddef.h>
+
+#include <mutex>
+
+#include <android-base/macros.h>
+
+#include "adb.h"
+
+// Recycles apackets in two size classes. Most traffic is control messages
+// and short shell or jdwp writes, which only need a small payload, so those
+// don't have to carry a MAX_PAYLOAD buffer around. Each class keeps a bounded
+// free list, anything beyond the bound goes back to malloc.
+//
+// Thread safe, packets are allocated and released both on the transport
+// threads and on the main thread.
+class PacketPool {
+  public:
+    enum SizeClass {
+        kSmall,
+        kLarge,
+        kSizeClassCount,
+    };
+
+    static constexpr size_t kSmallPayload = MAX_PAYLOAD_V1;
+    static constexpr size_t kLargePayload = MAX_PAYLOAD;
+
+    struct Stats {
+        size_t hits;    // served from the free list
+        size_t misses;  // had to be malloc'ed
+        size_t free;    // currently on the free list
+    };
+
+    // How many released packets of each class are kept for reuse.
+    PacketPool(size_t small_limit = 128, size_t large_limit = 8);
+    ~PacketPool();
+
+    // A packet with room for at least |payload| bytes, with everything but
+    // the payload zeroed.
+    apacket* Get(size_t payload);
+    void Put(apacket* p);
+
+    // Moves a packet whose payload would fit the small class into a small
+    // packet, and releases the original. Returns |p| itself otherwise.
+    apacket* Shrink(apacket* p);
+
+    Stats GetStats(SizeClass size_class);
+
+  private:
+    struct FreeList {
+        std::mutex mutex;
+        apacket* head = nullptr;
+        size_t limit = 0;
+        Stats stats = {};
+    };
+
+    static SizeClass ClassOf(size_t payload) {
+        return payload <= kSmallPayload ? kSmall : kLarge;
+    }
+
+    FreeList lists_[kSizeClassCount];
+
+    DISALLOW_COPY_AND_ASSIGN(PacketPool);
+};
+
+#endif  // __PACKET_POOL_H
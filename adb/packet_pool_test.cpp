@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "packet_pool.h"
+
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+#include <thread>
+#include <vector>
+
+TEST(packet_pool, size_classes) {
+    PacketPool pool;
+    apacket* control = pool.Get(0);
+    apacket* small = pool.Get(PacketPool::kSmallPayload);
+    apacket* large = pool.Get(PacketPool::kSmallPayload + 1);
+    apacket* full = pool.Get(MAX_PAYLOAD);
+    ASSERT_EQ(PacketPool::kSmallPayload, control->capacity);
+    ASSERT_EQ(PacketPool::kSmallPayload, small->capacity);
+    ASSERT_EQ(PacketPool::kLargePayload, large->capacity);
+    ASSERT_EQ(MAX_PAYLOAD, full->capacity);
+    pool.Put(control);
+    pool.Put(small);
+    pool.Put(large);
+    pool.Put(full);
+}
+
+TEST(packet_pool, recycles) {
+    PacketPool pool;
+    apacket* p = pool.Get(0);
+    p->msg.command = A_WRTE;
+    p->len = 42;
+    pool.Put(p);
+
+    // The same buffer comes back, cleared.
+    apacket* q = pool.Get(16);
+    ASSERT_EQ(p, q);
+    ASSERT_EQ(0U, q->msg.command);
+    ASSERT_EQ(0U, q->len);
+    pool.Put(q);
+
+    PacketPool::Stats stats = pool.GetStats(PacketPool::kSmall);
+    ASSERT_EQ(1U, stats.hits);
+    ASSERT_EQ(1U, stats.misses);
+    ASSERT_EQ(1U, stats.free);
+    ASSERT_EQ(0U, pool.GetStats(PacketPool::kLarge).misses);
+}
+
+TEST(packet_pool, limit) {
+    PacketPool pool(2, 1);
+    std::vector<apacket*> packets;
+    for (int i = 0; i < 4; ++i) {
+        packets.push_back(pool.Get(0));
+        packets.push_back(pool.Get(MAX_PAYLOAD));
+    }
+    for (apacket* p : packets) {
+        pool.Put(p);
+    }
+    ASSERT_EQ(2U, pool.GetStats(PacketPool::kSmall).free);
+    ASSERT_EQ(1U, pool.GetStats(PacketPool::kLarge).free);
+}
+
+TEST(packet_pool, shrink) {
+    PacketPool pool;
+    apacket* p = pool.Get(MAX_PAYLOAD);
+    p->msg.command = A_WRTE;
+    p->msg.data_length = 5;
+    memcpy(p->data, "hello", 5);
+
+    apacket* small = pool.Shrink(p);
+    ASSERT_NE(p, small);
+    ASSERT_EQ(PacketPool::kSmallPayload, small->capacity);
+    ASSERT_EQ(static_cast<unsigned>(A_WRTE), small->msg.command);
+    ASSERT_EQ(0, memcmp("hello", small->data, 5));
+    ASSERT_EQ(1U, pool.GetStats(PacketPool::kLarge).free);
+
+    // Already small, or too big to shrink.
+    ASSERT_EQ(small, pool.Shrink(small));
+    apacket* large = pool.Get(MAX_PAYLOAD);
+    large->len = PacketPool::kSmallPayload + 1;
+    ASSERT_EQ(large, pool.Shrink(large));
+
+    pool.Put(small);
+    pool.Put(large);
+}
+
+TEST(packet_pool, threads) {
+    PacketPool pool;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([&pool, i]() {
+            for (int j = 0; j < 10000; ++j) {
+                apacket* p = pool.Get((i + j) % 2 ? 0 : MAX_PAYLOAD);
+                p->data[p->capacity - 1] = 0;
+                pool.Put(p);
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    PacketPool::Stats small = pool.GetStats(PacketPool::kSmall);
+    PacketPool::Stats large = pool.GetStats(PacketPool::kLarge);
+    ASSERT_EQ(40000U, small.hits + small.misses + large.hits + large.misses);
+    ASSERT_LE(small.misses, 4U);
+    ASSERT_LE(large.misses, 4U);
+}
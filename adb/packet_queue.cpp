@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define TRACE_TAG TRANSPORT
+
+#include "sysdeps.h"
+#include "packet_queue.h"
+
+#include <stdint.h>
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
+
+// What a ring writes, an eventfd takes nothing shorter than a counter.
+#if defined(__linux__)
+typedef uint64_t doorbell_value_t;
+#else
+typedef char doorbell_value_t;
+#endif
+
+#include "adb.h"
+
+static_assert((PacketQueue::kCapacity & (PacketQueue::kCapacity - 1)) == 0,
+              "PacketQueue::kCapacity must be a power of two");
+
+bool PacketQueue::Enqueue(apacket* p) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) == kCapacity) {
+        return false;
+    }
+    slots_[tail & (kCapacity - 1)] = p;
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+// Every packet in the ring is older than every packet on the overflow list:
+// Post only uses the ring while the list is empty.
+apacket* PacketQueue::Dequeue() {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head != tail_.load(std::memory_order_acquire)) {
+        apacket* p = slots_[head & (kCapacity - 1)];
+        head_.store(head + 1, std::memory_order_release);
+        return p;
+    }
+    if (overflow_size_.load(std::memory_order_acquire) == 0) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(overflow_mutex_);
+    apacket* p = overflow_.front();
+    overflow_.pop_front();
+    overflow_size_.fetch_sub(1, std::memory_order_release);
+    return p;
+}
+
+bool PacketQueue::TryPush(apacket* p) {
+    if (!Enqueue(p)) {
+        return false;
+    }
+    Wake();
+    return true;
+}
+
+void PacketQueue::Push(apacket* p) {
+    if (TryPush(p)) {
+        return;
+    }
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        waiters_.fetch_add(1, std::memory_order_seq_cst);
+        while (!Enqueue(p)) {
+            cv_.wait(lock);
+        }
+        waiters_.fetch_sub(1, std::memory_order_relaxed);
+    }
+    Wake();
+}
+
+bool PacketQueue::Post(apacket* p) {
+    if (closed_.load(std::memory_order_acquire)) {
+        return false;
+    }
+    if (overflow_size_.load(std::memory_order_acquire) != 0 || !Enqueue(p)) {
+        std::lock_guard<std::mutex> lock(overflow_mutex_);
+        overflow_.push_back(p);
+        overflow_size_.fetch_add(1, std::memory_order_release);
+    }
+    Wake();
+    return true;
+}
+
+apacket* PacketQueue::TryPop() {
+    apacket* p = Dequeue();
+    if (p != nullptr) {
+        Wake();
+    }
+    return p;
+}
+
+apacket* PacketQueue::Pop() {
+    apacket* p = TryPop();
+    if (p != nullptr) {
+        return p;
+    }
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        waiters_.fetch_add(1, std::memory_order_seq_cst);
+        while ((p = Dequeue()) == nullptr) {
+            cv_.wait(lock);
+        }
+        waiters_.fetch_sub(1, std::memory_order_relaxed);
+    }
+    Wake();
+    return p;
+}
+
+void PacketQueue::Close() {
+    closed_.store(true, std::memory_order_release);
+}
+
+// Called after every change of head_ or tail_, with mutex_ not held. A
+// waiter registers itself before its final check under the mutex, so taking
+// the mutex here before notifying means that it either sees the change or
+// gets the notification.
+void PacketQueue::Wake() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiters_.load(std::memory_order_relaxed) != 0) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        cv_.notify_all();
+    }
+}
+
+Doorbell::~Doorbell() {
+    Close();
+}
+
+bool Doorbell::Open() {
+#if defined(__linux__)
+    int fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (fd == -1) {
+        return false;
+    }
+    read_fd_ = write_fd_ = fd;
+#else
+    int s[2];
+    if (adb_socketpair(s)) {
+        return false;
+    }
+    read_fd_ = s[0];
+    write_fd_ = s[1];
+#endif
+    return true;
+}
+
+int Doorbell::ReleaseFd() {
+    read_fd_owned_ = false;
+    return read_fd_;
+}
+
+void Doorbell::Close() {
+    if (write_fd_ != -1 && write_fd_ != read_fd_) {
+        adb_close(write_fd_);
+    }
+    if (read_fd_ != -1 && read_fd_owned_) {
+        adb_close(read_fd_);
+    }
+    read_fd_ = write_fd_ = -1;
+}
+
+void Doorbell::Ring() {
+    if (rung_.exchange(true)) {
+        return;
+    }
+    doorbell_value_t one = 1;
+    if (adb_write(write_fd_, &one, sizeof(one)) != sizeof(one)) {
+        PLOG(ERROR) << "failed to ring doorbell fd " << write_fd_;
+    }
+}
+
+void Doorbell::Clear() {
+    // Read before the flag drops, a ring in between then finds the flag
+    // still set and leaves its work to the caller's coming look.
+    doorbell_value_t value;
+    adb_read(read_fd_, &value, sizeof(value));
+    rung_.store(false);
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __PACKET_QUEUE_H
+#define __PACKET_QUEUE_H
+
+#include <stddef.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+#include <android-base/macros.h>
+
+struct apacket;
+
+// A bounded, lock-free queue of packets with exactly one producer thread and
+// one consumer thread, used between the transport threads and the fdevent
+// main thread. TryPush and TryPop never block. Push and Pop wait on a
+// condition variable, but only once the queue is full or empty, so a busy
+// transport moves packets without taking a lock or making a syscall.
+//
+// A producer that must never wait, like the main thread, uses Post instead:
+// once the ring is full its packets go on an unbounded overflow list, which
+// the consumer drains in order after the ring.
+class PacketQueue {
+  public:
+    static constexpr size_t kCapacity = 32;  // Must be a power of two.
+
+    PacketQueue() = default;
+
+    // Producer side.
+    bool TryPush(apacket* p);
+    void Push(apacket* p);
+    // Never blocks. Returns false, leaving 'p' to the caller, if the consumer
+    // has closed the queue. Don't mix with TryPush and Push.
+    bool Post(apacket* p);
+
+    // Consumer side. TryPop returns nullptr if the queue is empty.
+    apacket* TryPop();
+    apacket* Pop();
+    // The consumer is going away, Post refuses packets from now on. Packets
+    // already queued stay until they are popped.
+    void Close();
+
+  private:
+    bool Enqueue(apacket* p);
+    apacket* Dequeue();
+    void Wake();
+
+    // head_ is only written by the consumer, tail_ only by the producer.
+    std::atomic<size_t> head_{0};
+    std::atomic<size_t> tail_{0};
+    apacket* slots_[kCapacity] = {};
+
+    // Post's packets that didn't fit in the ring. Only the producer adds to
+    // overflow_size_, so once it sees zero, the ring is all there is.
+    std::mutex overflow_mutex_;
+    std::deque<apacket*> overflow_;
+    std::atomic<size_t> overflow_size_{0};
+    std::atomic<bool> closed_{false};
+
+    // Slow path, for a side that has to wait for the other.
+    std::atomic<int> waiters_{0};
+    std::mutex mutex_;
+    std::condition_variable cv_;
+
+    DISALLOW_COPY_AND_ASSIGN(PacketQueue);
+};
+
+// An fd for fdevent that is readable while the doorbell is rung. Rings are
+// coalesced, a producer only touches the fd when the consumer has cleared
+// the doorbell since the last ring. This is an eventfd on Linux and a
+// socketpair elsewhere.
+class Doorbell {
+  public:
+    Doorbell() = default;
+    ~Doorbell();
+
+    bool Open();
+    // Hand the readable fd to the caller, typically for fdevent_install,
+    // which then owns and closes it. The doorbell can still be rung, so the
+    // new owner must not close the fd while any thread might ring it.
+    int ReleaseFd();
+
+    // Any thread.
+    void Ring();
+    // The owner of the fd, before it looks for work.
+    void Clear();
+
+  private:
+    void Close();
+
+    int read_fd_ = -1;
+    int write_fd_ = -1;
+    bool read_fd_owned_ = true;
+    std::atomic<bool> rung_{false};
+
+    DISALLOW_COPY_AND_ASSIGN(Doorbell);
+};
+
+#endif  // __PACKET_QUEUE_H
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "packet_queue.h"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include "sysdeps.h"
+
+// The queue never looks inside a packet, any distinct pointers will do.
+static apacket* fake_packet(uintptr_t i) {
+    return reinterpret_cast<apacket*>(i + 1);
+}
+
+TEST(packet_queue, fifo) {
+    PacketQueue queue;
+    ASSERT_EQ(nullptr, queue.TryPop());
+    for (size_t i = 0; i < PacketQueue::kCapacity; ++i) {
+        ASSERT_TRUE(queue.TryPush(fake_packet(i)));
+    }
+    ASSERT_FALSE(queue.TryPush(fake_packet(PacketQueue::kCapacity)));
+    for (size_t i = 0; i < PacketQueue::kCapacity; ++i) {
+        ASSERT_EQ(fake_packet(i), queue.TryPop());
+    }
+    ASSERT_EQ(nullptr, queue.TryPop());
+}
+
+TEST(packet_queue, blocking_producer_consumer) {
+    // Many more packets than fit, so that both sides end up waiting.
+    static constexpr size_t kCount = 100000;
+    PacketQueue queue;
+    std::thread producer([&queue]() {
+        for (size_t i = 0; i < kCount; ++i) {
+            queue.Push(fake_packet(i));
+        }
+    });
+    for (size_t i = 0; i < kCount; ++i) {
+        ASSERT_EQ(fake_packet(i), queue.Pop());
+    }
+    producer.join();
+    ASSERT_EQ(nullptr, queue.TryPop());
+}
+
+TEST(packet_queue, post_overflows_in_order) {
+    PacketQueue queue;
+    static constexpr size_t kCount = PacketQueue::kCapacity * 4;
+    for (size_t i = 0; i < kCount / 2; ++i) {
+        ASSERT_TRUE(queue.Post(fake_packet(i)));
+    }
+    // Room in the ring again, but the overflow list goes first.
+    ASSERT_EQ(fake_packet(0), queue.TryPop());
+    for (size_t i = kCount / 2; i < kCount; ++i) {
+        ASSERT_TRUE(queue.Post(fake_packet(i)));
+    }
+    for (size_t i = 1; i < kCount; ++i) {
+        ASSERT_EQ(fake_packet(i), queue.TryPop());
+    }
+    ASSERT_EQ(nullptr, queue.TryPop());
+}
+
+TEST(packet_queue, post_never_blocks) {
+    static constexpr size_t kCount = 100000;
+    PacketQueue queue;
+    std::thread producer([&queue]() {
+        for (size_t i = 0; i < kCount; ++i) {
+            ASSERT_TRUE(queue.Post(fake_packet(i)));
+        }
+    });
+    for (size_t i = 0; i < kCount; ++i) {
+        ASSERT_EQ(fake_packet(i), queue.Pop());
+    }
+    producer.join();
+    ASSERT_EQ(nullptr, queue.TryPop());
+}
+
+TEST(packet_queue, post_after_close) {
+    PacketQueue queue;
+    ASSERT_TRUE(queue.Post(fake_packet(0)));
+    queue.Close();
+    ASSERT_FALSE(queue.Post(fake_packet(1)));
+    ASSERT_EQ(fake_packet(0), queue.TryPop());
+    ASSERT_EQ(nullptr, queue.TryPop());
+}
+
+TEST(packet_queue, doorbell) {
+    Doorbell doorbell;
+    ASSERT_TRUE(doorbell.Open());
+    int fd = doorbell.ReleaseFd();
+
+    adb_pollfd pfd = {.fd = fd, .events = POLLIN};
+    ASSERT_EQ(0, adb_poll(&pfd, 1, 0));
+
+    // Rings coalesce until the doorbell is cleared.
+    doorbell.Ring();
+    doorbell.Ring();
+    ASSERT_EQ(1, adb_poll(&pfd, 1, 0));
+    doorbell.Clear();
+    ASSERT_EQ(0, adb_poll(&pfd, 1, 0));
+
+    doorbell.Ring();
+    ASSERT_EQ(1, adb_poll(&pfd, 1, 0));
+    doorbell.Clear();
+
+    ASSERT_EQ(0, adb_close(fd));
+}
@@ -320,7 +320,10 @@ int service_to_fd(const char* name, const atransport* transport) {
     } else if(!strncmp(name, "exec:", 5)) {
         ret = StartSubprocess(name + 5, nullptr, SubprocessType::kRaw, SubprocessProtocol::kNone);
     } else if(!strncmp(name, "sync:", 5)) {
-        ret = create_service_thread(file_sync_service, NULL);
+        // The sync service may agree on chunks up to a packet in size.
+        size_t max_payload = transport ? transport->get_max_payload() : SYNC_DATA_MAX;
+        ret = create_service_thread(file_sync_service,
+                                    reinterpret_cast<void*>(static_cast<uintptr_t>(max_payload)));
     } else if(!strncmp(name, "remount:", 8)) {
         ret = create_service_thread(remount_service, NULL);
     } else if(!strncmp(name, "reboot:", 7)) {
@@ -336,6 +336,9 @@ static void local_socket_event_func(int fd, unsigned ev, void* _s) {
             put_apacket(p);
         } else {
             p->len = max_payload - avail;
+            // Interactive traffic comes in small reads, don't let those
+            // sit in the transport queues with a full sized buffer.
+            p = shrink_apacket(p);
 
             // s->peer->enqueue() may call s->close() and free s,
             // so save variables for debug printing below.
@@ -461,7 +464,7 @@ static int remote_socket_enqueue(asocket* s, apacket* p) {
 
 static void remote_socket_ready(asocket* s) {
     D("entered remote_socket_ready RS(%d) OKAY fd=%d peer.fd=%d", s->id, s->fd, s->peer->fd);
-    apacket* p = get_apacket();
+    apacket* p = get_apacket(0);
     p->msg.command = A_OKAY;
     p->msg.arg0 = s->peer->id;
     p->msg.arg1 = s->id;
@@ -471,7 +474,7 @@ static void remote_socket_ready(asocket* s) {
 static void remote_socket_shutdown(asocket* s) {
     D("entered remote_socket_shutdown RS(%d) CLOSE fd=%d peer->fd=%d", s->id, s->fd,
       s->peer ? s->peer->fd : -1);
-    apacket* p = get_apacket();
+    apacket* p = get_apacket(0);
     p->msg.command = A_CLSE;
     if (s->peer) {
         p->msg.arg0 = s->peer->id;
@@ -518,12 +521,12 @@ asocket* create_remote_socket(unsigned id, atransport* t) {
 
 void connect_to_remote(asocket* s, const char* destination) {
     D("Connect_to_remote call RS(%d) fd=%d", s->id, s->fd);
-    apacket* p = get_apacket();
     size_t len = strlen(destination) + 1;
 
     if (len > (s->get_max_payload() - 1)) {
         fatal("destination oversized");
     }
+    apacket* p = get_apacket(len);
 
     D("LS(%d): connect('%s')", s->id, destination);
     p->msg.command = A_OPEN;
@@ -658,6 +661,14 @@ static int smart_socket_enqueue(asocket* s, apacket* p) {
     D("SS(%d): enqueue %d", s->id, p->len);
 
     if (s->pkt_first == 0) {
+        // The request is collected in place, it needs a full sized packet.
+        if (p->capacity < MAX_PAYLOAD) {
+            apacket* large = get_apacket();
+            large->len = p->len;
+            memcpy(large->data, p->data, p->len);
+            put_apacket(p);
+            p = large;
+        }
         s->pkt_first = p;
         s->pkt_last = p;
     } else {
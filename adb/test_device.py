@@ -783,6 +783,87 @@ class FileOperationsTest(DeviceTest):
 
             self.assertIn('Permission denied', output)
 
+    def _remote_md5s(self, remote_dir):
+        """Maps the base name of each file in remote_dir to its md5."""
+        output = self.device.shell(
+            ['cd', remote_dir, '&&', get_md5_prog(self.device), '*'])[0]
+        md5s = {}
+        for line in output.splitlines():
+            md5, name = line.split()
+            md5s[name] = md5
+        return md5s
+
+    def test_push_dir_error_in_middle(self):
+        """A file that can't be written fails alone, later files still land.
+
+        The device reads the rest of a failed file and goes on, so that a
+        pipelined push gets the status of every file in order.
+        """
+        self.device.shell(['rm', '-rf', self.DEVICE_TEMP_DIR])
+
+        try:
+            host_dir = tempfile.mkdtemp()
+            os.chmod(host_dir, 0o700)
+
+            md5s = {}
+            for name in ['a', 'b', 'c', 'd', 'e']:
+                data = os.urandom(64 * 1024 + 1)
+                with open(os.path.join(host_dir, name), 'wb') as f:
+                    f.write(data)
+                md5s[name] = compute_md5(data)
+
+            # A directory where 'c' should go can't be opened for writing.
+            remote_dir = posixpath.join(self.DEVICE_TEMP_DIR,
+                                        os.path.basename(host_dir))
+            self.device.shell(['mkdir', '-p', posixpath.join(remote_dir, 'c')])
+
+            try:
+                self.device.push(host_dir, self.DEVICE_TEMP_DIR)
+                self.fail('push should not have succeeded')
+            except subprocess.CalledProcessError as e:
+                output = e.output
+
+            self.assertIn(os.path.join(host_dir, 'c'), output)
+            self.assertIn(posixpath.join(remote_dir, 'c'), output)
+            for name in ['a', 'b', 'd', 'e']:
+                self.assertNotIn(os.path.join(host_dir, name) + "'", output)
+
+            remote_md5s = self._remote_md5s(remote_dir)
+            for name in ['a', 'b', 'd', 'e']:
+                self.assertEqual(md5s[name], remote_md5s[name])
+            self.device.shell(['rm', '-rf', self.DEVICE_TEMP_DIR])
+        finally:
+            if host_dir is not None:
+                shutil.rmtree(host_dir)
+
+    def test_push_dir_many_files(self):
+        """Push more files than the client lets statuses pile up for."""
+        self.device.shell(['rm', '-rf', self.DEVICE_TEMP_DIR])
+        self.device.shell(['mkdir', self.DEVICE_TEMP_DIR])
+
+        try:
+            host_dir = tempfile.mkdtemp()
+            os.chmod(host_dir, 0o700)
+
+            # More than kMaxPendingCopies in file_sync_client.cpp.
+            md5s = {}
+            for i in xrange(1100):
+                name = 'file{}'.format(i)
+                data = os.urandom(random.randrange(0, 4096))
+                with open(os.path.join(host_dir, name), 'wb') as f:
+                    f.write(data)
+                md5s[name] = compute_md5(data)
+
+            self.device.push(host_dir, self.DEVICE_TEMP_DIR)
+
+            remote_dir = posixpath.join(self.DEVICE_TEMP_DIR,
+                                        os.path.basename(host_dir))
+            self.assertEqual(md5s, self._remote_md5s(remote_dir))
+            self.device.shell(['rm', '-rf', self.DEVICE_TEMP_DIR])
+        finally:
+            if host_dir is not None:
+                shutil.rmtree(host_dir)
+
     def _test_pull(self, remote_file, checksum):
         tmp_write = tempfile.NamedTemporaryFile(mode='wb', delete=False)
         tmp_write.close()
@@ -820,6 +901,42 @@ class FileOperationsTest(DeviceTest):
         self._test_pull(self.DEVICE_TEMP_FILE, dev_md5)
         self.device.shell_nocheck(['rm', self.DEVICE_TEMP_FILE])
 
+    def test_push_large(self):
+        """Push a file of several chunks that doesn't end on a chunk."""
+        tmp = tempfile.NamedTemporaryFile(mode='wb', delete=False)
+        rand_str = os.urandom(5 * 256 * 1024 + 17)
+        tmp.write(rand_str)
+        tmp.close()
+
+        self.device.shell(['rm', '-rf', self.DEVICE_TEMP_FILE])
+        self.device.push(local=tmp.name, remote=self.DEVICE_TEMP_FILE)
+
+        self._verify_remote(compute_md5(rand_str), self.DEVICE_TEMP_FILE)
+        self.device.shell(['rm', '-f', self.DEVICE_TEMP_FILE])
+
+        os.remove(tmp.name)
+
+    def test_pull_large(self):
+        """Pull a file of several chunks that doesn't end on a chunk."""
+        self.device.shell(['rm', '-rf', self.DEVICE_TEMP_FILE])
+        cmd = ['dd', 'if=/dev/urandom',
+               'of={}'.format(self.DEVICE_TEMP_FILE), 'bs=1000', 'count=1337']
+        self.device.shell(cmd)
+        dev_md5, _ = self.device.shell(
+            [get_md5_prog(self.device), self.DEVICE_TEMP_FILE])[0].split()
+        self._test_pull(self.DEVICE_TEMP_FILE, dev_md5)
+        self.device.shell_nocheck(['rm', self.DEVICE_TEMP_FILE])
+
+    def test_pull_sysfs(self):
+        """Pull files that hold less than their size says.
+
+        sysfs attributes claim 4096 bytes, procfs files none at all.
+        """
+        for remote_path in ['/sys/devices/system/cpu/online', '/proc/version']:
+            dev_md5, _ = self.device.shell(
+                [get_md5_prog(self.device), remote_path])[0].split()
+            self._test_pull(remote_path, dev_md5)
+
     def test_pull_dir(self):
         """Pull a randomly generated directory of files from the device."""
         try:
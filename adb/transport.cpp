@@ -47,6 +47,8 @@ ADB_MUTEX_DEFINE( transport_lock );
 
 const char* const kFeatureShell2 = "shell_v2";
 const char* const kFeatureCmd = "cmd";
+const char* const kFeaturePushPipeline = "push_pipeline";
+const char* const kFeatureSyncChunk = "sync_chunk";
 
 static std::string dump_packet(const char* name, const char* func, apacket* p) {
     unsigned  command = p->msg.command;
@@ -85,67 +87,26 @@ static std::string dump_packet(const char* name, const char* func, apacket* p) {
     return result;
 }
 
-static int
-read_packet(int  fd, const char* name, apacket** ppacket)
-{
-    char buff[8];
-    if (!name) {
-        snprintf(buff, sizeof buff, "fd=%d", fd);
-        name = buff;
-    }
-    char* p = reinterpret_cast<char*>(ppacket);  /* really read a packet address */
-    int len = sizeof(apacket*);
-    while(len > 0) {
-        int r = adb_read(fd, p, len);
-        if(r > 0) {
-            len -= r;
-            p += r;
-        } else {
-            D("%s: read_packet (fd=%d), error ret=%d: %s", name, fd, r, strerror(errno));
-            return -1;
+// The main thread is rung when the read_transport thread has queued packets
+// for it, handle_packet() is then called for every packet queued so far.
+static void transport_doorbell_events(int fd, unsigned events, void* _t) {
+    atransport* t = reinterpret_cast<atransport*>(_t);
+    D("transport_doorbell_events(fd=%d, events=%04x,...)", fd, events);
+    if (events & FDE_READ) {
+        t->doorbell.Clear();
+        apacket* p;
+        while ((p = t->from_remote.TryPop()) != nullptr) {
+            VLOG(TRANSPORT) << dump_packet(t->serial, "from remote", p);
+            handle_packet(p, t);
         }
     }
-
-    VLOG(TRANSPORT) << dump_packet(name, "from remote", *ppacket);
-    return 0;
 }
 
-static int
-write_packet(int  fd, const char* name, apacket** ppacket)
-{
-    char buff[8];
-    if (!name) {
-        snprintf(buff, sizeof buff, "fd=%d", fd);
-        name = buff;
-    }
-    VLOG(TRANSPORT) << dump_packet(name, "to remote", *ppacket);
-    char* p = reinterpret_cast<char*>(ppacket);  /* we really write the packet address */
-    int len = sizeof(apacket*);
-    while(len > 0) {
-        int r = adb_write(fd, p, len);
-        if(r > 0) {
-            len -= r;
-            p += r;
-        } else {
-            D("%s: write_packet (fd=%d) error ret=%d: %s", name, fd, r, strerror(errno));
-            return -1;
-        }
-    }
-    return 0;
-}
-
-static void transport_socket_events(int fd, unsigned events, void *_t)
-{
-    atransport *t = reinterpret_cast<atransport*>(_t);
-    D("transport_socket_events(fd=%d, events=%04x,...)", fd, events);
-    if(events & FDE_READ){
-        apacket *p = 0;
-        if(read_packet(fd, t->serial, &p)){
-            D("%s: failed to read packet from transport socket on fd %d", t->serial, fd);
-        } else {
-            handle_packet(p, (atransport *) _t);
-        }
-    }
+// Hands a packet from the read_transport thread to the main thread, waiting
+// for room if the main thread is that far behind.
+static void queue_from_remote(atransport* t, apacket* p) {
+    t->from_remote.Push(p);
+    t->doorbell.Ring();
 }
 
 void send_packet(apacket *p, atransport *t)
@@ -173,8 +134,11 @@ void send_packet(apacket *p, atransport *t)
         fatal_errno("Transport is null");
     }
 
-    if(write_packet(t->transport_socket, t->serial, &p)){
-        fatal_errno("cannot enqueue packet on transport socket");
+    VLOG(TRANSPORT) << dump_packet(t->serial, "to remote", p);
+    // The main thread must never wait for a slow or dead transport.
+    if (!t->to_remote.Post(p)) {
+        D("%s: write_transport thread is gone, dropping packet", t->serial);
+        put_apacket(p);
     }
 }
 
@@ -197,18 +161,14 @@ static void read_transport_thread(void* _t) {
 
     adb_thread_setname(android::base::StringPrintf("<-%s",
                                                    (t->serial != nullptr ? t->serial : "transport")));
-    D("%s: starting read_transport thread on fd %d, SYNC online (%d)",
-       t->serial, t->fd, t->sync_token + 1);
-    p = get_apacket();
+    D("%s: starting read_transport thread, SYNC online (%d)",
+       t->serial, t->sync_token + 1);
+    p = get_apacket(0);
     p->msg.command = A_SYNC;
     p->msg.arg0 = 1;
     p->msg.arg1 = ++(t->sync_token);
     p->msg.magic = A_SYNC ^ 0xffffffff;
-    if(write_packet(t->fd, t->serial, &p)) {
-        put_apacket(p);
-        D("%s: failed to write SYNC packet", t->serial);
-        goto oops;
-    }
+    queue_from_remote(t, p);
 
     D("%s: data pump started", t->serial);
     for(;;) {
@@ -217,11 +177,7 @@ static void read_transport_thread(void* _t) {
         if(t->read_from_remote(p, t) == 0){
             D("%s: received remote packet, sending to transport",
               t->serial);
-            if(write_packet(t->fd, t->serial, &p)){
-                put_apacket(p);
-                D("%s: failed to write apacket to transport", t->serial);
-                goto oops;
-            }
+            queue_from_remote(t, shrink_apacket(p));
         } else {
             D("%s: remote read failed for transport", t->serial);
             put_apacket(p);
@@ -230,17 +186,13 @@ static void read_transport_thread(void* _t) {
     }
 
     D("%s: SYNC offline for transport", t->serial);
-    p = get_apacket();
+    p = get_apacket(0);
     p->msg.command = A_SYNC;
     p->msg.arg0 = 0;
     p->msg.arg1 = 0;
     p->msg.magic = A_SYNC ^ 0xffffffff;
-    if(write_packet(t->fd, t->serial, &p)) {
-        put_apacket(p);
-        D("%s: failed to write SYNC apacket to transport", t->serial);
-    }
+    queue_from_remote(t, p);
 
-oops:
     D("%s: read_transport thread is exiting", t->serial);
     kick_transport(t);
     transport_unref(t);
@@ -255,15 +207,10 @@ static void write_transport_thread(void* _t) {
 
     adb_thread_setname(android::base::StringPrintf("->%s",
                                                    (t->serial != nullptr ? t->serial : "transport")));
-    D("%s: starting write_transport thread, reading from fd %d",
-       t->serial, t->fd);
+    D("%s: starting write_transport thread", t->serial);
 
     for(;;){
-        if(read_packet(t->fd, t->serial, &p)) {
-            D("%s: failed to read apacket from transport on fd %d",
-               t->serial, t->fd );
-            break;
-        }
+        p = t->to_remote.Pop();
         if(p->msg.command == A_SYNC){
             if(p->msg.arg0 == 0) {
                 D("%s: transport SYNC offline", t->serial);
@@ -290,7 +237,8 @@ static void write_transport_thread(void* _t) {
         put_apacket(p);
     }
 
-    D("%s: write_transport thread is exiting, fd %d", t->serial, t->fd);
+    D("%s: write_transport thread is exiting", t->serial);
+    t->to_remote.Close();
     kick_transport(t);
     transport_unref(t);
 }
@@ -369,7 +317,7 @@ device_tracker_enqueue( asocket*  socket, apacket*  p )
 }
 
 static int device_tracker_send(device_tracker* tracker, const std::string& string) {
-    apacket* p = get_apacket();
+    apacket* p = get_apacket(4 + string.size());
     asocket* peer = tracker->socket.peer;
 
     snprintf(reinterpret_cast<char*>(p->data), 5, "%04x", static_cast<int>(string.size()));
@@ -481,7 +429,6 @@ transport_write_action(int  fd, struct tmsg*  m)
 static void transport_registration_func(int _fd, unsigned ev, void *data)
 {
     tmsg m;
-    int s[2];
     atransport *t;
 
     if(!(ev & FDE_READ)) {
@@ -495,13 +442,18 @@ static void transport_registration_func(int _fd, unsigned ev, void *data)
     t = m.transport;
 
     if (m.action == 0) {
-        D("transport: %s removing and free'ing %d", t->serial, t->transport_socket);
+        D("transport: %s removing and free'ing", t->serial);
 
-            /* IMPORTANT: the remove closes one half of the
-            ** socket pair.  The close closes the other half.
-            */
+        // The remove closes the doorbell. Both transport threads are gone,
+        // whatever they left queued is dropped.
         fdevent_remove(&(t->transport_fde));
-        adb_close(t->fd);
+        apacket* p;
+        while ((p = t->from_remote.TryPop()) != nullptr) {
+            put_apacket(p);
+        }
+        while ((p = t->to_remote.TryPop()) != nullptr) {
+            put_apacket(p);
+        }
 
         adb_mutex_lock(&transport_lock);
         transport_list.remove(t);
@@ -529,18 +481,15 @@ static void transport_registration_func(int _fd, unsigned ev, void *data)
         /* initial references are the two threads */
         t->ref_count = 2;
 
-        if (adb_socketpair(s)) {
-            fatal_errno("cannot open transport socketpair");
+        if (!t->doorbell.Open()) {
+            fatal_errno("cannot open transport doorbell");
         }
 
-        D("transport: %s socketpair: (%d,%d) starting", t->serial, s[0], s[1]);
-
-        t->transport_socket = s[0];
-        t->fd = s[1];
+        D("transport: %s starting", t->serial);
 
         fdevent_install(&(t->transport_fde),
-                        t->transport_socket,
-                        transport_socket_events,
+                        t->doorbell.ReleaseFd(),
+                        transport_doorbell_events,
                         t);
 
         fdevent_set(&(t->transport_fde), FDE_READ);
@@ -784,7 +733,9 @@ const FeatureSet& supported_features() {
     // Local static allocation to avoid global non-POD variables.
     static const FeatureSet* features = new FeatureSet{
         kFeatureShell2,
-        kFeatureCmd
+        kFeatureCmd,
+        kFeaturePushPipeline,
+        kFeatureSyncChunk
         // Increment ADB_SERVER_VERSION whenever the feature list changes to
         // make sure that the adb client and server features stay in sync
         // (http://b/24370690).
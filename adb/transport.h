@@ -24,6 +24,7 @@
 #include <unordered_set>
 
 #include "adb.h"
+#include "packet_queue.h"
 
 typedef std::unordered_set<std::string> FeatureSet;
 
@@ -41,6 +42,11 @@ bool CanUseFeature(const FeatureSet& feature_set, const std::string& feature);
 extern const char* const kFeatureShell2;
 // The 'cmd' command is available
 extern const char* const kFeatureCmd;
+// The sync service answers every ID_SEND with exactly one status, in order,
+// and keeps going after a failed one, so files can be pushed back to back.
+extern const char* const kFeaturePushPipeline;
+// The sync service takes ID_CHNK, to agree on chunks larger than SYNC_DATA_MAX.
+extern const char* const kFeatureSyncChunk;
 
 class atransport {
 public:
@@ -68,8 +74,14 @@ public:
     }
     void Kick();
 
-    int fd = -1;
-    int transport_socket = -1;
+    // Packets the read_transport thread hands to the main thread, and those
+    // the main thread posts, without ever waiting, to the write_transport
+    // thread.
+    PacketQueue from_remote;
+    PacketQueue to_remote;
+    // Rung when from_remote has packets, the main thread watches it through
+    // transport_fde.
+    Doorbell doorbell;
     fdevent transport_fde;
     size_t ref_count = 0;
     uint32_t sync_token = 0;
@@ -679,6 +679,14 @@ int __android_log_is_loggable(int prio, const char *tag, int default_prio);
 
 int __android_log_security(); /* Device Owner is present */
 
+/*
+ * Non-zero opts this process into buffered writes to logd: each thread
+ * stages its log lines and sends them in bursts, flushed when full, when a
+ * line of ANDROID_LOG_WARN or higher is logged, or after 100ms. Zero sends
+ * each line as it is logged, the default. Returns the previous setting.
+ */
+int __android_log_set_buffered(int enable);
+
 int __android_log_error_write(int tag, const char *subTag, int32_t uid, const char *data,
                               uint32_t dataLen);
 
@@ -5,6 +5,7 @@
 
 #include <pthread.h>
 #include <cutils/atomic.h>
+#include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/uio.h>
 
@@ -62,6 +63,10 @@ public:
     int sendData(const void *data, int len);
     // iovec contents not preserved through call
     int sendDatav(struct iovec *iov, int iovcnt);
+    // Several messages in as few system calls as possible, message
+    // boundaries are kept (eg: one record per SOCK_SEQPACKET packet).
+    // mmsghdr and iovec contents not preserved through call
+    int sendMultipleDatav(struct mmsghdr *msgs, unsigned int count);
 
     // Optional reference counting.  Reference count starts at 1.  If
     // it's decremented to 0, it deletes itself.
@@ -82,6 +87,7 @@ private:
     // returns 0 if successful, -1 if there is a 0 byte write or if any
     // other error occurred (use errno to get the error)
     int sendDataLockedv(struct iovec *iov, int iovcnt);
+    int sendMultipleDataLockedv(struct mmsghdr *msgs, unsigned int count);
 };
 
 typedef android::sysutils::List<SocketClient *> SocketClientCollection;
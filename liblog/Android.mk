@@ -79,7 +79,32 @@ LOCAL_LDFLAGS_arm := -Wl,--hash-style=both
 
 LOCAL_SANITIZE := never
 LOCAL_CXX_STL := none
+LOCAL_REQUIRED_MODULES := event-log-tags.bin
 
 include $(BUILD_SHARED_LIBRARY)
 
+# Precompiled event-log-tags index, see event_tag_map.c
+# ========================================================
+include $(CLEAR_VARS)
+LOCAL_MODULE := event-log-tags-index
+LOCAL_SRC_FILES := event_tag_index.c
+LOCAL_CFLAGS := -Werror
+LOCAL_STATIC_LIBRARIES := liblog
+LOCAL_MODULE_HOST_OS := darwin linux
+include $(BUILD_HOST_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := event-log-tags.bin
+LOCAL_MODULE_CLASS := ETC
+LOCAL_MODULE_PATH := $(TARGET_OUT_ETC)
+include $(BUILD_SYSTEM)/base_rules.mk
+
+event_log_tags_index := $(HOST_OUT_EXECUTABLES)/event-log-tags-index$(HOST_EXECUTABLE_SUFFIX)
+$(LOCAL_BUILT_MODULE): PRIVATE_INDEX := $(event_log_tags_index)
+$(LOCAL_BUILT_MODULE): $(TARGET_OUT_ETC)/event-log-tags $(event_log_tags_index)
+	@echo "Event log tags index: $@"
+	$(hide) mkdir -p $(dir $@)
+	$(hide) $(PRIVATE_INDEX) $< $@
+event_log_tags_index :=
+
 include $(call first-makefiles-under,$(LOCAL_PATH))
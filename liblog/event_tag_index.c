@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Build time compiler of the event-log-tags file into the precompiled
+ * index that android_openEventTagMap() maps in its place.
+ *
+ *   event-log-tags-index <event-log-tags> <event-log-tags.bin>
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "logger.h"
+
+int main(int argc, char** argv)
+{
+    FILE* fp;
+    int ret;
+
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <event-log-tags> <index>\n", argv[0]);
+        return 1;
+    }
+
+    fp = fopen(argv[2], "we");
+    if (fp == NULL) {
+        fprintf(stderr, "%s: %s: %s\n", argv[0], argv[2], strerror(errno));
+        return 1;
+    }
+
+    ret = __android_log_write_event_tag_index(argv[1], fp);
+    if (fclose(fp) != 0) {
+        ret = -1;
+    }
+    if (ret != 0) {
+        fprintf(stderr, "%s: failed to index %s\n", argv[0], argv[1]);
+        unlink(argv[2]);
+        return 1;
+    }
+    return 0;
+}
@@ -17,14 +17,20 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <log/event_tag_map.h>
 #include <log/log.h>
 
 #include "log_portability.h"
+#include "logger.h"
 
 #define OUT_TAG "EventTagMap"
 
@@ -36,6 +42,30 @@ typedef struct EventTag {
     const char*     tagStr;
 } EventTag;
 
+/*
+ * Precompiled index, as written by __android_log_write_event_tag_index().
+ * Native byte order, all offsets are from the start of the file:
+ *
+ *     EventTagIndexHeader header;
+ *     uint32_t            tags[numTags];   sorted tag numbers
+ *     uint32_t            names[numTags];  offset of each tag string
+ *     char                strings[];       nul terminated tag strings
+ *
+ * The file always ends in a nul, so that any string offset inside the file
+ * is a terminated string. It is used where it is mapped, read-only and
+ * shared, there is nothing to parse.
+ */
+#define EVENT_TAG_INDEX_MAGIC   0x78644945 /* "EIdx" read in native order */
+#define EVENT_TAG_INDEX_VERSION 1
+#define EVENT_TAG_INDEX_SUFFIX  ".bin"
+
+typedef struct EventTagIndexHeader {
+    uint32_t        magic;
+    uint32_t        version;
+    uint32_t        size;           /* of the whole file */
+    uint32_t        numTags;
+} EventTagIndexHeader;
+
 /*
  * Map.
  */
@@ -47,9 +77,16 @@ struct EventTagMap {
     /* array of event tags, sorted numerically by tag index */
     EventTag*       tagArray;
     int             numTags;
+
+    /* or, mapped from a precompiled index, tagArray is NULL */
+    const uint32_t* indexTags;
+    const uint32_t* indexNames;
 };
 
 /* fwd */
+static EventTagMap* openIndex(const char* fileName);
+static EventTagMap* openFile(const char* fileName);
+static int processIndex(EventTagMap* map);
 static int processFile(EventTagMap* map);
 static int countMapLines(const EventTagMap* map);
 static int parseMapLines(EventTagMap* map);
@@ -60,10 +97,26 @@ static int sortTags(EventTagMap* map);
 /*
  * Open the map file and allocate a structure to manage it.
  *
+ * A precompiled index alongside the file, fileName.bin, is used in its
+ * place unless it is older than the file.
+ */
+LIBLOG_ABI_PUBLIC EventTagMap* android_openEventTagMap(const char* fileName)
+{
+    EventTagMap* newTagMap = openIndex(fileName);
+
+    if (newTagMap != NULL)
+        return newTagMap;
+
+    return openFile(fileName);
+}
+
+/*
+ * Open the map file itself, which may also be an index.
+ *
  * We create a private mapping because we want to terminate the log tag
  * strings with '\0'.
  */
-LIBLOG_ABI_PUBLIC EventTagMap* android_openEventTagMap(const char* fileName)
+static EventTagMap* openFile(const char* fileName)
 {
     EventTagMap* newTagMap;
     off_t end;
@@ -96,7 +149,7 @@ LIBLOG_ABI_PUBLIC EventTagMap* android_openEventTagMap(const char* fileName)
     }
     newTagMap->mapLen = end;
 
-    if (processFile(newTagMap) != 0)
+    if (processIndex(newTagMap) != 0 && processFile(newTagMap) != 0)
         goto fail;
 
     if (fd >= 0)
@@ -120,6 +173,7 @@ LIBLOG_ABI_PUBLIC void android_closeEventTagMap(EventTagMap* map)
         return;
 
     munmap(map->mapAddr, map->mapLen);
+    free(map->tagArray);
     free(map);
 }
 
@@ -136,6 +190,26 @@ LIBLOG_ABI_PUBLIC const char* android_lookupEventTag(const EventTagMap* map,
     lo = 0;
     hi = map->numTags-1;
 
+    if (map->indexTags) {
+        while (lo <= hi) {
+            uint32_t val;
+
+            mid = (lo+hi)/2;
+            val = map->indexTags[mid];
+            if (val < (unsigned int)tag) {
+                lo = mid + 1;
+            } else if (val > (unsigned int)tag) {
+                hi = mid - 1;
+            } else {
+                uint32_t offset = map->indexNames[mid];
+                if (offset >= map->mapLen)
+                    return NULL;
+                return (const char*)map->mapAddr + offset;
+            }
+        }
+        return NULL;
+    }
+
     while (lo <= hi) {
         int cmp;
 
@@ -186,6 +260,141 @@ static inline int isCharDigit(char c)
 }
 
 
+/*
+ * Map fileName.bin, if it is a precompiled index no older than fileName.
+ * Quietly returns NULL otherwise, the caller falls back to fileName.
+ */
+static EventTagMap* openIndex(const char* fileName)
+{
+    char indexName[PATH_MAX];
+    struct stat textStat, indexStat;
+    EventTagMap* map;
+    void* addr;
+    int fd;
+
+    if (snprintf(indexName, sizeof(indexName), "%s%s", fileName,
+                 EVENT_TAG_INDEX_SUFFIX) >= (int)sizeof(indexName))
+        return NULL;
+
+    fd = open(indexName, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    if (fstat(fd, &indexStat) != 0
+            || indexStat.st_size < (off_t)sizeof(EventTagIndexHeader)
+            || (stat(fileName, &textStat) == 0
+                && textStat.st_mtime > indexStat.st_mtime)) {
+        close(fd);
+        return NULL;
+    }
+
+    addr = mmap(NULL, indexStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+        return NULL;
+
+    map = calloc(1, sizeof(EventTagMap));
+    if (map == NULL) {
+        munmap(addr, indexStat.st_size);
+        return NULL;
+    }
+    map->mapAddr = addr;
+    map->mapLen = indexStat.st_size;
+
+    if (processIndex(map) != 0) {
+        android_closeEventTagMap(map);
+        return NULL;
+    }
+    return map;
+}
+
+/*
+ * Check the bounds of a precompiled index, nothing else needs doing to
+ * use it. Returns nonzero if the mapping is not an index.
+ */
+static int processIndex(EventTagMap* map)
+{
+    const EventTagIndexHeader* header = map->mapAddr;
+    size_t tables;
+
+    if (map->mapLen < sizeof(*header)
+            || header->magic != EVENT_TAG_INDEX_MAGIC)
+        return -1;
+
+    /* bound numTags first, the tables must not overflow a 32-bit size_t */
+    if (header->numTags > INT_MAX
+            || header->numTags > (map->mapLen - sizeof(*header))
+                                    / (2 * sizeof(uint32_t))) {
+        fprintf(stderr, "%s: corrupt tag index\n", OUT_TAG);
+        return -1;
+    }
+    tables = sizeof(*header) + 2 * sizeof(uint32_t) * (size_t)header->numTags;
+    if (header->version != EVENT_TAG_INDEX_VERSION
+            || header->size != map->mapLen
+            || tables >= map->mapLen
+            || ((const char*)map->mapAddr)[map->mapLen - 1] != '\0') {
+        fprintf(stderr, "%s: corrupt tag index\n", OUT_TAG);
+        return -1;
+    }
+
+    map->numTags = header->numTags;
+    map->indexTags = (const uint32_t*)(header + 1);
+    map->indexNames = map->indexTags + map->numTags;
+    return 0;
+}
+
+/*
+ * Parse the text map file fileName and write it as a precompiled index,
+ * see EventTagIndexHeader. Returns 0 on success.
+ */
+LIBLOG_HIDDEN int __android_log_write_event_tag_index(const char* fileName,
+                                                      FILE* fp)
+{
+    EventTagIndexHeader header;
+    EventTagMap* map;
+    uint32_t offset;
+    int i, ret = -1;
+
+    map = openFile(fileName);
+    if (map == NULL)
+        return -1;
+    if (map->tagArray == NULL) {
+        fprintf(stderr, "%s: '%s' is already an index\n", OUT_TAG, fileName);
+        goto done;
+    }
+
+    offset = sizeof(header) + 2 * sizeof(uint32_t) * map->numTags;
+    header.magic = EVENT_TAG_INDEX_MAGIC;
+    header.version = EVENT_TAG_INDEX_VERSION;
+    header.numTags = map->numTags;
+    header.size = offset;
+    for (i = 0; i < map->numTags; i++)
+        header.size += strlen(map->tagArray[i].tagStr) + 1;
+
+    if (fwrite(&header, sizeof(header), 1, fp) != 1)
+        goto done;
+    for (i = 0; i < map->numTags; i++) {
+        uint32_t tag = map->tagArray[i].tagIndex;
+        if (fwrite(&tag, sizeof(tag), 1, fp) != 1)
+            goto done;
+    }
+    for (i = 0; i < map->numTags; i++) {
+        if (fwrite(&offset, sizeof(offset), 1, fp) != 1)
+            goto done;
+        offset += strlen(map->tagArray[i].tagStr) + 1;
+    }
+    for (i = 0; i < map->numTags; i++) {
+        const char* str = map->tagArray[i].tagStr;
+        if (fwrite(str, strlen(str) + 1, 1, fp) != 1)
+            goto done;
+    }
+    ret = 0;
+
+done:
+    android_closeEventTagMap(map);
+    return ret;
+}
+
 /*
  * Crunch through the file, parsing the contents and creating a tag index.
  */
@@ -16,6 +16,8 @@
 
 #include <ctype.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #define _REALLY_INCLUDE_SYS__SYSTEM_PROPERTIES_H_
@@ -85,7 +87,11 @@ static void refresh_cache(struct cache *cache, const char *key)
     }
 }
 
-static int __android_log_level(const char *tag, int default_prio)
+/*
+ * The controlling property character for tag, or 0 if none. Cached for
+ * the last tag looked up, and the global settings, under lock_loggable.
+ */
+static char __android_log_level_char(const char *tag)
 {
     /* sizeof() is used on this array below */
     static const char log_namespace[] = "persist.log.tag.";
@@ -232,6 +238,11 @@ static int __android_log_level(const char *tag, int default_prio)
         unlock();
     }
 
+    return c;
+}
+
+static int __android_log_level_from_char(char c, int default_prio)
+{
     switch (toupper(c)) {
     case 'V': return ANDROID_LOG_VERBOSE;
     case 'D': return ANDROID_LOG_DEBUG;
@@ -246,10 +257,113 @@ static int __android_log_level(const char *tag, int default_prio)
     return default_prio;
 }
 
+/*
+ * Lock free front to __android_log_level_char. Each tag seen is interned
+ * once, in an open addressed table, along with its property character and
+ * the property area serial that it was valid for. Any property change
+ * bumps the area serial, so a check made while nothing changed is a hash
+ * of the tag, a few loads and a compare. Entries come from a static pool
+ * and are never freed; like the trylock above, this keeps the path safe
+ * in signal handlers and after fork, so nothing here may call malloc.
+ * Tags too long for an entry, or seen once the pool or their probe run is
+ * full, are simply not cached.
+ */
+#define LOGGABLE_SLOTS 512 /* power of two */
+#define LOGGABLE_POOL 256
+#define LOGGABLE_PROBES 8
+#define LOGGABLE_TAG_MAX 40 /* including the nul */
+
+struct loggable {
+    uint32_t hash;
+    atomic_uint_fast64_t state; /* serial << 32 | LOGGABLE_VALID | char */
+    char tag[LOGGABLE_TAG_MAX];
+};
+
+#define LOGGABLE_VALID 0x100
+
+static _Atomic(struct loggable *) loggable_table[LOGGABLE_SLOTS];
+static struct loggable loggable_pool[LOGGABLE_POOL];
+static atomic_uint loggable_pool_used;
+
+static uint32_t loggable_hash(const char *tag)
+{
+    uint32_t hash = 2166136261U; /* FNV-1a */
+
+    while (*tag) {
+        hash ^= (unsigned char)*tag++;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+static char __android_log_level_cached(const char *tag)
+{
+    uint32_t serial = __system_property_area_serial();
+    uint32_t hash = loggable_hash(tag);
+    size_t len = strlen(tag) + 1;
+    struct loggable *e = NULL;
+    uint_fast64_t state;
+    size_t i;
+    char c;
+
+    for (i = 0; (len <= LOGGABLE_TAG_MAX) && (i < LOGGABLE_PROBES); ++i) {
+        _Atomic(struct loggable *) *slot =
+            &loggable_table[(hash + i) & (LOGGABLE_SLOTS - 1)];
+
+        e = atomic_load_explicit(slot, memory_order_acquire);
+        if (!e) {
+            unsigned used = atomic_load_explicit(&loggable_pool_used,
+                                                 memory_order_relaxed);
+            struct loggable *n;
+
+            /* checked first, so that a full pool's count stops growing */
+            if (used >= LOGGABLE_POOL) {
+                break;
+            }
+            used = atomic_fetch_add_explicit(&loggable_pool_used, 1,
+                                             memory_order_relaxed);
+            if (used >= LOGGABLE_POOL) {
+                break;
+            }
+            n = &loggable_pool[used];
+            n->hash = hash;
+            atomic_init(&n->state, 0);
+            memcpy(n->tag, tag, len);
+            if (atomic_compare_exchange_strong_explicit(slot, &e, n,
+                    memory_order_release, memory_order_acquire)) {
+                e = n;
+                break;
+            }
+            /* lost the race, e is now the winner and n stays unused */
+        }
+        if ((e->hash == hash) && !strcmp(e->tag, tag)) {
+            break;
+        }
+        e = NULL;
+    }
+
+    if (e) {
+        state = atomic_load_explicit(&e->state, memory_order_relaxed);
+        if ((state & LOGGABLE_VALID) && ((uint32_t)(state >> 32) == serial)) {
+            return (char)state;
+        }
+    }
+
+    /* serial was read first, so a change racing with this is caught next */
+    c = __android_log_level_char(tag);
+    if (e) {
+        state = ((uint_fast64_t)serial << 32) | LOGGABLE_VALID
+              | (unsigned char)c;
+        atomic_store_explicit(&e->state, state, memory_order_relaxed);
+    }
+    return c;
+}
+
 LIBLOG_ABI_PUBLIC int __android_log_is_loggable(int prio, const char *tag,
                                                 int default_prio)
 {
-    int logLevel = __android_log_level(tag, default_prio);
+    char c = __android_log_level_cached(tag ? tag : "");
+    int logLevel = __android_log_level_from_char(c, default_prio);
     return logLevel >= 0 && prio >= logLevel;
 }
 
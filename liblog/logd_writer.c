@@ -19,6 +19,8 @@
 #include <fcntl.h>
 #include <inttypes.h>
 #include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdarg.h>
 #include <stdatomic.h>
 #include <stdio.h>
@@ -26,6 +28,7 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <time.h>
@@ -50,6 +53,10 @@ static int logdOpen();
 static void logdClose();
 static int logdWrite(log_id_t logId, struct timespec *ts,
                      struct iovec *vec, size_t nr);
+static void logdFlushAll(bool reconnect);
+
+static atomic_int_fast32_t dropped;
+static atomic_int_fast32_t droppedSecurity;
 
 LIBLOG_HIDDEN struct android_log_transport_write logdLoggerWrite = {
     .node = { &logdLoggerWrite.node, &logdLoggerWrite.node },
@@ -92,7 +99,7 @@ static int logdOpen()
     return ret;
 }
 
-static void logdClose()
+static void logdCloseSocket()
 {
     if (logdLoggerWrite.context.sock >= 0) {
         close(logdLoggerWrite.context.sock);
@@ -100,6 +107,13 @@ static void logdClose()
     }
 }
 
+/* log_init_lock assumed, so no reconnecting while staged lines go out */
+static void logdClose()
+{
+    logdFlushAll(false);
+    logdCloseSocket();
+}
+
 static int logdAvailable(log_id_t logId)
 {
     if (logId > LOG_ID_SECURITY) {
@@ -114,6 +128,534 @@ static int logdAvailable(log_id_t logId)
     return 1;
 }
 
+/*
+ * Report, ahead of the line about to be sent, how many lines logd did not
+ * take since the last report. header is that of the line, and is restored.
+ */
+static void logdSendDropped(android_log_header_t *header)
+{
+    struct iovec vec[2];
+    android_log_event_int_t buffer;
+    log_id_t logId = header->id;
+    ssize_t ret;
+
+    vec[0].iov_base = (unsigned char *)header;
+    vec[0].iov_len  = sizeof(*header);
+    vec[1].iov_base = &buffer;
+    vec[1].iov_len  = sizeof(buffer);
+
+    buffer.header.tag = htole32(LIBLOG_LOG_TAG);
+    buffer.payload.type = EVENT_TYPE_INT;
+
+    int32_t snapshot = atomic_exchange_explicit(&droppedSecurity, 0,
+                                                memory_order_relaxed);
+    if (snapshot) {
+        header->id = LOG_ID_SECURITY;
+        buffer.payload.data = htole32(snapshot);
+
+        ret = TEMP_FAILURE_RETRY(writev(logdLoggerWrite.context.sock, vec, 2));
+        if (ret != (ssize_t)(sizeof(*header) + sizeof(buffer))) {
+            atomic_fetch_add_explicit(&droppedSecurity, snapshot,
+                                      memory_order_relaxed);
+        }
+    }
+    snapshot = atomic_exchange_explicit(&dropped, 0, memory_order_relaxed);
+    if (snapshot && __android_log_is_loggable(ANDROID_LOG_INFO,
+                                              "liblog",
+                                              ANDROID_LOG_VERBOSE)) {
+        header->id = LOG_ID_EVENTS;
+        buffer.payload.data = htole32(snapshot);
+
+        ret = TEMP_FAILURE_RETRY(writev(logdLoggerWrite.context.sock, vec, 2));
+        if (ret != (ssize_t)(sizeof(*header) + sizeof(buffer))) {
+            atomic_fetch_add_explicit(&dropped, snapshot,
+                                      memory_order_relaxed);
+        }
+    }
+    header->id = logId;
+}
+
+/*
+ * Buffered mode, see __android_log_set_buffered(). Each thread stages its
+ * lines, header included, back to back in a buffer of its own and hands
+ * them all to logd with a single sendmmsg. The owner is the only writer
+ * of its buffer; a flush of all buffers (flusher thread, fatal line,
+ * close) is the only other party, and busy arbitrates between the two so
+ * that the common path takes no lock. Nothing here calls malloc or waits
+ * on this thread's own busy or stagedLock, so a signal handler may log.
+ */
+#define STAGED_LINES 16
+#define STAGED_SIZE  (8 * 1024)
+
+static const uint64_t stagedTimeoutNs = 100000000ULL; /* 100ms */
+/* before the flusher looks again at a buffer its owner was busy with */
+static const uint64_t stagedRetryNs = 1000000ULL; /* 1ms */
+/* passes a full flush makes over buffers their owners are busy with */
+#define STAGED_PASSES 4
+
+struct staged {
+    struct listnode node; /* on stagedList, under stagedLock */
+    atomic_int busy;      /* tid of the holder, 0 if none */
+    /* CLOCK_MONOTONIC of the first line staged, 0 if none, read unlocked */
+    atomic_uint_fast64_t oldest;
+    size_t lines;
+    size_t used;
+    struct iovec line[STAGED_LINES];
+    char data[STAGED_SIZE];
+};
+
+static pthread_once_t stagedOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t stagedKey;
+/* Error checking, a signal handler gets EDEADLK rather than hang on it */
+static pthread_mutex_t stagedLock = PTHREAD_ERRORCHECK_MUTEX_INITIALIZER_NP;
+static pthread_cond_t stagedCond; /* CLOCK_MONOTONIC, see stagedInit */
+static struct listnode stagedList = { &stagedList, &stagedList };
+static atomic_bool stagedInUse;
+static atomic_bool flusherRunning; /* changed under stagedLock */
+static atomic_bool flusherIdle;    /* changed under stagedLock */
+
+static uint64_t monotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * The owner's side. Waits for another thread to be done with s, never for
+ * this one: false if tid holds it already, as when a signal handler logs
+ * mid-stage. The other is a flush, which holds s for one non-blocking
+ * sendmmsg at most.
+ */
+static bool stagedAcquire(struct staged *s, pid_t tid)
+{
+    int holder = 0;
+
+    while (!atomic_compare_exchange_weak_explicit(&s->busy, &holder, tid,
+                                                  memory_order_acquire,
+                                                  memory_order_relaxed)) {
+        if (holder == tid) {
+            return false;
+        }
+        holder = 0;
+        sched_yield();
+    }
+    return true;
+}
+
+/* The flushing side, never waits on an owner staging a line */
+static bool stagedTryAcquire(struct staged *s, pid_t tid)
+{
+    int holder = 0;
+
+    return atomic_compare_exchange_strong_explicit(&s->busy, &holder, tid,
+                                                   memory_order_acquire,
+                                                   memory_order_relaxed);
+}
+
+static void stagedRelease(struct staged *s)
+{
+    atomic_store_explicit(&s->busy, 0, memory_order_release);
+}
+
+/* busy held. Lines logd does not take are dropped, as for writev */
+static void stagedFlush(struct staged *s, bool reconnect)
+{
+    struct mmsghdr msg[STAGED_LINES];
+    size_t i, sent = 0;
+
+    if (!s->lines) {
+        return;
+    }
+
+    memset(msg, 0, sizeof(msg));
+    for (i = 0; i < s->lines; ++i) {
+        msg[i].msg_hdr.msg_iov = &s->line[i];
+        msg[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    if (logdLoggerWrite.context.sock > 0) {
+        logdSendDropped((android_log_header_t *)s->line[0].iov_base);
+    }
+
+    while (sent < s->lines) {
+        int ret = TEMP_FAILURE_RETRY(sendmmsg(logdLoggerWrite.context.sock,
+                                              msg + sent, s->lines - sent, 0));
+        if (ret > 0) {
+            sent += ret;
+            continue;
+        }
+        /* Never wait on log_init_lock here, a close may be flushing us */
+        if ((ret < 0) && (errno == ENOTCONN) && reconnect
+                && !__android_log_trylock()) {
+            logdCloseSocket();
+            ret = logdOpen();
+            __android_log_unlock();
+            reconnect = false;
+            if (ret >= 0) {
+                continue;
+            }
+        }
+        break;
+    }
+    if (sent < s->lines) {
+        atomic_fetch_add_explicit(&dropped, s->lines - sent,
+                                  memory_order_relaxed);
+    }
+
+    s->lines = 0;
+    s->used = 0;
+    atomic_store_explicit(&s->oldest, 0, memory_order_relaxed);
+}
+
+/* Thread exit */
+static void stagedDestroy(void *obj)
+{
+    struct staged *s = obj;
+
+    stagedAcquire(s, gettid());
+    stagedFlush(s, true);
+    stagedRelease(s);
+
+    pthread_mutex_lock(&stagedLock);
+    list_remove(&s->node);
+    pthread_mutex_unlock(&stagedLock);
+    munmap(s, sizeof(*s));
+}
+
+static void stagedForkPrepare()
+{
+    pthread_mutex_lock(&stagedLock);
+}
+
+static void stagedForkParent()
+{
+    pthread_mutex_unlock(&stagedLock);
+}
+
+/*
+ * Only this thread lives on in the child, lines staged by the parent are
+ * the parent's to send. Without a flusher, the child sends unbuffered
+ * until it calls __android_log_set_buffered() again.
+ */
+static void stagedForkChild()
+{
+    struct staged *self = pthread_getspecific(stagedKey);
+    struct listnode *node, *n;
+
+    list_for_each_safe(node, n, &stagedList) {
+        struct staged *s = node_to_item(node, struct staged, node);
+        if (s != self) {
+            list_remove(node);
+            munmap(s, sizeof(*s));
+        }
+    }
+    if (self) {
+        atomic_store(&self->busy, 0);
+        atomic_store(&self->oldest, 0);
+        self->lines = 0;
+        self->used = 0;
+    }
+    atomic_store(&flusherRunning, false);
+    atomic_store(&flusherIdle, false);
+    pthread_mutex_unlock(&stagedLock);
+}
+
+static void stagedInit()
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&stagedCond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    pthread_key_create(&stagedKey, stagedDestroy);
+    pthread_atfork(stagedForkPrepare, stagedForkParent, stagedForkChild);
+}
+
+/* stagedLock held. When the oldest staged line is due, 0 if none is */
+static uint64_t stagedDeadline()
+{
+    struct listnode *node;
+    uint64_t deadline = 0;
+
+    list_for_each(node, &stagedList) {
+        struct staged *s = node_to_item(node, struct staged, node);
+        uint64_t oldest = atomic_load(&s->oldest);
+        if (oldest && (!deadline || ((oldest + stagedTimeoutNs) < deadline))) {
+            deadline = oldest + stagedTimeoutNs;
+        }
+    }
+    return deadline;
+}
+
+/*
+ * stagedLock held. Buffers whose owners are busy staging are skipped, an
+ * owner that finds its lines overdue sends them itself. Returns true if
+ * any buffer with lines was skipped.
+ */
+static bool stagedFlushList(bool expired, bool reconnect)
+{
+    struct listnode *node;
+    uint64_t now = expired ? monotonicNs() : 0;
+    pid_t tid = gettid();
+    bool skipped = false;
+
+    list_for_each(node, &stagedList) {
+        struct staged *s = node_to_item(node, struct staged, node);
+        if (!stagedTryAcquire(s, tid)) {
+            skipped |= atomic_load_explicit(&s->oldest,
+                                            memory_order_relaxed) != 0;
+            continue;
+        }
+        if (!expired || (s->lines && ((now - atomic_load_explicit(
+                &s->oldest, memory_order_relaxed)) >= stagedTimeoutNs))) {
+            stagedFlush(s, reconnect);
+        }
+        stagedRelease(s);
+    }
+    return skipped;
+}
+
+/* stagedLock held. Sends all, giving busy owners a few passes to finish */
+static void stagedFlushAllList(bool reconnect)
+{
+    int pass;
+
+    for (pass = 1; stagedFlushList(false, reconnect); ++pass) {
+        if (pass >= STAGED_PASSES) {
+            break;
+        }
+        sched_yield();
+    }
+}
+
+static void logdFlushAll(bool reconnect)
+{
+    if (!atomic_load_explicit(&stagedInUse, memory_order_acquire)) {
+        return;
+    }
+
+    /* EDEADLK, a signal handler interrupted this thread's own flush */
+    if (pthread_mutex_lock(&stagedLock)) {
+        return;
+    }
+    stagedFlushAllList(reconnect);
+    pthread_mutex_unlock(&stagedLock);
+}
+
+/* stagedLock held. Sleeps until ns from now, or until woken */
+static void stagedWait(uint64_t ns)
+{
+    uint64_t deadline = monotonicNs() + ns;
+    struct timespec ts = {
+        (time_t)(deadline / 1000000000ULL),
+        (long)(deadline % 1000000000ULL)
+    };
+
+    pthread_cond_timedwait(&stagedCond, &stagedLock, &ts);
+}
+
+/*
+ * Sends what threads that went quiet left behind, stops once unbuffered.
+ * Sleeps until the oldest staged line is due, or while none is staged,
+ * until a thread stages one, see stagedWake().
+ */
+static void *logdFlusher(void *obj __unused)
+{
+    pthread_mutex_lock(&stagedLock);
+    while (atomic_load(&__android_log_buffered)) {
+        uint64_t deadline = stagedDeadline();
+
+        if (!deadline) {
+            atomic_store(&flusherIdle, true);
+            if (!stagedDeadline()) {
+                pthread_cond_wait(&stagedCond, &stagedLock);
+            }
+            atomic_store(&flusherIdle, false);
+        } else {
+            uint64_t now = monotonicNs();
+
+            if (deadline > now) {
+                stagedWait(deadline - now);
+            } else if (stagedFlushList(true, true)) {
+                /* a busy owner still has lines due, look again shortly */
+                stagedWait(stagedRetryNs);
+            }
+        }
+    }
+    stagedFlushAllList(true);
+    atomic_store(&flusherRunning, false);
+    pthread_mutex_unlock(&stagedLock);
+    return NULL;
+}
+
+/*
+ * __android_log_set_buffered() changed the setting: start the flusher, or
+ * have it send everything and stop.
+ */
+LIBLOG_HIDDEN void __android_log_buffered_changed(int enable)
+{
+    pthread_once(&stagedOnce, stagedInit);
+
+    pthread_mutex_lock(&stagedLock);
+    if (enable && !atomic_load(&flusherRunning)) {
+        pthread_attr_t attr;
+        pthread_t thread;
+
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (!pthread_create(&thread, &attr, logdFlusher, NULL)) {
+            atomic_store(&flusherRunning, true);
+        }
+        pthread_attr_destroy(&attr);
+    }
+    pthread_cond_broadcast(&stagedCond);
+    pthread_mutex_unlock(&stagedLock);
+}
+
+/* mmap rather than malloc, which a signal handler must not call */
+static struct staged *stagedGet()
+{
+    struct staged *s = pthread_getspecific(stagedKey);
+
+    if (s) {
+        return s;
+    }
+
+    if (pthread_mutex_lock(&stagedLock)) {
+        return NULL;
+    }
+    /* zero filled, so idle with no lines */
+    s = mmap(NULL, sizeof(*s), PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (s == MAP_FAILED) {
+        pthread_mutex_unlock(&stagedLock);
+        return NULL;
+    }
+    list_add_tail(&stagedList, &s->node);
+    pthread_setspecific(stagedKey, s);
+    atomic_store_explicit(&stagedInUse, true, memory_order_release);
+    pthread_mutex_unlock(&stagedLock);
+    return s;
+}
+
+/*
+ * s got its first line while the flusher sleeps with none to wait for.
+ * Should stagedLock be this thread's already, send it now instead.
+ */
+static void stagedWake(struct staged *s, pid_t tid)
+{
+    if (!pthread_mutex_lock(&stagedLock)) {
+        pthread_cond_signal(&stagedCond);
+        pthread_mutex_unlock(&stagedLock);
+    } else if (stagedAcquire(s, tid)) {
+        stagedFlush(s, true);
+        stagedRelease(s);
+    }
+}
+
+/* Lines this thread staged go out ahead of any it sends unbuffered */
+static void stagedFlushSelf()
+{
+    struct staged *s;
+
+    if (!atomic_load_explicit(&stagedInUse, memory_order_relaxed)) {
+        return;
+    }
+    s = pthread_getspecific(stagedKey);
+    if (s && atomic_load_explicit(&s->oldest, memory_order_relaxed)
+            && stagedAcquire(s, gettid())) {
+        stagedFlush(s, true);
+        stagedRelease(s);
+    }
+}
+
+/* Returns -ENOMEM if the line could not be staged, and must be sent */
+static int logdStage(log_id_t logId, struct timespec *ts,
+                     struct iovec *vec, size_t nr)
+{
+    struct staged *s;
+    android_log_header_t header;
+    size_t i, payloadSize, len;
+    int prio = ANDROID_LOG_INFO;
+    bool first;
+    uint64_t now;
+    char *cp;
+
+    /* stagedInit has run if it is, not so in a child of fork() */
+    if (!atomic_load_explicit(&flusherRunning, memory_order_relaxed)) {
+        return -ENOMEM;
+    }
+    s = stagedGet();
+    if (!s) {
+        return -ENOMEM;
+    }
+
+    for (payloadSize = 0, i = 0; i < nr; ++i) {
+        payloadSize += vec[i].iov_len;
+    }
+    if (payloadSize > LOGGER_ENTRY_MAX_PAYLOAD) {
+        payloadSize = LOGGER_ENTRY_MAX_PAYLOAD;
+    }
+    if ((logId != LOG_ID_EVENTS) && nr && vec[0].iov_len) {
+        prio = *(const unsigned char *)vec[0].iov_base;
+    }
+
+    header.id = logId;
+    header.tid = gettid();
+    header.realtime.tv_sec = ts->tv_sec;
+    header.realtime.tv_nsec = ts->tv_nsec;
+
+    now = monotonicNs();
+    /* A signal handler that interrupted us mid-stage sends unbuffered */
+    if (!stagedAcquire(s, header.tid)) {
+        return -ENOMEM;
+    }
+
+    if ((s->lines >= STAGED_LINES)
+            || ((s->used + sizeof(header) + payloadSize) > STAGED_SIZE)) {
+        stagedFlush(s, true);
+    }
+
+    cp = s->data + s->used;
+    memcpy(cp, &header, sizeof(header));
+    for (len = sizeof(header), i = 0; len < (sizeof(header) + payloadSize); ++i) {
+        size_t chunk = min(vec[i].iov_len, sizeof(header) + payloadSize - len);
+        memcpy(cp + len, vec[i].iov_base, chunk);
+        len += chunk;
+    }
+    s->line[s->lines].iov_base = cp;
+    s->line[s->lines].iov_len = len;
+    first = !s->lines;
+    if (first) {
+        atomic_store(&s->oldest, now);
+    }
+    ++s->lines;
+    s->used += len;
+
+    if ((prio >= ANDROID_LOG_WARN) || ((now - atomic_load_explicit(
+            &s->oldest, memory_order_relaxed)) >= stagedTimeoutNs)) {
+        stagedFlush(s, true);
+        first = false;
+    }
+
+    stagedRelease(s);
+
+    /* Pairs with the flusher setting flusherIdle then checking oldest */
+    if (first && atomic_load(&flusherIdle)) {
+        stagedWake(s, header.tid);
+    }
+
+    /* about to abort, do not leave other threads' last words behind */
+    if (prio >= ANDROID_LOG_FATAL) {
+        logdFlushAll(true);
+    }
+
+    return payloadSize;
+}
+
 static int logdWrite(log_id_t logId, struct timespec *ts,
                      struct iovec *vec, size_t nr)
 {
@@ -122,8 +664,6 @@ static int logdWrite(log_id_t logId, struct timespec *ts,
     struct iovec newVec[nr + headerLength];
     android_log_header_t header;
     size_t i, payloadSize;
-    static atomic_int_fast32_t dropped;
-    static atomic_int_fast32_t droppedSecurity;
 
     if (logdLoggerWrite.context.sock < 0) {
         return -EBADF;
@@ -139,6 +679,17 @@ static int logdWrite(log_id_t logId, struct timespec *ts,
         return 0;
     }
 
+    if (logId != LOG_ID_SECURITY) {
+        if (atomic_load_explicit(&__android_log_buffered,
+                                 memory_order_relaxed)) {
+            ret = logdStage(logId, ts, vec, nr);
+            if (ret != -ENOMEM) {
+                return ret;
+            }
+        }
+    }
+    stagedFlushSelf();
+
     /*
      *  struct {
      *      // what we provide to socket
@@ -164,50 +715,12 @@ static int logdWrite(log_id_t logId, struct timespec *ts,
     newVec[0].iov_base = (unsigned char *)&header;
     newVec[0].iov_len  = sizeof(header);
 
+    header.id = logId;
+
     if (logdLoggerWrite.context.sock > 0) {
-        int32_t snapshot = atomic_exchange_explicit(&droppedSecurity, 0,
-                                                    memory_order_relaxed);
-        if (snapshot) {
-            android_log_event_int_t buffer;
-
-            header.id = LOG_ID_SECURITY;
-            buffer.header.tag = htole32(LIBLOG_LOG_TAG);
-            buffer.payload.type = EVENT_TYPE_INT;
-            buffer.payload.data = htole32(snapshot);
-
-            newVec[headerLength].iov_base = &buffer;
-            newVec[headerLength].iov_len  = sizeof(buffer);
-
-            ret = TEMP_FAILURE_RETRY(writev(logdLoggerWrite.context.sock, newVec, 2));
-            if (ret != (ssize_t)(sizeof(header) + sizeof(buffer))) {
-                atomic_fetch_add_explicit(&droppedSecurity, snapshot,
-                                          memory_order_relaxed);
-            }
-        }
-        snapshot = atomic_exchange_explicit(&dropped, 0, memory_order_relaxed);
-        if (snapshot && __android_log_is_loggable(ANDROID_LOG_INFO,
-                                                  "liblog",
-                                                  ANDROID_LOG_VERBOSE)) {
-            android_log_event_int_t buffer;
-
-            header.id = LOG_ID_EVENTS;
-            buffer.header.tag = htole32(LIBLOG_LOG_TAG);
-            buffer.payload.type = EVENT_TYPE_INT;
-            buffer.payload.data = htole32(snapshot);
-
-            newVec[headerLength].iov_base = &buffer;
-            newVec[headerLength].iov_len  = sizeof(buffer);
-
-            ret = TEMP_FAILURE_RETRY(writev(logdLoggerWrite.context.sock, newVec, 2));
-            if (ret != (ssize_t)(sizeof(header) + sizeof(buffer))) {
-                atomic_fetch_add_explicit(&dropped, snapshot,
-                                          memory_order_relaxed);
-            }
-        }
+        logdSendDropped(&header);
     }
 
-    header.id = logId;
-
     for (payloadSize = 0, i = headerLength; i < nr + headerLength; i++) {
         newVec[i].iov_base = vec[i - headerLength].iov_base;
         payloadSize += newVec[i].iov_len = vec[i - headerLength].iov_len;
@@ -232,7 +745,7 @@ static int logdWrite(log_id_t logId, struct timespec *ts,
         ret = -errno;
         if (ret == -ENOTCONN) {
             __android_log_lock();
-            logdClose();
+            logdCloseSocket();
             ret = logdOpen();
             __android_log_unlock();
 
@@ -17,7 +17,9 @@
 #ifndef _LIBLOG_LOGGER_H__
 #define _LIBLOG_LOGGER_H__
 
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <log/uio.h>
 
 #include <cutils/list.h>
@@ -158,6 +160,15 @@ LIBLOG_HIDDEN int __android_log_trylock();
 LIBLOG_HIDDEN void __android_log_unlock();
 LIBLOG_HIDDEN int __android_log_is_debuggable();
 
+/* event_tag_map.c, for the event-log-tags index host tool */
+LIBLOG_HIDDEN int __android_log_write_event_tag_index(const char *fileName,
+                                                      FILE *fp);
+
+/* __android_log_set_buffered() setting, transports that can stage read it */
+LIBLOG_HIDDEN extern atomic_int __android_log_buffered;
+/* and the transport that stages, told when that setting changes */
+LIBLOG_HIDDEN void __android_log_buffered_changed(int enable);
+
 __END_DECLS
 
 #endif /* _LIBLOG_LOGGER_H__ */
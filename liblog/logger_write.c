@@ -40,6 +40,8 @@
 static int __write_to_log_init(log_id_t, struct iovec *vec, size_t nr);
 static int (*write_to_log)(log_id_t, struct iovec *vec, size_t nr) = __write_to_log_init;
 
+LIBLOG_HIDDEN atomic_int __android_log_buffered = ATOMIC_VAR_INIT(0);
+
 /*
  * This is used by the C++ code to decide if it should write logs through
  * the C code.  Basically, if /dev/socket/logd is available, we're running in
@@ -168,6 +170,16 @@ LIBLOG_ABI_PUBLIC void __android_log_close()
     __android_log_unlock();
 }
 
+LIBLOG_ABI_PUBLIC int __android_log_set_buffered(int enable)
+{
+    int previous = atomic_exchange(&__android_log_buffered, !!enable);
+
+#if (FAKE_LOG_DEVICE == 0)
+    __android_log_buffered_changed(enable);
+#endif
+    return previous;
+}
+
 /* log_init_lock assumed */
 static int __write_to_log_initialize()
 {
@@ -57,6 +57,12 @@ struct AndroidLogFormat_t {
     bool epoch_output;
     bool monotonic_output;
     bool uid_output;
+    /* Seconds of the last time stamp formatted, most lines share theirs */
+    time_t time_sec;
+    size_t time_len;        /* 0 if time_buf is not valid */
+    char time_buf[48];
+    size_t zone_len;
+    char zone_buf[16];
 };
 
 /*
@@ -208,6 +214,7 @@ LIBLOG_ABI_PUBLIC AndroidLogFormat *android_log_format_new()
     p_ret->epoch_output = false;
     p_ret->monotonic_output = android_log_clockid() == CLOCK_MONOTONIC;
     p_ret->uid_output = false;
+    p_ret->time_len = 0;
 
     return p_ret;
 }
@@ -241,6 +248,8 @@ LIBLOG_ABI_PUBLIC int android_log_setPrintFormat(
         AndroidLogFormat *p_format,
         AndroidLogPrintFormat format)
 {
+    p_format->time_len = 0;
+
     switch (format) {
     case FORMAT_MODIFIER_COLOR:
         p_format->colored_output = true;
@@ -539,6 +548,86 @@ LIBLOG_ABI_PUBLIC int android_log_processLogBuffer(
     return 0;
 }
 
+/*
+ * snprintf() like appends for the line prefix and suffix. At most size - 1
+ * characters are stored, *len counts what would have been.
+ */
+static void append(char *buf, size_t size, size_t *len,
+                   const char *s, size_t n)
+{
+    if (*len < size - 1) {
+        size_t room = size - 1 - *len;
+        memcpy(buf + *len, s, MIN(n, room));
+    }
+    *len += n;
+}
+
+static inline void appendChar(char *buf, size_t size, size_t *len, char c)
+{
+    append(buf, size, len, &c, 1);
+}
+
+static inline void appendString(char *buf, size_t size, size_t *len,
+                                const char *s)
+{
+    append(buf, size, len, s, strlen(s));
+}
+
+/* %-*s */
+static void appendLeft(char *buf, size_t size, size_t *len,
+                       const char *s, size_t width)
+{
+    static const char spaces[] = "        ";
+    size_t n = strlen(s);
+
+    append(buf, size, len, s, n);
+    while (n < width) {
+        size_t pad = MIN(width - n, sizeof(spaces) - 1);
+        append(buf, size, len, spaces, pad);
+        n += pad;
+    }
+}
+
+/*
+ * Decimal, right aligned in width padded with pad (' ' for %*d, '0' for
+ * %0*d), into the end of a 24 character tmp. Returns the first character.
+ */
+static char *formatDecimal(char *tmp, long long val, size_t width, char pad)
+{
+    char *p = tmp + 24;
+    bool negative = val < 0;
+    unsigned long long u = negative ? -(unsigned long long)val
+                                    : (unsigned long long)val;
+
+    do {
+        *--p = '0' + (u % 10);
+        u /= 10;
+    } while (u);
+    if (negative && (pad == '0')) {
+        while ((size_t)(tmp + 24 - p) < (width - 1)) {
+            *--p = '0';
+        }
+        *--p = '-';
+    } else {
+        if (negative) {
+            *--p = '-';
+        }
+        while ((size_t)(tmp + 24 - p) < width) {
+            *--p = pad;
+        }
+    }
+    return p;
+}
+
+static void appendDecimal(char *buf, size_t size, size_t *len,
+                          long long val, size_t width)
+{
+    char tmp[24];
+    char *p = formatDecimal(tmp, val, width, ' ');
+
+    append(buf, size, len, p, tmp + sizeof(tmp) - p);
+}
+
 /*
  * Extract a 4-byte value from a byte stream.
  */
@@ -559,6 +648,24 @@ static inline uint64_t get8LE(const uint8_t* src)
     return ((uint64_t) high << 32) | (uint64_t) low;
 }
 
+/*
+ * A formatted event value into the output, only if it fits with room to
+ * spare for the nul. Returns 1 if it does not.
+ */
+static int appendEventValue(char** pOutBuf, size_t* pOutBufLen,
+                            const char* s, size_t n)
+{
+    size_t outCount = 0;
+
+    if (*pOutBufLen == 0)
+        return 1;
+    append(*pOutBuf, *pOutBufLen, &outCount, s, n);
+    if (outCount >= *pOutBufLen)
+        return 1;
+    *pOutBuf += outCount;
+    *pOutBufLen -= outCount;
+    return 0;
+}
 
 /*
  * Recursively convert binary log data to printable form.
@@ -580,6 +687,8 @@ static int android_log_printBinaryEvent(const unsigned char** pEventData,
     size_t outBufLen = *pOutBufLen;
     unsigned char type;
     size_t outCount;
+    char tmp[48];
+    char* p;
     int result = 0;
 
     if (eventDataLen < 1)
@@ -599,11 +708,8 @@ static int android_log_printBinaryEvent(const unsigned char** pEventData,
             eventData += 4;
             eventDataLen -= 4;
 
-            outCount = snprintf(outBuf, outBufLen, "%d", ival);
-            if (outCount < outBufLen) {
-                outBuf += outCount;
-                outBufLen -= outCount;
-            } else {
+            p = formatDecimal(tmp, ival, 0, ' ');
+            if (appendEventValue(&outBuf, &outBufLen, p, tmp + 24 - p)) {
                 /* halt output */
                 goto no_room;
             }
@@ -620,11 +726,8 @@ static int android_log_printBinaryEvent(const unsigned char** pEventData,
             eventData += 8;
             eventDataLen -= 8;
 
-            outCount = snprintf(outBuf, outBufLen, "%" PRId64, lval);
-            if (outCount < outBufLen) {
-                outBuf += outCount;
-                outBufLen -= outCount;
-            } else {
+            p = formatDecimal(tmp, (int64_t)lval, 0, ' ');
+            if (appendEventValue(&outBuf, &outBufLen, p, tmp + 24 - p)) {
                 /* halt output */
                 goto no_room;
             }
@@ -643,11 +746,10 @@ static int android_log_printBinaryEvent(const unsigned char** pEventData,
             eventData += 4;
             eventDataLen -= 4;
 
-            outCount = snprintf(outBuf, outBufLen, "%f", fval);
-            if (outCount < outBufLen) {
-                outBuf += outCount;
-                outBufLen -= outCount;
-            } else {
+            /* %f is left to stdio, -FLT_MAX is 47 characters */
+            outCount = snprintf(tmp, sizeof(tmp), "%f", fval);
+            if (appendEventValue(&outBuf, &outBufLen, tmp,
+                                 MIN(outCount, sizeof(tmp) - 1))) {
                 /* halt output */
                 goto no_room;
             }
@@ -914,6 +1016,30 @@ LIBLOG_WEAK ssize_t utf8_character_length(const char *src, size_t len)
     return num_to_read;
 }
 
+/*
+ * Characters that convertPrintable passes through untouched
+ */
+static inline bool isPlain(char c)
+{
+    return ((unsigned char)c >= ' ') && !(c & 0x80) && (c != '\\');
+}
+
+/*
+ * Eight characters at a time, true if all are isPlain(). The borrow tricks
+ * only ever err on the side of reporting a word as not plain.
+ */
+static inline bool isPlainWord(const char *message)
+{
+    static const uint64_t ones = 0x0101010101010101ULL;
+    static const uint64_t highs = 0x8080808080808080ULL;
+    uint64_t w, backslash;
+
+    memcpy(&w, message, sizeof(w));
+    backslash = w ^ (ones * '\\');
+    return !((w | ((w - ones * ' ') & ~w) | ((backslash - ones) & ~backslash))
+                 & highs);
+}
+
 /*
  * Convert to printable from message to p buffer, return string length. If p is
  * NULL, do not copy, but still return the expected string length.
@@ -925,7 +1051,28 @@ static size_t convertPrintable(char *p, const char *message, size_t messageLen)
 
     while (messageLen) {
         char buf[6];
-        ssize_t len = sizeof(buf) - 1;
+        ssize_t len;
+        size_t run = 0;
+
+        /* Copy runs of plain characters as is, the overwhelming majority */
+        while (((messageLen - run) >= sizeof(uint64_t))
+                && isPlainWord(message + run)) {
+            run += sizeof(uint64_t);
+        }
+        while ((run < messageLen) && isPlain(message[run])) {
+            ++run;
+        }
+        if (run) {
+            if (print) {
+                memcpy(p, message, run);
+            }
+            p += run;
+            message += run;
+            messageLen -= run;
+            continue;
+        }
+
+        len = sizeof(buf) - 1;
         if ((size_t)len > messageLen) {
             len = messageLen;
         }
@@ -971,6 +1118,9 @@ static size_t convertPrintable(char *p, const char *message, size_t messageLen)
         message += len;
         messageLen -= len;
     }
+    if (print) {
+        *p = '\0';
+    }
     return p - begin;
 }
 
@@ -1253,6 +1403,63 @@ static void convertMonotonic(struct timespec *result,
     subTimespec(result, result, &convert);
 }
 
+/*
+ * Time stamp, in the form requested by the format modifiers, into timeBuf.
+ * Returns its length. The seconds are only formatted, strftime() with its
+ * time zone processing, when they differ from the last line's.
+ */
+static size_t formatTimeStamp(AndroidLogFormat *p_format, char *timeBuf,
+                              size_t size, time_t now, unsigned long nsec)
+{
+    char tmp[24];
+    char *p;
+    size_t len;
+
+    if (!p_format->time_len || (p_format->time_sec != now)) {
+#if !defined(_WIN32)
+        struct tm tmBuf;
+#endif
+        struct tm* ptm = NULL;
+
+        if (p_format->epoch_output || p_format->monotonic_output) {
+            snprintf(p_format->time_buf, sizeof(p_format->time_buf),
+                     p_format->monotonic_output ? "%6lld" : "%19lld",
+                     (long long)now);
+        } else {
+#if !defined(_WIN32)
+            ptm = localtime_r(&now, &tmBuf);
+#else
+            ptm = localtime(&now);
+#endif
+            strftime(p_format->time_buf, sizeof(p_format->time_buf),
+                     &"%Y-%m-%d %H:%M:%S"[p_format->year_output ? 0 : 3],
+                     ptm);
+        }
+        p_format->zone_buf[0] = '\0';
+        if (p_format->zone_output && ptm) {
+            strftime(p_format->zone_buf, sizeof(p_format->zone_buf),
+                     " %z", ptm);
+        }
+        p_format->time_len = strlen(p_format->time_buf);
+        p_format->zone_len = strlen(p_format->zone_buf);
+        p_format->time_sec = now;
+    }
+
+    len = 0;
+    append(timeBuf, size, &len, p_format->time_buf, p_format->time_len);
+    appendChar(timeBuf, size, &len, '.');
+    if (p_format->usec_time_output) {
+        p = formatDecimal(tmp, nsec / US_PER_NSEC, 6, '0');
+    } else {
+        p = formatDecimal(tmp, nsec / MS_PER_NSEC, 3, '0');
+    }
+    append(timeBuf, size, &len, p, tmp + sizeof(tmp) - p);
+    append(timeBuf, size, &len, p_format->zone_buf, p_format->zone_len);
+    len = MIN(len, size - 1);
+    timeBuf[len] = '\0';
+    return len;
+}
+
 /**
  * Formats a log message into a buffer
  *
@@ -1268,10 +1475,6 @@ LIBLOG_ABI_PUBLIC char *android_log_formatLogLine (
         const AndroidLogEntry *entry,
         size_t *p_outLength)
 {
-#if !defined(_WIN32)
-    struct tm tmBuf;
-#endif
-    struct tm* ptm;
     char timeBuf[64]; /* good margin, 23+nul for msec, 26+nul for usec */
     char prefixBuf[128], suffixBuf[128];
     char priChar;
@@ -1282,7 +1485,6 @@ LIBLOG_ABI_PUBLIC char *android_log_formatLogLine (
 
     priChar = filterPriToChar(entry->priority);
     size_t prefixLen = 0, suffixLen = 0;
-    size_t len;
 
     /*
      * Get the current date/time in pretty form
@@ -1310,42 +1512,25 @@ LIBLOG_ABI_PUBLIC char *android_log_formatLogLine (
     if (now < 0) {
         nsec = NS_PER_SEC - nsec;
     }
-    if (p_format->epoch_output || p_format->monotonic_output) {
-        ptm = NULL;
-        snprintf(timeBuf, sizeof(timeBuf),
-                 p_format->monotonic_output ? "%6lld" : "%19lld",
-                 (long long)now);
-    } else {
-#if !defined(_WIN32)
-        ptm = localtime_r(&now, &tmBuf);
-#else
-        ptm = localtime(&now);
-#endif
-        strftime(timeBuf, sizeof(timeBuf),
-                 &"%Y-%m-%d %H:%M:%S"[p_format->year_output ? 0 : 3],
-                 ptm);
-    }
-    len = strlen(timeBuf);
-    if (p_format->usec_time_output) {
-        len += snprintf(timeBuf + len, sizeof(timeBuf) - len,
-                        ".%06ld", nsec / US_PER_NSEC);
-    } else {
-        len += snprintf(timeBuf + len, sizeof(timeBuf) - len,
-                        ".%03ld", nsec / MS_PER_NSEC);
-    }
-    if (p_format->zone_output && ptm) {
-        strftime(timeBuf + len, sizeof(timeBuf) - len, " %z", ptm);
+    switch (p_format->format) {
+        case FORMAT_TIME:
+        case FORMAT_THREADTIME:
+        case FORMAT_LONG:
+            formatTimeStamp(p_format, timeBuf, sizeof(timeBuf), now, nsec);
+            break;
+        default:
+            break;
     }
 
     /*
      * Construct a buffer containing the log header and log message.
      */
     if (p_format->colored_output) {
-        prefixLen = snprintf(prefixBuf, sizeof(prefixBuf), "\x1B[38;5;%dm",
-                             colorFromPri(entry->priority));
-        prefixLen = MIN(prefixLen, sizeof(prefixBuf));
-        suffixLen = snprintf(suffixBuf, sizeof(suffixBuf), "\x1B[0m");
-        suffixLen = MIN(suffixLen, sizeof(suffixBuf));
+        appendString(prefixBuf, sizeof(prefixBuf), &prefixLen, "\x1B[38;5;");
+        appendDecimal(prefixBuf, sizeof(prefixBuf), &prefixLen,
+                      colorFromPri(entry->priority), 0);
+        appendChar(prefixBuf, sizeof(prefixBuf), &prefixLen, 'm');
+        appendString(suffixBuf, sizeof(suffixBuf), &suffixLen, "\x1B[0m");
     }
 
     char uid[16];
@@ -1372,107 +1557,147 @@ LIBLOG_ABI_PUBLIC char *android_log_formatLogLine (
         }
     }
 
+    /* Assembled in place of snprintf, the prefix is on every line */
+#define PREFIX prefixBuf, sizeof(prefixBuf), &prefixLen
+#define SUFFIX suffixBuf, sizeof(suffixBuf), &suffixLen
     switch (p_format->format) {
         case FORMAT_TAG:
-            len = snprintf(prefixBuf + prefixLen, sizeof(prefixBuf) - prefixLen,
-                "%c/%-8s: ", priChar, entry->tag);
-            strcpy(suffixBuf + suffixLen, "\n");
-            ++suffixLen;
+            /* "%c/%-8s: " */
+            appendChar(PREFIX, priChar);
+            appendChar(PREFIX, '/');
+            appendLeft(PREFIX, entry->tag, 8);
+            appendString(PREFIX, ": ");
+            appendChar(SUFFIX, '\n');
             break;
         case FORMAT_PROCESS:
-            len = snprintf(suffixBuf + suffixLen, sizeof(suffixBuf) - suffixLen,
-                "  (%s)\n", entry->tag);
-            suffixLen += MIN(len, sizeof(suffixBuf) - suffixLen);
-            len = snprintf(prefixBuf + prefixLen, sizeof(prefixBuf) - prefixLen,
-                "%c(%s%5d) ", priChar, uid, entry->pid);
+            /* "%c(%s%5d) " ... "  (%s)\n" */
+            appendString(SUFFIX, "  (");
+            appendString(SUFFIX, entry->tag);
+            appendString(SUFFIX, ")\n");
+            appendChar(PREFIX, priChar);
+            appendChar(PREFIX, '(');
+            appendString(PREFIX, uid);
+            appendDecimal(PREFIX, entry->pid, 5);
+            appendString(PREFIX, ") ");
             break;
         case FORMAT_THREAD:
-            len = snprintf(prefixBuf + prefixLen, sizeof(prefixBuf) - prefixLen,
-                "%c(%s%5d:%5d) ", priChar, uid, entry->pid, entry->tid);
-            strcpy(suffixBuf + suffixLen, "\n");
-            ++suffixLen;
+            /* "%c(%s%5d:%5d) " */
+            appendChar(PREFIX, priChar);
+            appendChar(PREFIX, '(');
+            appendString(PREFIX, uid);
+            appendDecimal(PREFIX, entry->pid, 5);
+            appendChar(PREFIX, ':');
+            appendDecimal(PREFIX, entry->tid, 5);
+            appendString(PREFIX, ") ");
+            appendChar(SUFFIX, '\n');
             break;
         case FORMAT_RAW:
-            prefixBuf[prefixLen] = 0;
-            len = 0;
-            strcpy(suffixBuf + suffixLen, "\n");
-            ++suffixLen;
+            appendChar(SUFFIX, '\n');
             break;
         case FORMAT_TIME:
-            len = snprintf(prefixBuf + prefixLen, sizeof(prefixBuf) - prefixLen,
-                "%s %c/%-8s(%s%5d): ", timeBuf, priChar, entry->tag,
-                uid, entry->pid);
-            strcpy(suffixBuf + suffixLen, "\n");
-            ++suffixLen;
+            /* "%s %c/%-8s(%s%5d): " */
+            appendString(PREFIX, timeBuf);
+            appendChar(PREFIX, ' ');
+            appendChar(PREFIX, priChar);
+            appendChar(PREFIX, '/');
+            appendLeft(PREFIX, entry->tag, 8);
+            appendChar(PREFIX, '(');
+            appendString(PREFIX, uid);
+            appendDecimal(PREFIX, entry->pid, 5);
+            appendString(PREFIX, "): ");
+            appendChar(SUFFIX, '\n');
             break;
         case FORMAT_THREADTIME:
+            /* "%s %s%5d %5d %c %-8s: " */
             ret = strchr(uid, ':');
             if (ret) {
                 *ret = ' ';
             }
-            len = snprintf(prefixBuf + prefixLen, sizeof(prefixBuf) - prefixLen,
-                "%s %s%5d %5d %c %-8s: ", timeBuf,
-                uid, entry->pid, entry->tid, priChar, entry->tag);
-            strcpy(suffixBuf + suffixLen, "\n");
-            ++suffixLen;
+            appendString(PREFIX, timeBuf);
+            appendChar(PREFIX, ' ');
+            appendString(PREFIX, uid);
+            appendDecimal(PREFIX, entry->pid, 5);
+            appendChar(PREFIX, ' ');
+            appendDecimal(PREFIX, entry->tid, 5);
+            appendChar(PREFIX, ' ');
+            appendChar(PREFIX, priChar);
+            appendChar(PREFIX, ' ');
+            appendLeft(PREFIX, entry->tag, 8);
+            appendString(PREFIX, ": ");
+            appendChar(SUFFIX, '\n');
             break;
         case FORMAT_LONG:
-            len = snprintf(prefixBuf + prefixLen, sizeof(prefixBuf) - prefixLen,
-                "[ %s %s%5d:%5d %c/%-8s ]\n",
-                timeBuf, uid, entry->pid, entry->tid, priChar, entry->tag);
-            strcpy(suffixBuf + suffixLen, "\n\n");
-            suffixLen += 2;
+            /* "[ %s %s%5d:%5d %c/%-8s ]\n" ... "\n\n" */
+            appendString(PREFIX, "[ ");
+            appendString(PREFIX, timeBuf);
+            appendChar(PREFIX, ' ');
+            appendString(PREFIX, uid);
+            appendDecimal(PREFIX, entry->pid, 5);
+            appendChar(PREFIX, ':');
+            appendDecimal(PREFIX, entry->tid, 5);
+            appendChar(PREFIX, ' ');
+            appendChar(PREFIX, priChar);
+            appendChar(PREFIX, '/');
+            appendLeft(PREFIX, entry->tag, 8);
+            appendString(PREFIX, " ]\n");
+            appendString(SUFFIX, "\n\n");
             prefixSuffixIsHeaderFooter = 1;
             break;
         case FORMAT_BRIEF:
         default:
-            len = snprintf(prefixBuf + prefixLen, sizeof(prefixBuf) - prefixLen,
-                "%c/%-8s(%s%5d): ", priChar, entry->tag, uid, entry->pid);
-            strcpy(suffixBuf + suffixLen, "\n");
-            ++suffixLen;
+            /* "%c/%-8s(%s%5d): " */
+            appendChar(PREFIX, priChar);
+            appendChar(PREFIX, '/');
+            appendLeft(PREFIX, entry->tag, 8);
+            appendChar(PREFIX, '(');
+            appendString(PREFIX, uid);
+            appendDecimal(PREFIX, entry->pid, 5);
+            appendString(PREFIX, "): ");
+            appendChar(SUFFIX, '\n');
             break;
     }
+#undef PREFIX
+#undef SUFFIX
 
-    /* snprintf has a weird return value.   It returns what would have been
-     * written given a large enough buffer.  In the case that the prefix is
-     * longer then our buffer(128), it messes up the calculations below
-     * possibly causing heap corruption.  To avoid this we double check and
-     * set the length at the maximum (size minus null byte)
+    /*
+     * Like snprintf, the lengths are what would have been written given a
+     * large enough buffer. Clip them to what we have, keeping the newline
+     * at the end of a long suffix.
      */
-    prefixLen += len;
     if (prefixLen >= sizeof(prefixBuf)) {
         prefixLen = sizeof(prefixBuf) - 1;
-        prefixBuf[sizeof(prefixBuf) - 1] = '\0';
     }
+    prefixBuf[prefixLen] = '\0';
     if (suffixLen >= sizeof(suffixBuf)) {
         suffixLen = sizeof(suffixBuf) - 1;
         suffixBuf[sizeof(suffixBuf) - 2] = '\n';
-        suffixBuf[sizeof(suffixBuf) - 1] = '\0';
     }
-
-    /* the following code is tragically unreadable */
+    suffixBuf[suffixLen] = '\0';
 
     size_t numLines;
     char *p;
     size_t bufferSize;
     const char *pm;
+    const char *end = entry->message + entry->messageLen;
 
     if (prefixSuffixIsHeaderFooter) {
         /* we're just wrapping message with a header/footer */
         numLines = 1;
     } else {
-        pm = entry->message;
-        numLines = 0;
-
         /*
          * The line-end finding here must match the line-end finding
          * in for ( ... numLines...) loop below
          */
-        while (pm < (entry->message + entry->messageLen)) {
-            if (*pm++ == '\n') numLines++;
+        numLines = 0;
+        for (pm = entry->message;
+                (pm < end) && (pm = memchr(pm, '\n', end - pm)); ++pm) {
+            numLines++;
         }
-        /* plus one line for anything not newline-terminated at the end */
-        if (pm > entry->message && *(pm-1) != '\n') numLines++;
+        /*
+         * plus one line for anything not newline-terminated at the end,
+         * an empty message still gets its prefix and suffix
+         */
+        if ((end == entry->message) || (end[-1] != '\n')) numLines++;
     }
 
     /*
@@ -1481,8 +1706,16 @@ LIBLOG_ABI_PUBLIC char *android_log_formatLogLine (
      */
     bufferSize = (numLines * (prefixLen + suffixLen)) + 1;
     if (p_format->printable_output) {
-        /* Calculate extra length to convert non-printable to printable */
-        bufferSize += convertPrintable(NULL, entry->message, entry->messageLen);
+        /*
+         * Calculate extra length to convert non-printable to printable,
+         * unless the worst case (\ooo for every byte) fits regardless.
+         */
+        if ((bufferSize + 4 * entry->messageLen) <= defaultBufferSize) {
+            bufferSize += 4 * entry->messageLen;
+        } else {
+            bufferSize += convertPrintable(NULL, entry->message,
+                                           entry->messageLen);
+        }
     } else {
         bufferSize += entry->messageLen;
     }
@@ -1497,21 +1730,19 @@ LIBLOG_ABI_PUBLIC char *android_log_formatLogLine (
         }
     }
 
-    ret[0] = '\0';       /* to start strcat off */
-
     p = ret;
     pm = entry->message;
 
     if (prefixSuffixIsHeaderFooter) {
-        strcat(p, prefixBuf);
+        memcpy(p, prefixBuf, prefixLen);
         p += prefixLen;
         if (p_format->printable_output) {
             p += convertPrintable(p, entry->message, entry->messageLen);
         } else {
-            strncat(p, entry->message, entry->messageLen);
+            memcpy(p, entry->message, entry->messageLen);
             p += entry->messageLen;
         }
-        strcat(p, suffixBuf);
+        memcpy(p, suffixBuf, suffixLen);
         p += suffixLen;
     } else {
         do {
@@ -1520,24 +1751,27 @@ LIBLOG_ABI_PUBLIC char *android_log_formatLogLine (
             lineStart = pm;
 
             /* Find the next end-of-line in message */
-            while (pm < (entry->message + entry->messageLen)
-                    && *pm != '\n') pm++;
+            pm = memchr(pm, '\n', end - pm);
+            if (!pm) {
+                pm = end;
+            }
             lineLen = pm - lineStart;
 
-            strcat(p, prefixBuf);
+            memcpy(p, prefixBuf, prefixLen);
             p += prefixLen;
             if (p_format->printable_output) {
                 p += convertPrintable(p, lineStart, lineLen);
             } else {
-                strncat(p, lineStart, lineLen);
+                memcpy(p, lineStart, lineLen);
                 p += lineLen;
             }
-            strcat(p, suffixBuf);
+            memcpy(p, suffixBuf, suffixLen);
             p += suffixLen;
 
-            if (*pm == '\n') pm++;
-        } while (pm < (entry->message + entry->messageLen));
+            if ((pm < end) && (*pm == '\n')) pm++;
+        } while (pm < end);
     }
+    *p = '\0';
 
     if (p_outLength != NULL) {
         *p_outLength = p - ret;
@@ -15,6 +15,8 @@
  */
 
 #include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/endian.h>
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -24,6 +26,7 @@
 #include <log/log.h>
 #include <log/logger.h>
 #include <log/log_read.h>
+#include <log/logprint.h>
 #include <private/android_logger.h>
 
 #include "benchmark.h"
@@ -77,6 +80,43 @@ static void BM_log_maximum(int iters) {
 }
 BENCHMARK(BM_log_maximum);
 
+/*
+ *	Measure the fastest rate we can stuff print messages into the log
+ * with __android_log_set_buffered. Compare to BM_log_maximum, sixteen lines
+ * go out with one sendmmsg rather than one writev per line.
+ */
+static void BM_log_maximum_buffered(int iters) {
+    int previous = __android_log_set_buffered(1);
+    StartBenchmarkTiming();
+
+    for (int i = 0; i < iters; ++i) {
+        __android_log_print(ANDROID_LOG_INFO, "BM_log_maximum_buffered", "%d", i);
+    }
+
+    StopBenchmarkTiming();
+    __android_log_set_buffered(previous);
+}
+BENCHMARK(BM_log_maximum_buffered);
+
+/*
+ *	Measure the time it takes to submit the android logging call using
+ * discrete acquisition under light load with __android_log_set_buffered.
+ * Expect this to be a copy into the staging buffer, no syscall.
+ */
+static void BM_log_overhead_buffered(int iters) {
+    int previous = __android_log_set_buffered(1);
+
+    for (int i = 0; i < iters; ++i) {
+       StartBenchmarkTiming();
+       __android_log_print(ANDROID_LOG_INFO, "BM_log_overhead_buffered", "%d", i);
+       StopBenchmarkTiming();
+       usleep(1000);
+    }
+
+    __android_log_set_buffered(previous);
+}
+BENCHMARK(BM_log_overhead_buffered);
+
 /*
  *	Measure the time it takes to submit the android logging call using
  * discrete acquisition under light load. Expect this to be a pair of
@@ -661,6 +701,45 @@ static void BM_is_loggable(int iters) {
 }
 BENCHMARK(BM_is_loggable);
 
+/*
+ *	Measure the time it takes for __android_log_is_loggable to filter out
+ * a message, the common case behind an ALOGV or ALOGD guard.
+ */
+static void BM_is_loggable_negative(int iters) {
+    StartBenchmarkTiming();
+
+    for (int i = 0; i < iters; ++i) {
+        __android_log_is_loggable(ANDROID_LOG_VERBOSE,
+                                  "BM_is_loggable_negative",
+                                  ANDROID_LOG_INFO);
+    }
+
+    StopBenchmarkTiming();
+}
+BENCHMARK(BM_is_loggable_negative);
+
+/*
+ *	Measure the time it takes for __android_log_is_loggable to filter out
+ * messages when a process interleaves several tags.
+ */
+static void BM_is_loggable_negative_tags(int iters) {
+    static const char *tags[] = {
+        "ActivityManager", "PackageManager", "WindowManager", "InputReader",
+        "SurfaceFlinger", "AudioFlinger", "ConnectivityService", "chatty",
+    };
+    static const size_t count = sizeof(tags) / sizeof(tags[0]);
+
+    StartBenchmarkTiming();
+
+    for (int i = 0; i < iters; ++i) {
+        __android_log_is_loggable(ANDROID_LOG_VERBOSE, tags[i % count],
+                                  ANDROID_LOG_INFO);
+    }
+
+    StopBenchmarkTiming();
+}
+BENCHMARK(BM_is_loggable_negative_tags);
+
 /*
  *	Measure the time it takes for android_log_clockid.
  */
@@ -688,3 +767,78 @@ static void BM_security(int iters) {
     StopBenchmarkTiming();
 }
 BENCHMARK(BM_security);
+
+/*
+ *	Measure android_log_formatLogLine as logcat drives it, a line at a time
+ * into its own buffer, a millisecond apart. Reports ns per line, and bytes
+ * of formatted output per second.
+ */
+static void format_log_line(int iters, AndroidLogPrintFormat format,
+                            AndroidLogPrintFormat modifier) {
+    AndroidLogFormat *p_format = android_log_format_new();
+    android_log_setPrintFormat(p_format, format);
+    if (modifier != FORMAT_OFF) {
+        android_log_setPrintFormat(p_format, modifier);
+    }
+
+    static const char message[] =
+        "Displayed com.android.settings/.Settings: +312ms (total +1s204ms)";
+    AndroidLogEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.priority = ANDROID_LOG_INFO;
+    entry.uid = 1000;
+    entry.pid = 1372;
+    entry.tid = 1403;
+    entry.tag = "ActivityManager";
+    entry.message = message;
+    entry.messageLen = sizeof(message) - 1;
+
+    char defaultBuffer[512];
+    size_t bytes = 0;
+    log_time start(CLOCK_REALTIME);
+
+    StartBenchmarkTiming();
+
+    for (int i = 0; i < iters; ++i) {
+        entry.tv_sec = start.tv_sec + (i / 1000);
+        entry.tv_nsec = (i % 1000) * 1000000;
+        size_t len = 0;
+        char *line = android_log_formatLogLine(p_format, defaultBuffer,
+                                               sizeof(defaultBuffer),
+                                               &entry, &len);
+        if (line != defaultBuffer) {
+            free(line);
+        }
+        bytes += len;
+    }
+
+    StopBenchmarkTiming();
+    SetBenchmarkBytesProcessed(bytes);
+
+    android_log_format_free(p_format);
+}
+
+static void BM_format_threadtime(int iters) {
+    format_log_line(iters, FORMAT_THREADTIME, FORMAT_OFF);
+}
+BENCHMARK(BM_format_threadtime);
+
+static void BM_format_long(int iters) {
+    format_log_line(iters, FORMAT_LONG, FORMAT_OFF);
+}
+BENCHMARK(BM_format_long);
+
+static void BM_format_epoch(int iters) {
+    format_log_line(iters, FORMAT_THREADTIME, FORMAT_MODIFIER_EPOCH);
+}
+BENCHMARK(BM_format_epoch);
+
+static void BM_format_usec(int iters) {
+    format_log_line(iters, FORMAT_THREADTIME, FORMAT_MODIFIER_TIME_USEC);
+}
+BENCHMARK(BM_format_usec);
+
+static void BM_format_printable(int iters) {
+    format_log_line(iters, FORMAT_THREADTIME, FORMAT_MODIFIER_PRINTABLE);
+}
+BENCHMARK(BM_format_printable);
@@ -20,10 +20,15 @@
 #include <signal.h>
 #include <string.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
+#include <string>
+#include <vector>
+
 #include <cutils/properties.h>
 #include <gtest/gtest.h>
+#include <log/event_tag_map.h>
 #include <log/log.h>
 #include <log/logger.h>
 #include <log/log_read.h>
@@ -124,6 +129,155 @@ TEST(liblog, concurrent_name(__android_log_buf_print, NUM_CONCURRENT)) {
     ASSERT_LT(0, ret);
 }
 
+// Messages tag logged since ts, by pid or any if 0, in the order logd has them
+static std::vector<std::string> buffered_messages(const char *tag, pid_t pid,
+                                                  const log_time &ts) {
+    std::vector<std::string> messages;
+    struct logger_list *logger_list = android_logger_list_open(
+        LOG_ID_MAIN, ANDROID_LOG_RDONLY | ANDROID_LOG_NONBLOCK, 1000, pid);
+    if (!logger_list) {
+        return messages;
+    }
+
+    for (;;) {
+        log_msg log_msg;
+        if (android_logger_list_read(logger_list, &log_msg) <= 0) {
+            break;
+        }
+        if ((log_msg.id() != LOG_ID_MAIN)
+         || (log_time(log_msg.entry.sec, log_msg.entry.nsec) < ts)) {
+            continue;
+        }
+        AndroidLogEntry entry;
+        if (android_log_processLogBuffer(&log_msg.entry_v1, &entry)
+         || strcmp(entry.tag, tag)) {
+            continue;
+        }
+        messages.push_back(std::string(entry.message, entry.messageLen));
+    }
+
+    android_logger_list_close(logger_list);
+    return messages;
+}
+
+TEST(liblog, __android_log_set_buffered__warn) {
+    static const char tag[] = "TEST__android_log_set_buffered__warn";
+    pid_t pid = getpid();
+    log_time ts(CLOCK_REALTIME);
+
+    int previous = __android_log_set_buffered(1);
+    EXPECT_LT(0, __android_log_print(ANDROID_LOG_INFO, tag, "0"));
+    EXPECT_LT(0, __android_log_print(ANDROID_LOG_INFO, tag, "1"));
+    EXPECT_LT(0, __android_log_print(ANDROID_LOG_INFO, tag, "2"));
+    usleep(20000);
+    // staged, well ahead of the 100ms timeout
+    EXPECT_EQ(0U, buffered_messages(tag, pid, ts).size());
+
+    EXPECT_LT(0, __android_log_print(ANDROID_LOG_WARN, tag, "3"));
+    usleep(20000);
+    std::vector<std::string> messages = buffered_messages(tag, pid, ts);
+    ASSERT_EQ(4U, messages.size());
+    for (size_t i = 0; i < messages.size(); ++i) {
+        EXPECT_EQ(std::to_string(i), messages[i]);
+    }
+
+    __android_log_set_buffered(previous);
+}
+
+TEST(liblog, __android_log_set_buffered__timeout) {
+    static const char tag[] = "TEST__android_log_set_buffered__timeout";
+    pid_t pid = getpid();
+    log_time ts(CLOCK_REALTIME);
+
+    int previous = __android_log_set_buffered(1);
+    EXPECT_LT(0, __android_log_print(ANDROID_LOG_INFO, tag, "quiet"));
+    usleep(20000);
+    EXPECT_EQ(0U, buffered_messages(tag, pid, ts).size());
+
+    // nothing else logged, the flusher thread sends it
+    usleep(300000);
+    EXPECT_EQ(1U, buffered_messages(tag, pid, ts).size());
+
+    __android_log_set_buffered(previous);
+}
+
+#define NUM_BUFFERED_THREADS 4
+#define NUM_BUFFERED_LINES   100 // several bursts each
+
+static void* BufferedPrintFn(void *arg) {
+    uintptr_t thread = reinterpret_cast<uintptr_t>(arg);
+    for (int i = 0; i < NUM_BUFFERED_LINES; ++i) {
+        __android_log_print(ANDROID_LOG_INFO,
+                            "TEST__android_log_set_buffered__order",
+                            "%" PRIuPTR " %d", thread, i);
+        if (!(i % 10)) {
+            usleep(1000); // stay inside what logd takes at once
+        }
+    }
+    return NULL;
+}
+
+TEST(liblog, __android_log_set_buffered__order) {
+    pid_t pid = getpid();
+    log_time ts(CLOCK_REALTIME);
+
+    int previous = __android_log_set_buffered(1);
+    pthread_t t[NUM_BUFFERED_THREADS];
+    for (uintptr_t i = 0; i < NUM_BUFFERED_THREADS; ++i) {
+        ASSERT_EQ(0, pthread_create(&t[i], NULL, BufferedPrintFn,
+                                    reinterpret_cast<void *>(i)));
+    }
+    for (int i = 0; i < NUM_BUFFERED_THREADS; ++i) {
+        ASSERT_EQ(0, pthread_join(t[i], NULL));
+    }
+    __android_log_set_buffered(previous);
+    usleep(100000);
+
+    int next[NUM_BUFFERED_THREADS] = {};
+    for (const std::string &message : buffered_messages(
+            "TEST__android_log_set_buffered__order", pid, ts)) {
+        unsigned thread;
+        int i;
+        ASSERT_EQ(2, sscanf(message.c_str(), "%u %d", &thread, &i));
+        ASSERT_GT(NUM_BUFFERED_THREADS, thread);
+        EXPECT_EQ(next[thread], i);
+        next[thread] = i + 1;
+    }
+    for (int i = 0; i < NUM_BUFFERED_THREADS; ++i) {
+        EXPECT_EQ(NUM_BUFFERED_LINES, next[i]);
+    }
+}
+
+TEST(liblog, __android_log_set_buffered__fork) {
+    static const char tag[] = "TEST__android_log_set_buffered__fork";
+    pid_t pid = getpid();
+    log_time ts(CLOCK_REALTIME);
+
+    int previous = __android_log_set_buffered(1);
+    EXPECT_LT(0, __android_log_print(ANDROID_LOG_INFO, tag, "parent"));
+
+    // The child leaves our staged line alone, and logs unbuffered
+    pid_t child = fork();
+    ASSERT_LE(0, child);
+    if (!child) {
+        __android_log_print(ANDROID_LOG_INFO, tag, "child");
+        usleep(20000);
+        _exit((buffered_messages(tag, getpid(), ts).size() == 1) ? 0 : 1);
+    }
+    int status;
+    ASSERT_EQ(child, waitpid(child, &status, 0));
+    EXPECT_TRUE(WIFEXITED(status) && !WEXITSTATUS(status));
+
+    __android_log_set_buffered(previous);
+    usleep(100000);
+    std::vector<std::string> messages = buffered_messages(tag, pid, ts);
+    ASSERT_EQ(1U, messages.size());
+    EXPECT_EQ("parent", messages[0]);
+    messages = buffered_messages(tag, child, ts);
+    ASSERT_EQ(1U, messages.size());
+    EXPECT_EQ("child", messages[0]);
+}
+
 TEST(liblog, __android_log_btwrite__android_logger_list_read) {
     struct logger_list *logger_list;
 
@@ -2517,3 +2671,77 @@ TEST(liblog, __android_log_pmsg_file_read) {
     EXPECT_LT(0, ret);
     EXPECT_EQ(1U, signaled);
 }
+
+TEST(liblog, android_lookupEventTag__index) {
+    static const char text_file[] = "/system/etc/event-log-tags";
+    static const char index_file[] = "/system/etc/event-log-tags.bin";
+
+    // A header claiming more tags than fit, 8 * numTags wraps a 32-bit
+    // size_t to 0, must be turned away rather than read past the mapping.
+    char corrupt_file[] = "/data/local/tmp/event-log-tags.XXXXXX";
+    int corrupt_fd = mkstemp(corrupt_file);
+    ASSERT_LE(0, corrupt_fd);
+    struct {
+        uint32_t magic, version, size, numTags;
+        char strings[8];
+    } corrupt = { 0x78644945, 1, sizeof(corrupt), 0x20000000, { 0 } };
+    ASSERT_EQ((ssize_t)sizeof(corrupt),
+              write(corrupt_fd, &corrupt, sizeof(corrupt)));
+    close(corrupt_fd);
+    // nor is it text
+    EventTagMap *corrupt_map = android_openEventTagMap(corrupt_file);
+    unlink(corrupt_file);
+    EXPECT_TRUE(NULL == corrupt_map);
+    if (corrupt_map) {
+        android_closeEventTagMap(corrupt_map);
+    }
+
+    if (access(index_file, R_OK)) {
+        fprintf(stderr, "No %s to compare with %s,\n"
+                        "false positive test result.\n",
+                index_file, text_file);
+        return;
+    }
+
+    // A copy has no index alongside, it is parsed as text
+    char copy_file[] = "/data/local/tmp/event-log-tags.XXXXXX";
+    int fd = mkstemp(copy_file);
+    ASSERT_LE(0, fd);
+    FILE *in = fopen(text_file, "re");
+    ASSERT_TRUE(NULL != in);
+    std::vector<int> tags;
+    char line[1024];
+    while (fgets(line, sizeof(line), in)) {
+        ASSERT_EQ((ssize_t)strlen(line), write(fd, line, strlen(line)));
+        int tag;
+        if (sscanf(line, "%d", &tag) == 1) {
+            tags.push_back(tag);
+        }
+    }
+    fclose(in);
+    close(fd);
+    EXPECT_LT(0U, tags.size());
+
+    EventTagMap *text_map = android_openEventTagMap(copy_file);
+    unlink(copy_file);
+    ASSERT_TRUE(NULL != text_map);
+    // An index is also accepted given as the file itself
+    EventTagMap *index_map = android_openEventTagMap(index_file);
+    ASSERT_TRUE(NULL != index_map);
+
+    for (size_t i = 0; i < tags.size(); ++i) {
+        // and either side of it, which are most likely not tags
+        for (int tag = tags[i] - 1; tag <= (tags[i] + 1); ++tag) {
+            const char *text_name = android_lookupEventTag(text_map, tag);
+            const char *index_name = android_lookupEventTag(index_map, tag);
+            if (!text_name || !index_name) {
+                EXPECT_EQ(text_name, index_name) << "tag " << tag;
+            } else {
+                EXPECT_STREQ(text_name, index_name) << "tag " << tag;
+            }
+        }
+    }
+
+    android_closeEventTagMap(index_map);
+    android_closeEventTagMap(text_map);
+}
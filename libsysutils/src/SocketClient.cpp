@@ -227,6 +227,81 @@ int SocketClient::sendDataLockedv(struct iovec *iov, int iovcnt) {
     return ret;
 }
 
+int SocketClient::sendMultipleDatav(struct mmsghdr *msgs, unsigned int count) {
+    pthread_mutex_lock(&mWriteMutex);
+    int rc = sendMultipleDataLockedv(msgs, count);
+    pthread_mutex_unlock(&mWriteMutex);
+
+    return rc;
+}
+
+int SocketClient::sendMultipleDataLockedv(struct mmsghdr *msgs,
+                                          unsigned int count) {
+
+    if (mSocket < 0) {
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+
+    int ret = 0;
+    int e = 0; // SLOGW and sigaction are not inert regarding errno
+    unsigned int current = 0;
+
+    struct sigaction new_action, old_action;
+    memset(&new_action, 0, sizeof(new_action));
+    new_action.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &new_action, &old_action);
+
+    while (current < count) {
+        int rc = TEMP_FAILURE_RETRY(
+            sendmmsg(mSocket, msgs + current, count - current, 0));
+
+        if (rc > 0) {
+            current += rc;
+
+            // A stream socket may take only part of the last message,
+            // finish it off before moving on.
+            struct msghdr *hdr = &msgs[current - 1].msg_hdr;
+            struct iovec *iov = hdr->msg_iov;
+            int iovcnt = hdr->msg_iovlen;
+            size_t written = msgs[current - 1].msg_len;
+            while ((iovcnt > 0) && (written >= iov->iov_len)) {
+                written -= iov->iov_len;
+                ++iov;
+                --iovcnt;
+            }
+            if (iovcnt == 0) {
+                continue;
+            }
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+            if (sendDataLockedv(iov, iovcnt)) {
+                e = errno;
+                ret = -1;
+                break;
+            }
+            continue;
+        }
+
+        if (rc == 0) {
+            e = EIO;
+            SLOGW("0 length write :(");
+        } else {
+            e = errno;
+            SLOGW("write error (%s)", strerror(e));
+        }
+        ret = -1;
+        break;
+    }
+
+    sigaction(SIGPIPE, &old_action, &new_action);
+
+    if (e != 0) {
+        errno = e;
+    }
+    return ret;
+}
+
 void SocketClient::incRef() {
     pthread_mutex_lock(&mRefCountMutex);
     mRefCount++;
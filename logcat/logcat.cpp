@@ -8,6 +8,7 @@
 #include <fcntl.h>
 #include <getopt.h>
 #include <math.h>
+#include <pthread.h>
 #include <sched.h>
 #include <signal.h>
 #include <stdarg.h>
@@ -24,8 +25,10 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <android-base/file.h>
+#include <android-base/stringprintf.h>
 #include <android-base/strings.h>
 #include <cutils/properties.h>
 #include <cutils/sched_policy.h>
@@ -39,6 +42,7 @@
 #include <utils/threads.h>
 
 #include <pcrecpp.h>
+#include <zlib.h>
 
 #define DEFAULT_MAX_ROTATED_LOGS 4
 
@@ -83,12 +87,23 @@ static size_t g_outByteCountOfLogDump;
 static int g_printBinary;
 static int g_devCount;                              // >1 means multiple
 static pcrecpp::RE* g_regex;
+// Literal text any match of g_regex must contain, checked first
+static std::string g_regexLiteral;
+static bool g_regexIsLiteral;                       // g_regex adds nothing
 // 0 means "infinite"
 static size_t g_maxCount;
 static size_t g_printCount;
 static bool g_printItAnyways;
 static bool g_logDumpEnabled;
 static size_t g_logDumpEndPosition = 0;
+// gzip rotated logs, done along with the rotation on its own thread
+static bool g_compressLogs;
+static pthread_mutex_t g_rotateLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_rotateCond = PTHREAD_COND_INITIALIZER;
+static bool g_rotating;                             // segment 0 pending
+// Print formats applied to g_logformat, in order, to set up others alike
+static std::vector<AndroidLogPrintFormat> g_printFormats;
+static bool g_printMonotonic = false;
 
 // if showHelp is set, newline required in fmt statement to transition to usage
 __noreturn static void logcat_panic(bool showHelp, const char *fmt, ...) __printflike(2,3);
@@ -98,46 +113,195 @@ static int openLogFile (const char *pathname)
     return open(pathname, O_WRONLY | O_APPEND | O_CREAT, S_IRUSR | S_IWUSR);
 }
 
-static void rotateLogs()
+// Name of rotated segment i of g_outputFileName. Segment 0 is the output
+// file as it was at rotation, waiting for the rotation thread.
+static std::string segmentName(size_t i, const char *suffix = "")
 {
-    int err;
-
-    // Can't rotate logs if we're not outputting to a file
-    if (g_outputFileName == NULL) {
-        return;
-    }
-
-    close(g_outFD);
-
     // Compute the maximum number of digits needed to count up to g_maxRotatedLogs in decimal.
     // eg: g_maxRotatedLogs == 30 -> log10(30) == 1.477 -> maxRotationCountDigits == 2
     int maxRotationCountDigits =
             (g_maxRotatedLogs > 0) ? (int) (floor(log10(g_maxRotatedLogs) + 1)) : 0;
 
-    for (int i = g_maxRotatedLogs ; i > 0 ; i--) {
-        char *file0, *file1;
-
-        asprintf(&file1, "%s.%.*d", g_outputFileName, maxRotationCountDigits, i);
+    return android::base::StringPrintf("%s.%.*d%s", g_outputFileName,
+                                       maxRotationCountDigits, (int) i,
+                                       suffix);
+}
 
-        if (i - 1 == 0) {
-            asprintf(&file0, "%s", g_outputFileName);
-        } else {
-            asprintf(&file0, "%s.%.*d", g_outputFileName, maxRotationCountDigits, i - 1);
+static bool compressFile(const char *from, const char *to)
+{
+    int in = open(from, O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        return false;
+    }
+    int out = open(to, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                   S_IRUSR | S_IWUSR);
+    if (out < 0) {
+        close(in);
+        return false;
+    }
+    // gzclose closes its fd, keep ours for the fsync
+    int gzfd = dup(out);
+    gzFile gz = (gzfd < 0) ? NULL : gzdopen(gzfd, "wb");
+    if (!gz) {
+        if (gzfd >= 0) {
+            close(gzfd);
         }
+        close(out);
+        close(in);
+        unlink(to);
+        return false;
+    }
 
-        if (!file0 || !file1) {
-            perror("while rotating log files");
+    bool ok = true;
+    char buf[32768];
+    ssize_t len;
+    while ((len = TEMP_FAILURE_RETRY(read(in, buf, sizeof(buf)))) > 0) {
+        if (gzwrite(gz, buf, len) != len) {
+            ok = false;
             break;
         }
+    }
+    if (len < 0) {
+        ok = false;
+    }
+    if (gzclose(gz) != Z_OK) {
+        ok = false;
+    }
+    // on disk before the rename publishes it, or a crash could leave a
+    // truncated .gz in place of the segment
+    if (ok && fsync(out)) {
+        ok = false;
+    }
+    close(out);
+    close(in);
+    if (!ok) {
+        unlink(to);
+    }
+    return ok;
+}
 
-        err = rename(file0, file1);
+static void renameSegment(const std::string &from, const std::string &to)
+{
+    if ((rename(from.c_str(), to.c_str()) < 0) && (errno != ENOENT)) {
+        perror("while rotating log files");
+    }
+}
 
-        if (err < 0 && errno != ENOENT) {
-            perror("while rotating log files");
+// Shift the rotated segments up by one, dropping the oldest, and put
+// segment 0 in place as segment 1, compressed if asked to. Run by the
+// rotation thread.
+static void rotateSegments()
+{
+    std::string staged = segmentName(0);
+    std::string compressed;
+
+    if (g_compressLogs) {
+        compressed = segmentName(0, ".gz.tmp");
+        if (!compressFile(staged.c_str(), compressed.c_str())) {
+            perror("while compressing log file");
+            compressed.clear();
         }
+    }
 
-        free(file1);
-        free(file0);
+    unlink(segmentName(g_maxRotatedLogs).c_str());
+    unlink(segmentName(g_maxRotatedLogs, ".gz").c_str());
+    for (size_t i = g_maxRotatedLogs; i > 1; --i) {
+        renameSegment(segmentName(i - 1), segmentName(i));
+        renameSegment(segmentName(i - 1, ".gz"), segmentName(i, ".gz"));
+    }
+
+    if (compressed.empty()) {
+        renameSegment(staged, segmentName(1));
+    } else {
+        renameSegment(compressed, segmentName(1, ".gz"));
+        unlink(staged.c_str());
+    }
+}
+
+static void *rotateThread(void * /*obj*/)
+{
+    pthread_mutex_lock(&g_rotateLock);
+    for (;;) {
+        while (!g_rotating) {
+            pthread_cond_wait(&g_rotateCond, &g_rotateLock);
+        }
+        pthread_mutex_unlock(&g_rotateLock);
+
+        rotateSegments();
+
+        pthread_mutex_lock(&g_rotateLock);
+        g_rotating = false;
+        pthread_cond_broadcast(&g_rotateCond);
+    }
+    return NULL;
+}
+
+// Let a rotation in progress finish before we exit
+static void waitRotation()
+{
+    pthread_mutex_lock(&g_rotateLock);
+    while (g_rotating) {
+        pthread_cond_wait(&g_rotateCond, &g_rotateLock);
+    }
+    pthread_mutex_unlock(&g_rotateLock);
+}
+
+// Hand segment 0 to the rotation thread, starting it if need be
+static void startRotation()
+{
+    static bool started;
+
+    pthread_mutex_lock(&g_rotateLock);
+    if (!started) {
+        pthread_attr_t attr;
+        pthread_t thread;
+
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        started = !pthread_create(&thread, &attr, rotateThread, NULL);
+        pthread_attr_destroy(&attr);
+    }
+    if (started) {
+        g_rotating = true;
+        pthread_cond_broadcast(&g_rotateCond);
+    }
+    pthread_mutex_unlock(&g_rotateLock);
+
+    if (!started) {
+        rotateSegments();
+    }
+}
+
+// Only the output file is renamed here, everything else is left to the
+// rotation thread so that reading from logd is not held up by storage.
+static void rotateLogs()
+{
+    // Can't rotate logs if we're not outputting to a file
+    if (g_outputFileName == NULL) {
+        return;
+    }
+
+    // The previous segment is still being dealt with. Rather than wait for
+    // it, carry on with this one a while longer, we are called again for
+    // the next entry. Past twice the rotation size, wait after all.
+    pthread_mutex_lock(&g_rotateLock);
+    bool rotating = g_rotating;
+    pthread_mutex_unlock(&g_rotateLock);
+    if (rotating) {
+        if ((g_outByteCount / 1024) < (2 * g_logRotateSizeKBytes)) {
+            return;
+        }
+        waitRotation();
+    }
+
+    close(g_outFD);
+
+    if (rename(g_outputFileName, segmentName(0).c_str()) < 0) {
+        if (errno != ENOENT) {
+            perror("while rotating log files");
+        }
+    } else {
+        startRotation();
     }
 
     g_outFD = openLogFile(g_outputFileName);
@@ -193,15 +357,171 @@ static void writeEntryToLogDump(AndroidLogEntry *entry)
     g_outByteCountOfLogDump += bytesWrittenToLogDump;
 }
 
+/*
+ * The longest run of literal characters that every match of expr must
+ * contain, or empty if that can not be told without a full parse. Only
+ * top level runs count, and anything that might make a run optional or
+ * an alternative (alternation, inline options, \Q) gives up on the lot,
+ * as does any escape that may take arguments (\x41, \cA, \p{L}, \012).
+ * isLiteral is set if the expression is nothing more than its literal.
+ */
+static std::string requiredLiteral(const char *expr, bool *isLiteral)
+{
+    std::string best, run;
+    int depth = 0;
+
+    *isLiteral = false;
+    if (strchr(expr, '|') || strstr(expr, "(?") || strstr(expr, "\\Q")) {
+        return best;
+    }
+    bool literal = true;
+    for (const char *cp = expr; *cp; ++cp) {
+        switch (*cp) {
+            case '\\':
+                if (!cp[1]) {
+                    return std::string();
+                }
+                ++cp;
+                if (isalnum(*cp)) {
+                    // character classes and assertions end a run, codes
+                    // and back references carry arguments we do not parse
+                    if (!strchr("dDwWsShHvVbBAzZG", *cp)) {
+                        return std::string();
+                    }
+                    literal = false;
+                    break;
+                }
+                if (!depth) {
+                    run += *cp;
+                }
+                continue;
+            case '[':
+                literal = false;
+                ++cp;
+                if (*cp == '^') {
+                    ++cp;
+                }
+                if (*cp == ']') {
+                    ++cp;
+                }
+                while (*cp && (*cp != ']')) {
+                    if ((*cp == '\\') && cp[1]) {
+                        ++cp;
+                    }
+                    ++cp;
+                }
+                if (!*cp) {
+                    return std::string();
+                }
+                break;
+            case '(':
+                literal = false;
+                ++depth;
+                break;
+            case ')':
+                literal = false;
+                --depth;
+                break;
+            case '.':
+            case '^':
+            case '$':
+                literal = false;
+                break;
+            case '{': {
+                // a quantifier unless it does not parse as one
+                const char *end = cp + 1;
+                while (isdigit(*end) || (*end == ',')) {
+                    ++end;
+                }
+                if ((*end != '}') || (end == cp + 1)) {
+                    literal = false;
+                    break;
+                }
+                cp = end;
+            }
+                // FALLTHRU
+            case '*':
+            case '?':
+                // previous character is optional
+                literal = false;
+                if (!run.empty()) {
+                    run.erase(run.length() - 1);
+                }
+                break;
+            case '+': {
+                // previous character is required, its repeats are not,
+                // unless (lazy or possessive aside) quantified again
+                literal = false;
+                const char *next = cp + 1;
+                if ((*next == '?') || (*next == '+')) {
+                    ++next;
+                }
+                if (*next && strchr("*?{", *next) && !run.empty()) {
+                    run.erase(run.length() - 1);
+                }
+            }
+                break;
+            default:
+                if (!depth) {
+                    run += *cp;
+                }
+                continue;
+        }
+        if (run.length() > best.length()) {
+            best = run;
+        }
+        run.clear();
+    }
+    if (run.length() > best.length()) {
+        best = run;
+    }
+    *isLiteral = literal;
+    return best;
+}
+
 static bool regexOk(const AndroidLogEntry& entry)
 {
     if (!g_regex) {
         return true;
     }
 
-    std::string messageString(entry.message, entry.messageLen);
+    if (!g_regexLiteral.empty() && !memmem(entry.message, entry.messageLen,
+                                           g_regexLiteral.data(),
+                                           g_regexLiteral.length())) {
+        return false;
+    }
+    if (g_regexIsLiteral) {
+        return true;
+    }
+
+    return g_regex->PartialMatch(pcrecpp::StringPiece(entry.message,
+                                                      entry.messageLen));
+}
+
+static EventTagMap *getEventTagMap()
+{
+    static bool hasOpenedEventTagMap = false;
+    static EventTagMap *eventTagMap = NULL;
+
+    if (!eventTagMap && !hasOpenedEventTagMap) {
+        eventTagMap = android_openEventTagMap(EVENT_TAG_MAP_FILE);
+        hasOpenedEventTagMap = true;
+    }
+    return eventTagMap;
+}
 
-    return g_regex->PartialMatch(messageString);
+// binaryMsgBuf holds the message of a binary entry, must outlive entry
+static int processEntry(bool binary, struct log_msg *buf,
+                        AndroidLogEntry *entry,
+                        char *binaryMsgBuf, size_t binaryMsgBufLen)
+{
+    if (binary) {
+        return android_log_processBinaryLogBuffer(&buf->entry_v1, entry,
+                                                  getEventTagMap(),
+                                                  binaryMsgBuf,
+                                                  binaryMsgBufLen);
+    }
+    return android_log_processLogBuffer(&buf->entry_v1, entry);
 }
 
 static void processBuffer(log_device_t* dev, struct log_msg *buf)
@@ -211,23 +531,8 @@ static void processBuffer(log_device_t* dev, struct log_msg *buf)
     AndroidLogEntry entry;
     char binaryMsgBuf[1024];
 
-    if (dev->binary) {
-        static bool hasOpenedEventTagMap = false;
-        static EventTagMap *eventTagMap = NULL;
-
-        if (!eventTagMap && !hasOpenedEventTagMap) {
-            eventTagMap = android_openEventTagMap(EVENT_TAG_MAP_FILE);
-            hasOpenedEventTagMap = true;
-        }
-        err = android_log_processBinaryLogBuffer(&buf->entry_v1, &entry,
-                                                 eventTagMap,
-                                                 binaryMsgBuf,
-                                                 sizeof(binaryMsgBuf));
-        //printf(">>> pri=%d len=%d msg='%s'\n",
-        //    entry.priority, entry.messageLen, entry.message);
-    } else {
-        err = android_log_processLogBuffer(&buf->entry_v1, &entry);
-    }
+    err = processEntry(dev->binary, buf, &entry,
+                       binaryMsgBuf, sizeof(binaryMsgBuf));
     if (err < 0) {
         goto error;
     }
@@ -285,6 +590,318 @@ static void maybePrintStart(log_device_t* dev, bool printDividers) {
     }
 }
 
+// Panics on a failed android_logger_list_read(), -EAGAIN is the end of a dump
+static void readFailed(int ret)
+{
+    if (ret == 0) {
+        logcat_panic(false, "read: unexpected EOF!\n");
+    }
+    if (ret == -EIO) {
+        logcat_panic(false, "read: unexpected EOF!\n");
+    }
+    if (ret == -EINVAL) {
+        logcat_panic(false, "read: unexpected length.\n");
+    }
+    logcat_panic(false, "logcat read failure");
+}
+
+static void writeOutput(const char *buf, size_t len)
+{
+    while (len) {
+        ssize_t ret = TEMP_FAILURE_RETRY(write(g_outFD, buf, len));
+        if (ret <= 0) {
+            logcat_panic(false, "output error");
+        }
+        buf += ret;
+        len -= ret;
+        g_outByteCount += ret;
+    }
+}
+
+/*
+ * Dumps are CPU bound on filtering (--regex in particular) and formatting,
+ * so they are pipelined: a reader thread fills batches of entries, a pool
+ * of workers filter and format them into text, and the main thread writes
+ * the batches out in the order they were read. The output is what the one
+ * thread loop in main() would have produced.
+ */
+class LogPipeline {
+    struct Batch {
+        static const size_t entries = 32;
+        enum { FREE, FILLED, DONE } state;
+        size_t count;
+        struct log_msg msgs[entries];
+        log_device_t *devs[entries];
+        bool binary[entries];
+        // filled in by a worker
+        bool printable[entries];   // passes android_log_shouldPrintLine
+        bool match[entries];       // and regexOk
+        size_t end[entries];       // end of the entry's text in out
+        std::string out;
+    };
+
+    struct logger_list *mLoggerList;
+    log_device_t *mDevices;
+    log_device_t *mUnexpected;
+    bool mPrintDividers;
+
+    pthread_mutex_t mLock;
+    pthread_cond_t mCond;
+    Batch *mBatches;
+    size_t mNumBatches;
+    uint64_t mRead;    // batches filled by the reader
+    uint64_t mProcess; // batches taken by the workers
+    uint64_t mWrite;   // batches written out
+    bool mEnd;         // reader is done, mRead is final
+    int mReadResult;   // of the last android_logger_list_read()
+    bool mStop;        // --max-count reached, wind down
+
+    static void *readerThread(void *obj);
+    static void *workerThread(void *obj);
+    void reader();
+    void worker();
+    void process(Batch &batch, AndroidLogFormat *format);
+    bool write(Batch &batch, log_device_t *&dev);
+
+public:
+    LogPipeline(struct logger_list *loggerList, log_device_t *devices,
+                log_device_t *unexpected, bool printDividers);
+    ~LogPipeline();
+
+    // Returns the last android_logger_list_read() result, -EAGAIN at the
+    // end of the dump, once everything read before it is written out.
+    int run(size_t workers);
+};
+
+LogPipeline::LogPipeline(struct logger_list *loggerList,
+                         log_device_t *devices,
+                         log_device_t *unexpected,
+                         bool printDividers) :
+        mLoggerList(loggerList),
+        mDevices(devices),
+        mUnexpected(unexpected),
+        mPrintDividers(printDividers),
+        mBatches(NULL),
+        mNumBatches(0),
+        mRead(0),
+        mProcess(0),
+        mWrite(0),
+        mEnd(false),
+        mReadResult(-EAGAIN),
+        mStop(false) {
+    pthread_mutex_init(&mLock, NULL);
+    pthread_cond_init(&mCond, NULL);
+}
+
+LogPipeline::~LogPipeline() {
+    delete [] mBatches;
+    pthread_cond_destroy(&mCond);
+    pthread_mutex_destroy(&mLock);
+}
+
+void *LogPipeline::readerThread(void *obj) {
+    static_cast<LogPipeline *>(obj)->reader();
+    return NULL;
+}
+
+void *LogPipeline::workerThread(void *obj) {
+    static_cast<LogPipeline *>(obj)->worker();
+    return NULL;
+}
+
+void LogPipeline::reader() {
+    for (;;) {
+        pthread_mutex_lock(&mLock);
+        Batch &batch = mBatches[mRead % mNumBatches];
+        while (!mStop && (batch.state != Batch::FREE)) {
+            pthread_cond_wait(&mCond, &mLock);
+        }
+        bool stop = mStop;
+        pthread_mutex_unlock(&mLock);
+        if (stop) {
+            break;
+        }
+
+        int ret = 1;
+        for (batch.count = 0; batch.count < Batch::entries; ++batch.count) {
+            struct log_msg &msg = batch.msgs[batch.count];
+            ret = android_logger_list_read(mLoggerList, &msg);
+            if (ret <= 0) {
+                break;
+            }
+
+            log_device_t *d;
+            for (d = mDevices; d; d = d->next) {
+                if (android_name_to_log_id(d->device) == msg.id()) {
+                    break;
+                }
+            }
+            if (d) {
+                batch.binary[batch.count] = d->binary;
+            } else {
+                d = mUnexpected;
+                batch.binary[batch.count] = msg.id() == LOG_ID_EVENTS;
+            }
+            batch.devs[batch.count] = d;
+        }
+
+        pthread_mutex_lock(&mLock);
+        batch.state = Batch::FILLED;
+        ++mRead;
+        if (ret <= 0) {
+            mEnd = true;
+            mReadResult = ret;
+        }
+        pthread_cond_broadcast(&mCond);
+        pthread_mutex_unlock(&mLock);
+        if (ret <= 0) {
+            break;
+        }
+    }
+}
+
+void LogPipeline::worker() {
+    // android_log_formatLogLine keeps state in its format, one each
+    AndroidLogFormat *format = android_log_format_new();
+    for (size_t i = 0; i < g_printFormats.size(); ++i) {
+        android_log_setPrintFormat(format, g_printFormats[i]);
+    }
+
+    pthread_mutex_lock(&mLock);
+    for (;;) {
+        while (!mStop && (mProcess == mRead) && !mEnd) {
+            pthread_cond_wait(&mCond, &mLock);
+        }
+        if (mStop || (mProcess == mRead)) {
+            break;
+        }
+        Batch &batch = mBatches[mProcess++ % mNumBatches];
+        pthread_mutex_unlock(&mLock);
+
+        process(batch, format);
+
+        pthread_mutex_lock(&mLock);
+        batch.state = Batch::DONE;
+        pthread_cond_broadcast(&mCond);
+    }
+    pthread_mutex_unlock(&mLock);
+
+    // Also empties liblog's global monotonic conversion list, which is
+    // never built here: -v monotonic keeps dumps off the pipeline.
+    android_log_format_free(format);
+}
+
+// processBuffer(), less the output
+void LogPipeline::process(Batch &batch, AndroidLogFormat *format) {
+    char binaryMsgBuf[1024];
+    char defaultBuffer[1024];
+
+    batch.out.clear();
+    for (size_t i = 0; i < batch.count; ++i) {
+        AndroidLogEntry entry;
+
+        batch.printable[i] = false;
+        batch.match[i] = false;
+        if ((processEntry(batch.binary[i], &batch.msgs[i], &entry,
+                          binaryMsgBuf, sizeof(binaryMsgBuf)) >= 0)
+                && android_log_shouldPrintLine(g_logformat, entry.tag,
+                                               entry.priority)) {
+            batch.printable[i] = true;
+            batch.match[i] = regexOk(entry);
+            if (batch.match[i] || g_printItAnyways) {
+                size_t len;
+                char *line = android_log_formatLogLine(format, defaultBuffer,
+                                                       sizeof(defaultBuffer),
+                                                       &entry, &len);
+                if (line) {
+                    batch.out.append(line, len);
+                    if (line != defaultBuffer) {
+                        free(line);
+                    }
+                }
+            }
+        }
+        batch.end[i] = batch.out.length();
+    }
+}
+
+// Returns false once --max-count is reached
+bool LogPipeline::write(Batch &batch, log_device_t *&dev) {
+    size_t start = 0;
+    size_t i;
+    bool more = true;
+
+    for (i = 0; i < batch.count; ++i) {
+        if (g_maxCount && (g_printCount >= g_maxCount)) {
+            more = false;
+            break;
+        }
+        if (dev != batch.devs[i]) {
+            writeOutput(batch.out.data() + start,
+                        (i ? batch.end[i - 1] : 0) - start);
+            start = i ? batch.end[i - 1] : 0;
+            dev = batch.devs[i];
+            if (dev == mUnexpected) {
+                g_devCount = 2; // set to Multiple
+            }
+            maybePrintStart(dev, mPrintDividers);
+        }
+        g_printCount += batch.printable[i] && batch.match[i];
+    }
+    writeOutput(batch.out.data() + start, (i ? batch.end[i - 1] : 0) - start);
+    return more && (!g_maxCount || (g_printCount < g_maxCount));
+}
+
+int LogPipeline::run(size_t workers) {
+    mNumBatches = 2 * workers + 2;
+    mBatches = new Batch[mNumBatches];
+    for (size_t i = 0; i < mNumBatches; ++i) {
+        mBatches[i].state = Batch::FREE;
+    }
+    // Opened up front, not raced for by the workers
+    getEventTagMap();
+
+    pthread_t readerTid;
+    std::vector<pthread_t> workerTids(workers);
+    pthread_create(&readerTid, NULL, readerThread, this);
+    for (size_t i = 0; i < workers; ++i) {
+        pthread_create(&workerTids[i], NULL, workerThread, this);
+    }
+
+    log_device_t *dev = NULL;
+    pthread_mutex_lock(&mLock);
+    for (;;) {
+        Batch &batch = mBatches[mWrite % mNumBatches];
+        while ((batch.state != Batch::DONE) && !(mEnd && (mWrite == mRead))) {
+            pthread_cond_wait(&mCond, &mLock);
+        }
+        if (batch.state != Batch::DONE) {
+            break;
+        }
+        pthread_mutex_unlock(&mLock);
+
+        bool more = write(batch, dev);
+
+        pthread_mutex_lock(&mLock);
+        batch.state = Batch::FREE;
+        ++mWrite;
+        if (!more) {
+            mStop = true;
+        }
+        pthread_cond_broadcast(&mCond);
+        if (mStop) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mLock);
+
+    pthread_join(readerTid, NULL);
+    for (size_t i = 0; i < workers; ++i) {
+        pthread_join(workerTids[i], NULL);
+    }
+    return mStop ? -EAGAIN : mReadResult;
+}
+
 static void setupOutput()
 {
     if (g_logDumpEnabled) {
@@ -347,6 +964,14 @@ static void setupOutput()
         }
 
         g_outByteCount = statbuf.st_size;
+
+        // Finish a rotation cut short by our last exit
+        if (g_logRotateSizeKBytes) {
+            unlink(segmentName(0, ".gz.tmp").c_str());
+            if (!access(segmentName(0).c_str(), F_OK)) {
+                startRotation();
+            }
+        }
     }
 }
 
@@ -361,6 +986,7 @@ static void show_help(const char *cmd)
                     "                  Rotate log every kbytes. Requires -f option\n"
                     "  -n <count>, --rotate-count=<count>\n"
                     "                  Sets max number of rotated logs to <count>, default 4\n"
+                    "  --gzip          Compress rotated logs, <file>.<n>.gz. Requires -r option\n"
                     "  -v <format>, --format=<format>\n"
                     "                  Sets the log print format, where <format> is:\n"
                     "                    brief color epoch long monotonic printable process raw\n"
@@ -441,6 +1067,10 @@ static int setLogFormat(const char * formatString)
         return -1;
     }
 
+    g_printFormats.push_back(format);
+    if (format == FORMAT_MODIFIER_MONOTONIC) {
+        g_printMonotonic = true;
+    }
     return android_log_setPrintFormat(g_logformat, format);
 }
 
@@ -519,6 +1149,42 @@ static char *parseTime(log_time &t, const char *cp) {
     return t.strptime(cp, "%s.%q");
 }
 
+// Suffix of a rotated log segment of file, ".<digits>" or ".<digits>.gz"
+static bool isSegmentSuffix(const char *suffix, bool *compressed) {
+    *compressed = false;
+    if ((*suffix != '.') || !isdigit(*++suffix)) {
+        return false;
+    }
+    while (isdigit(*suffix)) {
+        ++suffix;
+    }
+    if (!strcmp(suffix, ".gz")) {
+        *compressed = true;
+        return true;
+    }
+    return !*suffix;
+}
+
+static bool readLogFile(const std::string &fileName, bool compressed,
+                        std::string *content) {
+    if (!compressed) {
+        return android::base::ReadFileToString(fileName, content);
+    }
+
+    gzFile gz = gzopen(fileName.c_str(), "rb");
+    if (!gz) {
+        return false;
+    }
+    content->clear();
+    char buf[32768];
+    int len;
+    while ((len = gzread(gz, buf, sizeof(buf))) > 0) {
+        content->append(buf, len);
+    }
+    gzclose(gz);
+    return len == 0;
+}
+
 // Find last logged line in gestalt of all matching existing output files
 static log_time lastLogTime(char *outputFileName) {
     log_time retval(log_time::EPOCH);
@@ -553,6 +1219,7 @@ static log_time lastLogTime(char *outputFileName) {
     struct dirent *dp;
 
     while ((dp = readdir(dir.get())) != NULL) {
+        bool compressed = false;
         if ((dp->d_type != DT_REG)
                 // If we are using realtime, check all files that match the
                 // basename for latest time. If we are using monotonic time
@@ -560,8 +1227,7 @@ static log_time lastLogTime(char *outputFileName) {
                 // every reboot.
                 || strncmp(dp->d_name, file, len + monotonic)
                 || (dp->d_name[len]
-                    && ((dp->d_name[len] != '.')
-                        || !isdigit(dp->d_name[len+1])))) {
+                    && !isSegmentSuffix(dp->d_name + len, &compressed))) {
             continue;
         }
 
@@ -569,7 +1235,7 @@ static log_time lastLogTime(char *outputFileName) {
         file_name += "/";
         file_name += dp->d_name;
         std::string file;
-        if (!android::base::ReadFileToString(file_name, &file)) {
+        if (!readLogFile(file_name, compressed, &file)) {
             continue;
         }
 
@@ -652,6 +1318,7 @@ int main(int argc, char **argv)
         static const char pid_str[] = "pid";
         static const char wrap_str[] = "wrap";
         static const char print_str[] = "print";
+        static const char gzip_str[] = "gzip";
         static const struct option long_options[] = {
           { "binary",        no_argument,       NULL,   'B' },
           { "buffer",        required_argument, NULL,   'b' },
@@ -662,6 +1329,7 @@ int main(int argc, char **argv)
           { "format",        required_argument, NULL,   'v' },
           // hidden and undocumented reserved alias for --regex
           { "grep",          required_argument, NULL,   'e' },
+          { gzip_str,        no_argument,       NULL,   0 },
           // hidden and undocumented reserved alias for --max-count
           { "head",          required_argument, NULL,   'm' },
           { "last",          no_argument,       NULL,   'L' },
@@ -720,6 +1388,10 @@ int main(int argc, char **argv)
                     g_printItAnyways = true;
                     break;
                 }
+                if (long_options[option_index].name == gzip_str) {
+                    g_compressLogs = true;
+                    break;
+                }
             break;
 
             case 's':
@@ -774,7 +1446,9 @@ int main(int argc, char **argv)
             break;
 
             case 'e':
+                delete g_regex;
                 g_regex = new pcrecpp::RE(optarg);
+                g_regexLiteral = requiredLiteral(optarg, &g_regexIsLiteral);
             break;
 
             case 'm': {
@@ -1048,6 +1722,9 @@ int main(int argc, char **argv)
     if (g_logRotateSizeKBytes != 0 && g_outputFileName == NULL) {
         logcat_panic(true, "-r requires -f as well\n");
     }
+    if (g_compressLogs && g_logRotateSizeKBytes == 0) {
+        logcat_panic(true, "--gzip requires -r as well\n");
+    }
 
     setupOutput();
 
@@ -1143,6 +1820,23 @@ int main(int argc, char **argv)
                     }
 
                     free(file);
+
+                    // compressed, or segment 0 caught mid rotation
+                    std::vector<std::string> others;
+                    if (i == 0) {
+                        others.push_back(segmentName(0));
+                        others.push_back(segmentName(0, ".gz.tmp"));
+                    } else {
+                        others.push_back(segmentName(i, ".gz"));
+                    }
+                    for (size_t j = 0; j < others.size(); ++j) {
+                        err = unlink(others[j].c_str());
+
+                        if (err < 0 && errno != ENOENT && clearFail == NULL) {
+                            perror("while clearing log files");
+                            clearFail = dev->device;
+                        }
+                    }
                 }
             } else if (android_logger_clear(dev->logger)) {
                 clearFail = clearFail ?: dev->device;
@@ -1276,27 +1970,34 @@ int main(int argc, char **argv)
     dev = NULL;
     log_device_t unexpected("unexpected", false);
 
+    // Dumps only; rotation and the log dump partition want output a line
+    // at a time, blocking and wrap reads want it as soon as it is read.
+    // -v monotonic converts through a list liblog keeps in a global, built
+    // and freed without a lock, so it can not be formatted on the workers.
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if ((cpus > 1) && (mode & ANDROID_LOG_NONBLOCK)
+            && !(mode & ANDROID_LOG_WRAP) && !g_printBinary && !g_printMonotonic
+            && !g_logRotateSizeKBytes && !g_logDumpEnabled
+            && (!g_maxCount || (g_printCount < g_maxCount))) {
+        LogPipeline pipeline(logger_list, devices, &unexpected, printDividers);
+        int ret = pipeline.run((cpus > 5) ? 4 : (cpus - 1));
+        if (ret != -EAGAIN) {
+            readFailed(ret);
+        }
+        android_logger_list_free(logger_list);
+        return EXIT_SUCCESS;
+    }
+
     while (!g_maxCount || (g_printCount < g_maxCount)) {
         struct log_msg log_msg;
         log_device_t* d;
         int ret = android_logger_list_read(logger_list, &log_msg);
 
-        if (ret == 0) {
-            logcat_panic(false, "read: unexpected EOF!\n");
-        }
-
-        if (ret < 0) {
+        if (ret <= 0) {
             if (ret == -EAGAIN) {
                 break;
             }
-
-            if (ret == -EIO) {
-                logcat_panic(false, "read: unexpected EOF!\n");
-            }
-            if (ret == -EINVAL) {
-                logcat_panic(false, "read: unexpected length.\n");
-            }
-            logcat_panic(false, "logcat read failure");
+            readFailed(ret);
         }
 
         for (d = devices; d; d = d->next) {
@@ -1321,6 +2022,7 @@ int main(int argc, char **argv)
         }
     }
 
+    waitRotation();
     android_logger_list_free(logger_list);
 
     return EXIT_SUCCESS;
@@ -17,6 +17,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <gtest/gtest.h>
 
@@ -126,3 +127,43 @@ TEST(logcat, sorted_order) {
     // sample statistically too small
     EXPECT_LT(100, count);
 }
+
+// Wall time of a logcat command, its output discarded
+static double elapsed(const char *command) {
+    struct timespec start, stop;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int ret = system(command);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    if (ret) {
+        return -1;
+    }
+    return (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/*
+ *	Measure logcat -d --regex over all the buffers, for a literal (memmem
+ * prefilter only), a literal with regular expression (prefilter, then
+ * pcre) and a regular expression with no literal to go on (pcre only).
+ * Compare with the unfiltered dump, formatting and output alone.
+ */
+TEST(logcat, dump_regex) {
+    static const char *commands[] = {
+        "logcat -b all -d >/dev/null 2>&1",
+        "logcat -b all -d -e 'ActivityManager' >/dev/null 2>&1",
+        "logcat -b all -d -e 'Displayed .*: \\+[0-9]+ms' >/dev/null 2>&1",
+        "logcat -b all -d -e '[Ww]ak(e|ing)' >/dev/null 2>&1",
+    };
+
+    for (size_t i = 0; i < (sizeof(commands) / sizeof(commands[0])); ++i) {
+        double best = -1;
+        for (int retry = 0; retry < 3; ++retry) {
+            double t = elapsed(commands[i]);
+            ASSERT_LE(0, t);
+            if ((best < 0) || (t < best)) {
+                best = t;
+            }
+        }
+        fprintf(stderr, "%8.3fs %s\n", best, commands[i]);
+    }
+}
@@ -665,6 +665,76 @@ TEST(logcat, logrotate_suffix) {
     EXPECT_FALSE(system(command));
 }
 
+TEST(logcat, logrotate_gzip) {
+    static const char tmp_out_dir_form[] = "/data/local/tmp/logcat.logrotate.XXXXXX";
+    char tmp_out_dir[sizeof(tmp_out_dir_form)];
+    ASSERT_TRUE(NULL != mkdtemp(strcpy(tmp_out_dir, tmp_out_dir_form)));
+
+    static const char logcat_cmd[] = "logcat -b radio -b events -b system -b main"
+                                     " -d -f %s/log.txt -n 10 -r 1 --gzip";
+    char command[sizeof(tmp_out_dir) + sizeof(logcat_cmd)];
+    snprintf(command, sizeof(command), logcat_cmd, tmp_out_dir);
+
+    int ret;
+    EXPECT_FALSE((ret = system(command)));
+    if (!ret) {
+        snprintf(command, sizeof(command), "ls %s 2>/dev/null", tmp_out_dir);
+
+        FILE *fp;
+        EXPECT_TRUE(NULL != (fp = popen(command, "r")));
+        char buffer[BIG_BUFFER];
+        int log_file_count = 0;
+
+        while (fgets(buffer, sizeof(buffer), fp)) {
+            static const char rotated_log_filename_prefix[] = "log.txt.";
+            static const size_t rotated_log_filename_prefix_len =
+                strlen(rotated_log_filename_prefix);
+            static const char log_filename[] = "log.txt\n";
+
+            if (!strncmp(buffer, rotated_log_filename_prefix, rotated_log_filename_prefix_len)) {
+              // Rotated file should have form log.txt.##.gz, and all
+              // rotations are complete by the time logcat -d exits.
+              char* rotated_log_filename_suffix = buffer + rotated_log_filename_prefix_len;
+              char* endptr;
+              const long int suffix_value = strtol(rotated_log_filename_suffix, &endptr, 10);
+              EXPECT_EQ(rotated_log_filename_suffix + 2, endptr);
+              EXPECT_STREQ(".gz\n", endptr);
+              EXPECT_LE(suffix_value, 10);
+              EXPECT_GT(suffix_value, 0);
+
+              char name[sizeof(tmp_out_dir) + BIG_BUFFER];
+              snprintf(name, sizeof(name), "%s/%.*s", tmp_out_dir,
+                       (int)strcspn(buffer, "\n"), buffer);
+              FILE *gz = fopen(name, "r");
+              EXPECT_TRUE(NULL != gz);
+              if (gz) {
+                  // gzip magic
+                  EXPECT_EQ(0x1f, fgetc(gz));
+                  EXPECT_EQ(0x8b, fgetc(gz));
+                  fclose(gz);
+              }
+              ++log_file_count;
+              continue;
+            }
+
+            if (!strcmp(buffer, log_filename)) {
+              ++log_file_count;
+              continue;
+            }
+
+            fprintf(stderr, "ERROR: Unexpected file: %s", buffer);
+            ADD_FAILURE();
+        }
+        pclose(fp);
+        // Compression is slow enough that a rotation may be deferred while
+        // the previous one runs, so not every -r 1 worth makes a segment.
+        EXPECT_LE(2, log_file_count);
+        EXPECT_GE(11, log_file_count);
+    }
+    snprintf(command, sizeof(command), "rm -rf %s", tmp_out_dir);
+    EXPECT_FALSE(system(command));
+}
+
 TEST(logcat, logrotate_continue) {
     static const char tmp_out_dir_form[] = "/data/local/tmp/logcat.logrotate.XXXXXX";
     char tmp_out_dir[sizeof(tmp_out_dir_form)];
@@ -1090,3 +1160,103 @@ TEST(logcat, maxcount) {
 
     ASSERT_EQ(3, count);
 }
+
+// Lines printed by a logcat command, less the buffer dividers
+static int count_lines(const char *command) {
+    FILE *fp;
+    int count = 0;
+    char buffer[BIG_BUFFER];
+
+    if (!(fp = popen(command, "r"))) {
+        return -1;
+    }
+
+    while (fgets(buffer, sizeof(buffer), fp)) {
+        if (!strncmp(begin, buffer, sizeof(begin) - 1)) {
+            continue;
+        }
+
+        count++;
+    }
+
+    pclose(fp);
+
+    return count;
+}
+
+TEST(logcat, regex_literal) {
+    char buffer[BIG_BUFFER];
+
+    LOG_FAILURE_RETRY(__android_log_print(ANDROID_LOG_WARN, "logcat_test", "logcat_test_x.y"));
+    LOG_FAILURE_RETRY(__android_log_print(ANDROID_LOG_WARN, "logcat_test", "logcat_test_xzy"));
+    LOG_FAILURE_RETRY(__android_log_print(ANDROID_LOG_WARN, "logcat_test", "logcat_test_xy"));
+
+    // Let the logs settle
+    sleep(1);
+
+    // Pure literal, no pcre involved
+    snprintf(buffer, sizeof(buffer), "logcat --pid %d -d -e 'logcat_test_x\\.y'", getpid());
+    EXPECT_EQ(1, count_lines(buffer));
+
+    // Literal prefix, pcre for the rest
+    snprintf(buffer, sizeof(buffer), "logcat --pid %d -d -e 'logcat_test_x.y'", getpid());
+    EXPECT_EQ(2, count_lines(buffer));
+
+    // Optional character, not part of the literal
+    snprintf(buffer, sizeof(buffer), "logcat --pid %d -d -e 'logcat_test_xz?y'", getpid());
+    EXPECT_EQ(2, count_lines(buffer));
+}
+
+TEST(logcat, regex_escapes) {
+    char buffer[BIG_BUFFER];
+
+    LOG_FAILURE_RETRY(__android_log_print(ANDROID_LOG_WARN, "logcat_test", "logcat_test_escAbar"));
+    LOG_FAILURE_RETRY(__android_log_print(ANDROID_LOG_WARN, "logcat_test", "logcat_test_esc\001bar"));
+
+    // Let the logs settle
+    sleep(1);
+
+    // Escapes with arguments, none of which is part of the literal
+    static const char *escapes[] = {
+        "\\x41", "\\101", "\\cA", "\\p{Lu}", "\\x{41}",
+    };
+    for (size_t i = 0; i < (sizeof(escapes) / sizeof(escapes[0])); ++i) {
+        snprintf(buffer, sizeof(buffer), "logcat --pid %d -d -e 'logcat_test_esc%sbar'",
+                 getpid(), escapes[i]);
+        EXPECT_EQ(1, count_lines(buffer)) << escapes[i];
+    }
+}
+
+TEST(logcat, regex_alternation) {
+    char buffer[BIG_BUFFER];
+
+    LOG_FAILURE_RETRY(__android_log_print(ANDROID_LOG_WARN, "logcat_test", "logcat_test_cd"));
+    LOG_FAILURE_RETRY(__android_log_print(ANDROID_LOG_WARN, "logcat_test", "logcat_test_ef"));
+    LOG_FAILURE_RETRY(__android_log_print(ANDROID_LOG_WARN, "logcat_test", "logcat_test_gh"));
+
+    // Let the logs settle
+    sleep(1);
+
+    snprintf(buffer, sizeof(buffer), "logcat --pid %d -d -e 'logcat_test_cd|logcat_test_gh'", getpid());
+    EXPECT_EQ(2, count_lines(buffer));
+}
+
+TEST(logcat, regex_maxcount) {
+    char buffer[BIG_BUFFER];
+
+    for (int i = 0; i < 100; ++i) {
+        LOG_FAILURE_RETRY(__android_log_print(ANDROID_LOG_WARN, "logcat_test", "logcat_test_max %d", i));
+        LOG_FAILURE_RETRY(__android_log_print(ANDROID_LOG_WARN, "logcat_test", "logcat_test_min %d", i));
+    }
+
+    // Let the logs settle
+    sleep(1);
+
+    // Enough entries for the dump to span several batches of the pipeline
+    snprintf(buffer, sizeof(buffer), "logcat --pid %d -d -e logcat_test_max -m 70", getpid());
+    EXPECT_EQ(70, count_lines(buffer));
+
+    // Everything up to the last match, earlier tests' entries included
+    snprintf(buffer, sizeof(buffer), "logcat --pid %d -d -e logcat_test_max -m 70 --print", getpid());
+    EXPECT_LE(139, count_lines(buffer));
+}
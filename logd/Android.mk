@@ -14,7 +14,10 @@ LOCAL_SRC_FILES := \
     LogReader.cpp \
     FlushCommand.cpp \
     LogBuffer.cpp \
+    LogBufferArena.cpp \
     LogBufferElement.cpp \
+    LogRateLimit.cpp \
+    LogRing.cpp \
     LogTimes.cpp \
     LogStatistics.cpp \
     LogWhiteBlackList.cpp \
@@ -28,7 +31,8 @@ LOCAL_SHARED_LIBRARIES := \
     liblog \
     libcutils \
     libbase \
-    libpackagelistparser
+    libpackagelistparser \
+    libz
 
 # This is what we want to do:
 #  event_logtags = $(shell \
@@ -39,6 +43,8 @@ LOCAL_SHARED_LIBRARIES := \
 #  event_flag += $(call event_logtags,logd)
 # so make sure we do not regret hard-coding it as follows:
 event_flag := -DAUDITD_LOG_TAG=1003 -DLOGD_LOG_TAG=1004
+# and from liblog/event.logtags
+event_flag += -DLIBLOG_LOG_TAG=1005
 
 LOCAL_CFLAGS := -Werror $(event_flag)
 
@@ -25,6 +25,8 @@
 #include <sys/uio.h>
 #include <syslog.h>
 
+#include <utility>
+
 #include <log/logger.h>
 #include <private/android_filesystem_config.h>
 #include <private/android_logger.h>
@@ -41,8 +43,9 @@
     '0' + LOG_MAKEPRI(LOG_AUTH, LOG_PRI(PRI)) % 10, \
     '>'
 
-LogAudit::LogAudit(LogBuffer *buf, LogReader *reader, int fdDmesg) :
-        SocketListener(getLogSocket(), false),
+LogAudit::LogAudit(LogBuffer *buf, LogReader *reader, int fdDmesg,
+                   int fdAudit) :
+        SocketListener(fdAudit, false),
         logbuf(buf),
         reader(reader),
         fdDmesg(fdDmesg),
@@ -70,34 +73,102 @@ bool LogAudit::onDataAvailable(SocketClient *cli) {
         return false;
     }
 
-    logPrint("type=%d %.*s",
-        rep.nlh.nlmsg_type, rep.nlh.nlmsg_len, rep.data);
+    // "type=<type> <data>"
+    char str[maxRecordLen];
+    static const char type_str[] = "type=";
+    memcpy(str, type_str, sizeof(type_str) - 1);
+    char *cp = str + sizeof(type_str) - 1;
+    char digits[sizeof("65535")];
+    char *dp = digits + sizeof(digits);
+    unsigned type = rep.nlh.nlmsg_type;
+    do {
+        *--dp = '0' + (type % 10);
+    } while (type /= 10);
+    size_t len = digits + sizeof(digits) - dp;
+    memcpy(cp, dp, len);
+    cp += len;
+    *cp++ = ' ';
+
+    size_t data_len = (rep.nlh.nlmsg_len < sizeof(rep.data))
+                    ? rep.nlh.nlmsg_len : sizeof(rep.data);
+    cp = squeeze(str, cp, rep.data, data_len);
+    *cp = '\0';
+
+    logRecord(str, cp - str);
 
     return true;
 }
 
-int LogAudit::logPrint(const char *fmt, ...) {
-    if (fmt == NULL) {
-        return -EINVAL;
+// Append the up to len bytes at src to the string at str that currently
+// ends at cp, stopping at any nul, and squeezing each run of spaces in the
+// result down to one. Returns the new end, the caller nul terminates.
+char *LogAudit::squeeze(char *str, char *cp, const char *src, size_t len) {
+    len = strnlen(src, len);
+    const char *end = src + len;
+    while (src < end) {
+        const char *space = static_cast<const char *>(
+            memchr(src, ' ', end - src));
+        if (!space) {
+            space = end;
+        }
+        memcpy(cp, src, space - src);
+        cp += space - src;
+        if (space == end) {
+            break;
+        }
+        if ((cp == str) || (cp[-1] != ' ')) {
+            *cp++ = ' ';
+        }
+        src = space + 1;
     }
+    return cp;
+}
 
-    va_list args;
-
-    char *str = NULL;
-    va_start(args, fmt);
-    int rc = vasprintf(&str, fmt, args);
-    va_end(args);
-
-    if (rc < 0) {
-        return rc;
-    }
+// s if needle, a string literal, is found there and ends before end
+template <size_t N>
+static inline char *match(char *s, const char *end, const char (&needle)[N]) {
+    return (((size_t)(end - s) >= (N - 1)) && !memcmp(s, needle, N - 1))
+        ? s : NULL;
+}
 
-    char *cp;
-    while ((cp = strstr(str, "  "))) {
-        memmove(cp, cp + 1, strlen(cp + 1) + 1);
+int LogAudit::logRecord(char *str, size_t len) {
+    static const char audit_str[] = " audit(";
+    static const char pid_str[] = " pid=";
+    static const char comm_str[] = " comm=\"";
+    static const char permissive_str[] = " permissive=1";
+    static const char policy_str[] = " policy loaded ";
+
+    // A single pass over the words of the record for everything we are
+    // interested in, all of it starts with a space.
+    char *end = str + len;
+    char *timeptr = NULL;
+    char *pidptr = NULL;
+    char *commptr = NULL;
+    bool info = false;
+    for (char *cp = str;
+            (cp = static_cast<char *>(memchr(cp, ' ', end - cp)));
+            ++cp) {
+        switch (cp[1]) {
+        case 'a':
+            if (!timeptr) {
+                timeptr = match(cp, end, audit_str);
+            }
+            break;
+        case 'c':
+            if (!commptr) {
+                commptr = match(cp, end, comm_str);
+            }
+            break;
+        case 'p':
+            if (!pidptr && ((pidptr = match(cp, end, pid_str)))) {
+                break;
+            }
+            info = info || match(cp, end, permissive_str)
+                        || match(cp, end, policy_str);
+            break;
+        }
     }
 
-    bool info = strstr(str, " permissive=1") || strstr(str, " policy loaded ");
     if ((fdDmesg >= 0) && initialized) {
         struct iovec iov[3];
         static const char log_info[] = { KMSG_PRIORITY(LOG_INFO) };
@@ -107,7 +178,7 @@ int LogAudit::logPrint(const char *fmt, ...) {
                                : const_cast<char *>(log_warning);
         iov[0].iov_len = info ? sizeof(log_info) : sizeof(log_warning);
         iov[1].iov_base = str;
-        iov[1].iov_len = strlen(str);
+        iov[1].iov_len = len;
         iov[2].iov_base = const_cast<char *>("\n");
         iov[2].iov_len = 1;
 
@@ -119,13 +190,25 @@ int LogAudit::logPrint(const char *fmt, ...) {
     uid_t uid = AID_LOGD;
     log_time now;
 
-    static const char audit_str[] = " audit(";
-    char *timeptr = strstr(str, audit_str);
+    // Sections of the record cut out below, the time is replaced with
+    // 0.0 by cutting all but the first three characters of it
+    struct {
+        char *begin;
+        char *end;
+    } cut[2];
+    size_t cuts = 0;
+
+    char *cp;
     if (timeptr
             && ((cp = now.strptime(timeptr + sizeof(audit_str) - 1, "%s.%q")))
             && (*cp == ':')) {
-        memcpy(timeptr + sizeof(audit_str) - 1, "0.0", 3);
-        memmove(timeptr + sizeof(audit_str) - 1 + 3, cp, strlen(cp) + 1);
+        char *time = timeptr + sizeof(audit_str) - 1;
+        if ((cp - time) >= 3) {
+            memcpy(time, "0.0", 3);
+            cut[cuts].begin = time + 3;
+            cut[cuts].end = cp;
+            ++cuts;
+        }
         if (!isMonotonic()) {
             if (android::isMonotonic(now)) {
                 LogKlog::convertMonotonicToReal(now);
@@ -141,8 +224,6 @@ int LogAudit::logPrint(const char *fmt, ...) {
         now = log_time(CLOCK_REALTIME);
     }
 
-    static const char pid_str[] = " pid=";
-    char *pidptr = strstr(str, pid_str);
     if (pidptr && isdigit(pidptr[sizeof(pid_str) - 1])) {
         cp = pidptr + sizeof(pid_str) - 1;
         pid = 0;
@@ -154,29 +235,44 @@ int LogAudit::logPrint(const char *fmt, ...) {
         logbuf->lock();
         uid = logbuf->pidToUid(pid);
         logbuf->unlock();
-        memmove(pidptr, cp, strlen(cp) + 1);
+        cut[cuts].begin = pidptr;
+        cut[cuts].end = cp;
+        ++cuts;
     }
 
+    // Last cut first, so that the earlier one stays where it is
+    if ((cuts == 2) && (cut[0].begin < cut[1].begin)) {
+        std::swap(cut[0], cut[1]);
+    }
+    for (size_t i = 0; i < cuts; ++i) {
+        size_t n = cut[i].end - cut[i].begin;
+        memmove(cut[i].begin, cut[i].end, end - cut[i].end + 1);
+        end -= n;
+        if (commptr && (commptr >= cut[i].end)) {
+            commptr -= n;
+        }
+    }
+    len = end - str;
+
     // log to events
 
-    size_t l = strnlen(str, LOGGER_ENTRY_MAX_PAYLOAD);
-    size_t n = l + sizeof(android_log_event_string_t);
+    size_t l = (len < LOGGER_ENTRY_MAX_PAYLOAD) ? len : LOGGER_ENTRY_MAX_PAYLOAD;
 
     bool notify = false;
+    int rc;
 
     {   // begin scope for event buffer
-        uint32_t buffer[(n + sizeof(uint32_t) - 1) / sizeof(uint32_t)];
-
-        android_log_event_string_t *event
-            = reinterpret_cast<android_log_event_string_t *>(buffer);
-        event->header.tag = htole32(AUDITD_LOG_TAG);
-        event->type = EVENT_TYPE_STRING;
-        event->length = htole32(l);
-        memcpy(event->data, str, l);
-
+        android_log_event_string_t event;
+        event.header.tag = htole32(AUDITD_LOG_TAG);
+        event.type = EVENT_TYPE_STRING;
+        event.length = htole32(l);
+
+        struct iovec vec[] = {
+            { &event, sizeof(event) },
+            { str, l },
+        };
         rc = logbuf->log(LOG_ID_EVENTS, now, uid, pid, tid,
-                         reinterpret_cast<char *>(event),
-                         (n <= USHRT_MAX) ? (unsigned short) n : USHRT_MAX);
+                         vec, sizeof(vec) / sizeof(vec[0]));
         if (rc >= 0) {
             notify = true;
         }
@@ -185,13 +281,12 @@ int LogAudit::logPrint(const char *fmt, ...) {
 
     // log to main
 
-    static const char comm_str[] = " comm=\"";
-    const char *comm = strstr(str, comm_str);
-    const char *estr = str + strlen(str);
+    const char *comm;
+    const char *estr = end;
     const char *commfree = NULL;
-    if (comm) {
-        estr = comm;
-        comm += sizeof(comm_str) - 1;
+    if (commptr) {
+        estr = commptr;
+        comm = commptr + sizeof(comm_str) - 1;
     } else if (pid == getpid()) {
         pid = tid;
         comm = "auditd";
@@ -217,18 +312,21 @@ int LogAudit::logPrint(const char *fmt, ...) {
         b = LOGGER_ENTRY_MAX_PAYLOAD;
     }
     size_t e = strnlen(ecomm, LOGGER_ENTRY_MAX_PAYLOAD - b);
-    n = b + e + l + 2;
+    size_t n = b + e + l + 2;
 
     {   // begin scope for main buffer
-        char newstr[n];
-
-        *newstr = info ? ANDROID_LOG_INFO : ANDROID_LOG_WARN;
-        strlcpy(newstr + 1, comm, l);
-        strncpy(newstr + 1 + l, str, b);
-        strncpy(newstr + 1 + l + b, ecomm, e);
-
-        rc = logbuf->log(LOG_ID_MAIN, now, uid, pid, tid, newstr,
-                         (n <= USHRT_MAX) ? (unsigned short) n : USHRT_MAX);
+        char prio = info ? ANDROID_LOG_INFO : ANDROID_LOG_WARN;
+        static const char nul = '\0';
+        struct iovec vec[] = {
+            { &prio, 1 },
+            { const_cast<char *>(comm), l - 1 },
+            { const_cast<char *>(&nul), 1 },
+            { str, b },
+            { const_cast<char *>(ecomm), e },
+            { const_cast<char *>(&nul), 1 },
+        };
+        rc = logbuf->log(LOG_ID_MAIN, now, uid, pid, tid,
+                         vec, sizeof(vec) / sizeof(vec[0]));
 
         if (rc >= 0) {
             notify = true;
@@ -237,7 +335,6 @@ int LogAudit::logPrint(const char *fmt, ...) {
     }
 
     free(const_cast<char *>(commfree));
-    free(str);
 
     if (notify) {
         reader->notifyNewLog();
@@ -255,17 +352,20 @@ int LogAudit::log(char *buf, size_t len) {
         return 0;
     }
 
-    *audit = '\0';
-
-    int rc;
-    char *type = strstr(buf, "type=");
-    if (type && (type < &buf[len])) {
-        rc = logPrint("%s %s", type, audit + 1);
-    } else {
-        rc = logPrint("%s", audit + 1);
+    // "type=<type> audit(...", or from "audit(" if there is no type
+    const char *start = audit + 1;
+    const char *type = static_cast<const char *>(
+        memmem(buf, audit - buf, "type=", sizeof("type=") - 1));
+    if (type) {
+        start = type;
     }
-    *audit = ' ';
-    return rc;
+
+    char str[maxRecordLen];
+    size_t n = &buf[len] - start;
+    char *cp = squeeze(str, str, start,
+                       (n < (sizeof(str) - 1)) ? n : (sizeof(str) - 1));
+    *cp = '\0';
+    return logRecord(str, cp - str);
 }
 
 int LogAudit::getLogSocket() {
@@ -19,6 +19,7 @@
 
 #include <sysutils/SocketListener.h>
 
+#include "libaudit.h"
 #include "LogBuffer.h"
 
 class LogReader;
@@ -29,8 +30,13 @@ class LogAudit : public SocketListener {
     int fdDmesg;
     bool initialized;
 
+    // "type=<type> " and the longest netlink payload
+    static const size_t maxRecordLen = 16 + MAX_AUDIT_MESSAGE_LENGTH;
+
 public:
-    LogAudit(LogBuffer *buf, LogReader *reader, int fdDmesg);
+    // fdAudit is the NETLINK_AUDIT socket, or -1 to only log() records
+    LogAudit(LogBuffer *buf, LogReader *reader, int fdDmesg,
+             int fdAudit = getLogSocket());
     int log(char *buf, size_t len);
     bool isMonotonic() { return logbuf->isMonotonic(); }
 
@@ -39,8 +45,10 @@ protected:
 
 private:
     static int getLogSocket();
-    int logPrint(const char *fmt, ...)
-        __attribute__ ((__format__ (__printf__, 2, 3)));
+    static char *squeeze(char *str, char *cp, const char *src, size_t len);
+    // Log the nul terminated record of len bytes in str, which is
+    // edited in place.
+    int logRecord(char *str, size_t len);
 };
 
 #endif
@@ -15,6 +15,7 @@
  */
 
 #include <ctype.h>
+#include <endian.h>
 #include <errno.h>
 #include <stdio.h>
 #include <string.h>
@@ -22,10 +23,14 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <memory>
 #include <unordered_map>
+#include <vector>
 
 #include <cutils/properties.h>
 #include <log/logger.h>
+#include <private/android_logger.h>
 
 #include "LogBuffer.h"
 #include "LogKlog.h"
@@ -108,9 +113,14 @@ void LogBuffer::init() {
         }
     }
 
+    bool compress = property_get_bool("logd.compress",
+                                      BOOL_DEFAULT_FALSE |
+                                      BOOL_DEFAULT_FLAG_PERSIST);
+
     log_id_for_each(i) {
         mLastSet[i] = false;
         mLast[i] = mLogElements.begin();
+        mArena[i].setCompress(compress);
 
         char key[PROP_NAME_MAX];
 
@@ -136,6 +146,13 @@ void LogBuffer::init() {
             setSize(i, LOG_BUFFER_MIN_SIZE);
         }
     }
+
+    unsigned long ring_size = property_get_size("persist.logd.ring");
+    if (!ring_size) {
+        ring_size = property_get_size("ro.logd.ring");
+    }
+    initRing(ring_size);
+
     bool lastMonotonic = monotonic;
     monotonic = android_log_clockid() == CLOCK_MONOTONIC;
     if (lastMonotonic != monotonic) {
@@ -154,7 +171,7 @@ void LogBuffer::init() {
         // as the act of mounting /data would trigger persist.logd.timestamp to
         // be corrected. 1/30 corner case YMMV.
         //
-        pthread_mutex_lock(&mLogElementsLock);
+        pthread_rwlock_wrlock(&mLogElementsLock);
         LogBufferElementCollection::iterator it = mLogElements.begin();
         while((it != mLogElements.end())) {
             LogBufferElement *e = *it;
@@ -169,7 +186,7 @@ void LogBuffer::init() {
             }
             ++it;
         }
-        pthread_mutex_unlock(&mLogElementsLock);
+        pthread_rwlock_unlock(&mLogElementsLock);
     }
 
     // We may have been triggered by a SIGHUP. Release any sleeping reader
@@ -191,10 +208,68 @@ void LogBuffer::init() {
     LogTimeEntry::unlock();
 }
 
+// Entries go back as they were accepted, the rate limit and the loggable
+// check had their say the first time. The kernel log is not mirrored,
+// LogKlog reads what the kernel still holds anew on start, replayed it
+// would be there twice.
+int LogBuffer::replayRing(void *arg, log_id_t log_id, log_time realtime,
+                          uid_t uid, pid_t pid, pid_t tid,
+                          const char *msg, unsigned short len) {
+    if (log_id == LOG_ID_KERNEL) {
+        return -EINVAL;
+    }
+    struct iovec vec = { const_cast<char *>(msg), len };
+    return static_cast<LogBuffer *>(arg)->insert(log_id, realtime,
+                                                 uid, pid, tid, &vec, 1, len);
+}
+
+// Open the ring file on the first init() that finds /data mounted, and
+// repopulate the buffers from what it held. Entries that arrive while the
+// ring is being replayed are not mirrored. A size of zero stops mirroring.
+void LogBuffer::initRing(unsigned long size) {
+    static const char ringPath[] = "/data/misc/logd_ring/ring";
+
+    if (!size) {
+        pthread_rwlock_wrlock(&mLogElementsLock);
+        mRing.close();
+        pthread_rwlock_unlock(&mLogElementsLock);
+        return;
+    }
+
+    // only ever opened or closed from init(), no lock needed to look
+    if (mRing.isOpen()) {
+        return;
+    }
+
+    pthread_rwlock_wrlock(&mLogElementsLock);
+    int rc = mRing.open(ringPath, size);
+    pthread_rwlock_unlock(&mLogElementsLock);
+    if (rc < 0) {
+        return;
+    }
+
+    mRing.recover(replayRing, this);
+
+    pthread_rwlock_wrlock(&mLogElementsLock);
+    mRing.start();
+    pthread_rwlock_unlock(&mLogElementsLock);
+}
+
 LogBuffer::LogBuffer(LastLogTimes *times):
+        mIndexCountdown(0),
         monotonic(android_log_clockid() == CLOCK_MONOTONIC),
         mTimes(*times) {
-    pthread_mutex_init(&mLogElementsLock, NULL);
+    // Writers must not queue behind a stream of overlapping readers.
+    // bionic has pthread_rwlockattr_setkind_np from API 23 (M), before
+    // that the lock keeps its default reader preference.
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+#if !defined(__BIONIC__) || (defined(__ANDROID_API__) && (__ANDROID_API__ >= 23))
+    pthread_rwlockattr_setkind_np(&attr,
+        PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+    pthread_rwlock_init(&mLogElementsLock, &attr);
+    pthread_rwlockattr_destroy(&attr);
 
     init();
 }
@@ -202,33 +277,179 @@ LogBuffer::LogBuffer(LastLogTimes *times):
 int LogBuffer::log(log_id_t log_id, log_time realtime,
                    uid_t uid, pid_t pid, pid_t tid,
                    const char *msg, unsigned short len) {
-    if ((log_id >= LOG_ID_MAX) || (log_id < 0)) {
+    struct iovec vec = { const_cast<char *>(msg), len };
+    return log(log_id, realtime, uid, pid, tid, &vec, 1);
+}
+
+// Copy the leading bytes of vec into head, through the nul that ends the
+// tag and no fewer than an event tag, for the __android_log_is_loggable
+// check. Tags are short, this is but a few bytes.
+static const char *gatherHead(char *head, size_t size,
+                              const struct iovec *vec, size_t count) {
+    size_t n = 0;
+    for (size_t i = 0; (i < count) && (n < (size - 1)); ++i) {
+        size_t len = std::min(vec[i].iov_len, size - 1 - n);
+        memcpy(head + n, vec[i].iov_base, len);
+        size_t from = n ? n : 1; // past the priority
+        n += len;
+        if ((n >= sizeof(uint32_t)) && (n > from)
+                && memchr(head + from, '\0', n - from)) {
+            break;
+        }
+    }
+    head[n] = '\0';
+    return head;
+}
+
+// FNV-1a of the nul terminated tag, the rate limit key of a text log
+static uint32_t hashTag(const char *tag, size_t len) {
+    uint32_t hash = 2166136261U;
+    for (const char *end = tag + len; (tag < end) && *tag; ++tag) {
+        hash = (hash ^ (unsigned char)*tag) * 16777619U;
+    }
+    return hash;
+}
+
+// A chatty record in place of the lines the rate limit suppressed for
+// uid and tag, key where the tag has no name. It goes straight in, the
+// rate limit must not suppress its own summaries.
+void LogBuffer::logSuppressed(log_id_t log_id, log_time realtime,
+                              uid_t uid, pid_t pid, pid_t tid,
+                              const char *tag, uint32_t key,
+                              uint32_t count) {
+    static const char chatty[] = "chatty";
+    char text[LOGGER_ENTRY_MAX_PAYLOAD / 2];
+    int n;
+    if (tag) {
+        n = snprintf(text, sizeof(text), "uid=%u %s: %u line%s suppressed",
+                     uid, tag, count, (count > 1) ? "s" : "");
+    } else {
+        n = snprintf(text, sizeof(text), "uid=%u %u: %u line%s suppressed",
+                     uid, key, count, (count > 1) ? "s" : "");
+    }
+    if (n <= 0) {
+        return;
+    }
+    size_t len = std::min((size_t)n, sizeof(text) - 1);
+
+    if (log_id == LOG_ID_EVENTS) {
+        android_log_event_string_t event;
+        event.header.tag = htole32(LOGD_LOG_TAG);
+        event.type = EVENT_TYPE_STRING;
+        event.length = htole32(len);
+        struct iovec vec[] = {
+            { &event, sizeof(event) },
+            { text, len },
+        };
+        insert(log_id, realtime, uid, pid, tid, vec,
+               sizeof(vec) / sizeof(vec[0]), sizeof(event) + len);
+        return;
+    }
+
+    char prio = ANDROID_LOG_INFO;
+    struct iovec vec[] = {
+        { &prio, 1 },
+        { const_cast<char *>(chatty), sizeof(chatty) },
+        { text, len + 1 },
+    };
+    insert(log_id, realtime, uid, pid, tid, vec, sizeof(vec) / sizeof(vec[0]),
+           1 + sizeof(chatty) + len + 1);
+}
+
+// Chatty records for what the rate limit suppressed in buckets it had to
+// forget before a line of theirs got through to carry the count.
+void LogBuffer::logEvicted(log_time realtime) {
+    std::vector<LogRateLimit::Evicted> evicted;
+    mRateLimit.takeEvicted(evicted);
+    for (size_t i = 0; i < evicted.size(); ++i) {
+        const LogRateLimit::Evicted &e = evicted[i];
+        logSuppressed(e.logId, realtime, e.uid, 0, 0,
+                      e.name[0] ? e.name : NULL, e.tag, e.suppressed);
+    }
+}
+
+int LogBuffer::log(log_id_t log_id, log_time realtime,
+                   uid_t uid, pid_t pid, pid_t tid,
+                   const struct iovec *vec, size_t count) {
+    if ((log_id >= LOG_ID_MAX) || (log_id < 0) || !count) {
         return -EINVAL;
     }
 
-    LogBufferElement *elem = new LogBufferElement(log_id, realtime,
-                                                  uid, pid, tid, msg, len);
+    size_t total = 0;
+    for (size_t i = 0; i < count; ++i) {
+        total += vec[i].iov_len;
+    }
+    unsigned short len = (total <= USHRT_MAX) ? total : USHRT_MAX;
+
     if (log_id != LOG_ID_SECURITY) {
+        const char *msg = static_cast<const char *>(vec[0].iov_base);
+        char head[LOGGER_ENTRY_MAX_PAYLOAD];
+        if (count > 1) {
+            msg = gatherHead(head, sizeof(head), vec, count);
+        }
         int prio = ANDROID_LOG_INFO;
         const char *tag = NULL;
+        uint32_t key = 0;
         if (log_id == LOG_ID_EVENTS) {
-            tag = android::tagToName(elem->getTag());
+            key = LogBufferElement::getTag(log_id, msg, len);
+            tag = android::tagToName(key);
         } else {
             prio = *msg;
             tag = msg + 1;
         }
+        if (mRateLimit.haveEvicted()) {
+            logEvicted(realtime);
+        }
         if (!__android_log_is_loggable(prio, tag, ANDROID_LOG_VERBOSE)) {
             // Log traffic received to total
-            pthread_mutex_lock(&mLogElementsLock);
-            stats.add(elem);
-            stats.subtract(elem);
-            pthread_mutex_unlock(&mLogElementsLock);
-            delete elem;
+            pthread_rwlock_wrlock(&mLogElementsLock);
+            LogBufferElement *elem = LogBufferElement::create(
+                mArena[log_id], log_id, realtime, uid, pid, tid,
+                vec, count, len);
+            if (elem) {
+                stats.add(elem);
+                stats.subtract(elem);
+                // most recent record, storage is immediately reused
+                LogBufferElement::destroy(mArena[log_id], elem);
+                stats.compressed(log_id, mArena[log_id].compressedIn(),
+                                 mArena[log_id].compressedOut());
+            }
+            pthread_rwlock_unlock(&mLogElementsLock);
             return -EACCES;
         }
+        // spam is turned away before it costs an element or statistics,
+        // lines filtered out above spend none of the budget
+        uint32_t suppressed = 0;
+        if (mRateLimit.enabled() && (uid != AID_ROOT) && (uid != AID_LOGD)) {
+            if (log_id != LOG_ID_EVENTS) {
+                key = hashTag(tag, len ? (len - 1) : 0);
+            }
+            if (!mRateLimit.check(log_id, uid, key, tag, suppressed)) {
+                return -EAGAIN;
+            }
+        }
+        if (suppressed) {
+            logSuppressed(log_id, realtime, uid, pid, tid, tag, key,
+                          suppressed);
+        }
     }
 
-    pthread_mutex_lock(&mLogElementsLock);
+    return insert(log_id, realtime, uid, pid, tid, vec, count, len);
+}
+
+int LogBuffer::insert(log_id_t log_id, log_time realtime,
+                      uid_t uid, pid_t pid, pid_t tid,
+                      const struct iovec *vec, size_t count,
+                      unsigned short len) {
+    pthread_rwlock_wrlock(&mLogElementsLock);
+
+    LogBufferElement *elem = LogBufferElement::create(mArena[log_id], log_id,
+                                                      realtime, uid, pid, tid,
+                                                      vec, count, len);
+    if (!elem) {
+        pthread_rwlock_unlock(&mLogElementsLock);
+        return -ENOMEM;
+    }
 
     // Insert elements in time sorted order if possible
     //  NB: if end is region locked, place element at end of list
@@ -244,6 +465,13 @@ int LogBuffer::log(log_id_t log_id, log_time realtime,
 
     if (last == mLogElements.end()) {
         mLogElements.push_back(elem);
+        if (mIndexCountdown) {
+            --mIndexCountdown;
+        } else if (mIndex.empty()
+                || (mIndex.back()->getRealTime() <= realtime)) {
+            mIndex.push_back(elem);
+            mIndexCountdown = indexInterval - 1;
+        }
     } else {
         uint64_t end = 1;
         bool end_set = false;
@@ -254,11 +482,14 @@ int LogBuffer::log(log_id_t log_id, log_time realtime,
         LastLogTimes::iterator times = mTimes.begin();
         while(times != mTimes.end()) {
             LogTimeEntry *entry = (*times);
+            // A blocking reader resumes past the last sequence it was sent,
+            // also when it is waiting for more rather than reading now. An
+            // element placed ahead of that point would never reach it.
+            if (!entry->mNonBlock) {
+                end_always = true;
+                break;
+            }
             if (entry->owned_Locked()) {
-                if (!entry->mNonBlock) {
-                    end_always = true;
-                    break;
-                }
                 if (!end_set || (end <= entry->mEnd)) {
                     end = entry->mEnd;
                     end_set = true;
@@ -277,19 +508,49 @@ int LogBuffer::log(log_id_t log_id, log_time realtime,
         LogTimeEntry::unlock();
     }
 
+    mUidChains[log_id][uid].push_back(elem);
+    if (log_id != LOG_ID_KERNEL) { // see replayRing
+        mRing.append(log_id, realtime, uid, pid, tid, vec, count, len);
+    }
     stats.add(elem);
+    stats.compressed(log_id, mArena[log_id].compressedIn(),
+                     mArena[log_id].compressedOut());
     maybePrune(log_id);
-    pthread_mutex_unlock(&mLogElementsLock);
+    pthread_rwlock_unlock(&mLogElementsLock);
 
     return len;
 }
 
+// Uncompressed payload bytes "id" may hold, that is log_buffer_size(id)
+// stretched by the compression its arena is achieving.
+//
+// mLogElementsLock must be held when this function is called.
+unsigned long LogBuffer::maxSizes(log_id_t id) {
+    unsigned long maxSize = log_buffer_size(id);
+    const LogBufferArena &arena = mArena[id];
+    size_t in = arena.compressedIn();
+    size_t payloads = arena.payloads();
+    if (!in || !payloads) {
+        return maxSize;
+    }
+    size_t out = arena.compressedOut();
+    // compressed chunks may still account for released payloads
+    uint64_t stored = (payloads > in) ? (payloads - in + out)
+                                      : ((uint64_t)out * payloads / in);
+    // element headers are not compressed, do not let them run away
+    static const unsigned long maxRatio = 4;
+    if (stored < (payloads / maxRatio)) {
+        return maxSize * maxRatio;
+    }
+    return (uint64_t)maxSize * payloads / stored;
+}
+
 // Prune at most 10% of the log entries or maxPrune, whichever is less.
 //
 // mLogElementsLock must be held when this function is called.
 void LogBuffer::maybePrune(log_id_t id) {
     size_t sizes = stats.sizes(id);
-    unsigned long maxSize = log_buffer_size(id);
+    unsigned long maxSize = maxSizes(id);
     if (sizes > maxSize) {
         size_t sizeOver = sizes - ((maxSize * 9) / 10);
         size_t elements = stats.realElements(id);
@@ -340,6 +601,24 @@ LogBufferElementCollection::iterator LogBuffer::erase(
     log_id_for_each(i) {
         doSetLast |= setLast[i] = mLastSet[i] && (it == mLast[i]);
     }
+    if (!mIndex.empty()) {
+        // Elements are mostly expired oldest first
+        if (mIndex.front() == element) {
+            mIndex.pop_front();
+        } else {
+            uint64_t sequence = element->getSequence();
+            std::deque<LogBufferElement *>::iterator found = std::lower_bound(
+                mIndex.begin(), mIndex.end(), sequence,
+                [](const LogBufferElement *e, uint64_t s) {
+                    return e->getSequence() < s;
+                });
+            if ((found != mIndex.end()) && (*found == element)) {
+                mIndex.erase(found);
+            }
+        }
+    }
+
+    LogBufferElementChain::erase(element);
     it = mLogElements.erase(it);
     if (doSetLast) {
         log_id_for_each(i) {
@@ -357,7 +636,8 @@ LogBufferElementCollection::iterator LogBuffer::erase(
     } else {
         stats.subtract(element);
     }
-    delete element;
+    LogBufferElement::destroy(mArena[id], element);
+    stats.compressed(id, mArena[id].compressedIn(), mArena[id].compressedOut());
 
     return it;
 }
@@ -440,6 +720,201 @@ public:
 
 };
 
+// Watermark the chatty entry of the worst UID, or worst PID of system UID,
+// that the next pruning pass is to resume from.
+void LogBuffer::setLastWorst(log_id_t id,
+                             LogBufferElementCollection::iterator it,
+                             pid_t worstPid) {
+    LogBufferElement *element = *it;
+    mLastWorstUid[id][element->getUid()] = it;
+    if (worstPid && (element->getPid() == worstPid)) {
+        mLastWorstPidOfSystem[id][worstPid] = it;
+    }
+}
+
+// Chatty pruning of the worst UID, or of the worst PID of the system UID,
+// following the UID's LogBufferElementChain from its oldest element rather
+// than walking the log and stepping over everyone else. Returns true if
+// anything was pruned.
+//
+// mLogElementsLock and LogTimeEntry::lock() must be held when this
+// function is called.
+bool LogBuffer::pruneWorstUid(log_id_t id, uid_t worst, pid_t worstPid,
+                              size_t worst_sizes, size_t second_worst_sizes,
+                              unsigned long &pruneRows, LogTimeEntry *oldest,
+                              bool &busy) {
+    LogBufferUidChainMap::iterator chain = mUidChains[id].find(worst);
+    if ((chain == mUidChains[id].end()) || !chain->second.front()) {
+        return false;
+    }
+
+    // The worst offender's leading entries are expired outright rather
+    // than left behind as chatty, and any leading drops are cleared. Look
+    // no further than the first entry that has to stay, or as many of
+    // the worst offender's entries as we could possibly prune.
+    unsigned long visits = pruneRows;
+    LogBufferElementCollection::iterator it;
+    it = mLastSet[id] ? mLast[id] : mLogElements.begin();
+    while (it != mLogElements.end()) {
+        LogBufferElement *element = *it;
+
+        if (oldest && (oldest->mStart <= element->getSequence())) {
+            break;
+        }
+
+        if (element->getLogId() != id) {
+            ++it;
+            continue;
+        }
+
+        if (!mLastSet[id] || ((*mLast[id])->getLogId() != id)) {
+            mLast[id] = it;
+            mLastSet[id] = true;
+        }
+
+        if (element->getDropped()) {
+            it = erase(it);
+            continue;
+        }
+
+        if ((element->getUid() != worst)
+                || (worstPid && (element->getPid() != worstPid))
+                || !visits--) {
+            break;
+        }
+        ++it;
+    }
+    uint64_t leading = (it == mLogElements.end()) ?
+                           UINT64_MAX : (*it)->getSequence();
+
+    static const timespec too_old = {
+        EXPIRE_HOUR_THRESHOLD * 60 * 60, 0
+    };
+    LogBufferElementCollection::iterator lastt;
+    lastt = mLogElements.end();
+    --lastt;
+    LogBufferElementLast last;
+    bool kick = false;
+
+    // Resume from the most recent chatty entry of a previous pass, further
+    // drops accumulate there rather than in one that will soon expire.
+    LogBufferElement *element = chain->second.front();
+    {   // begin scope for uid worst found iterator
+        LogBufferIteratorMap::iterator found = mLastWorstUid[id].find(worst);
+        if ((found != mLastWorstUid[id].end())
+                && (found->second != mLogElements.end())) {
+            element = *found->second;
+        }
+    }
+    if (worstPid) {
+        // begin scope for pid worst found iterator
+        LogBufferPidIteratorMap::iterator found
+            = mLastWorstPidOfSystem[id].find(worstPid);
+        if ((found != mLastWorstPidOfSystem[id].end())
+                && (found->second != mLogElements.end())
+                && ((*found->second)->getUid() == worst)) {
+            element = *found->second;
+        }
+    }
+
+    LogBufferElement *next;
+    for (; element; element = next) {
+        next = chain->second.next(element);
+
+        if (oldest && (oldest->mStart <= element->getSequence())) {
+            busy = true;
+            if (oldest->mTimeout.tv_sec || oldest->mTimeout.tv_nsec) {
+                oldest->triggerReader_Locked();
+            }
+            break;
+        }
+
+        LogBufferElementCollection::iterator it(element);
+        unsigned short dropped = element->getDropped();
+        if (dropped) {
+            if (last.coalesce(element, dropped)) {
+                erase(it, true);
+            } else {
+                last.add(element);
+                setLastWorst(id, it, worstPid);
+            }
+            continue;
+        }
+
+        if (worstPid && (element->getPid() != worstPid)) {
+            continue;
+        }
+
+        if ((element->getRealTime() < ((*lastt)->getRealTime() - too_old))
+                || (element->getRealTime() > (*lastt)->getRealTime())) {
+            break;
+        }
+
+        pruneRows--;
+        if (pruneRows == 0) {
+            break;
+        }
+
+        kick = true;
+
+        unsigned short len = element->getMsgLen();
+        last.clear(element);
+
+        if (element->getSequence() < leading) {
+            erase(it);
+        } else {
+            stats.drop(element);
+            element->setDropped(1);
+            if (last.coalesce(element, 1)) {
+                erase(it, true);
+            } else {
+                last.add(element);
+                setLastWorst(id, it, worstPid);
+            }
+        }
+        if (worst_sizes < second_worst_sizes) {
+            break;
+        }
+        worst_sizes -= len;
+    }
+
+    return kick;
+}
+
+// Readers hold back pruning, until the buffer is over its size by a
+// quarter. Past that their lag is no longer worth the memory, entries are
+// pruned from under them and they are told how many they missed.
+//
+// mLogElementsLock must be held when this function is called.
+bool LogBuffer::readersLagging(log_id_t id) {
+    unsigned long maxSize = maxSizes(id);
+    return stats.sizes(id) > (maxSize + maxSize / 4);
+}
+
+// element is about to be pruned, account for it with every reader that
+// has yet to get to it. Returns false if it has to stay, a reader is
+// between batches in flushTo and resumes from it.
+//
+// mLogElementsLock and LogTimeEntry::lock() must be held when this
+// function is called.
+bool LogBuffer::skipReaders(LogBufferElement *element) {
+    uint64_t sequence = element->getSequence();
+    LastLogTimes::iterator times;
+    for (times = mTimes.begin(); times != mTimes.end(); ++times) {
+        LogTimeEntry *entry = (*times);
+        if (entry->owned_Locked() && (entry->mStart == sequence)) {
+            return false;
+        }
+    }
+    for (times = mTimes.begin(); times != mTimes.end(); ++times) {
+        LogTimeEntry *entry = (*times);
+        if (entry->owned_Locked() && (entry->mStart < sequence)) {
+            entry->skip_Locked(element);
+        }
+    }
+    return true;
+}
+
 // prune "pruneRows" of type "id" from the buffer.
 //
 // This garbage collection task is used to expire log entries. It is called to
@@ -479,8 +954,8 @@ public:
 // preservation. Thus whitelist is a Hail Mary low priority, blacklists and
 // spam filtration all take priority. This second loop also checks if a region
 // lock is causing us to buffer too much in the logs to help the reader(s),
-// and will tell the slowest reader thread to skip log entries, and if
-// persistent and hits a further threshold, kill the reader thread.
+// past the readersLagging() threshold it prunes from under them and each is
+// told how many entries it missed.
 //
 // The third thread is optional, and only gets hit if there was a whitelist
 // and more needs to be pruned against the backstop of the region lock.
@@ -526,14 +1001,10 @@ bool LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
                 mLastSet[id] = true;
             }
 
-            if (oldest && (oldest->mStart <= element->getSequence())) {
-                busy = true;
-                if (oldest->mTimeout.tv_sec || oldest->mTimeout.tv_nsec) {
-                    oldest->triggerReader_Locked();
-                } else {
-                    oldest->triggerSkip_Locked(id, pruneRows);
-                }
-                break;
+            if (oldest && (oldest->mStart <= element->getSequence())
+                    && !skipReaders(element)) {
+                ++it;
+                continue;
             }
 
             it = erase(it);
@@ -560,7 +1031,7 @@ bool LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
                 if (sorted.get() && sorted[0] && sorted[1]) {
                     worst_sizes = sorted[0]->getSizes();
                     // Calculate threshold as 12.5% of available storage
-                    size_t threshold = log_buffer_size(id) / 8;
+                    size_t threshold = maxSizes(id) / 8;
                     if ((worst_sizes > threshold)
                         // Allow time horizon to extend roughly tenfold, assume
                         // average entry length is 100 characters.
@@ -592,6 +1063,16 @@ bool LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
             break;
         }
 
+        // Without a blacklist to apply, only the worst UID need be visited
+        if (!hasBlacklist) {
+            if (!pruneWorstUid(id, worst, worstPid, worst_sizes,
+                               second_worst_sizes, pruneRows, oldest, busy)
+                    || !mPrune.worstUidEnabled()) {
+                break;
+            }
+            continue;
+        }
+
         bool kick = false;
         bool leading = true;
         it = mLastSet[id] ? mLast[id] : mLogElements.begin();
@@ -779,19 +1260,12 @@ bool LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
             mLastSet[id] = true;
         }
 
-        if (oldest && (oldest->mStart <= element->getSequence())) {
+        bool lagging = oldest && (oldest->mStart <= element->getSequence());
+        if (lagging && !clearAll && !readersLagging(id)) {
             busy = true;
-            if (whitelist) {
-                break;
-            }
-
-            if (stats.sizes(id) > (2 * log_buffer_size(id))) {
-                // kick a misbehaving log reader client off the island
-                oldest->release_Locked();
-            } else if (oldest->mTimeout.tv_sec || oldest->mTimeout.tv_nsec) {
+            if (!whitelist
+                    && (oldest->mTimeout.tv_sec || oldest->mTimeout.tv_nsec)) {
                 oldest->triggerReader_Locked();
-            } else {
-                oldest->triggerSkip_Locked(id, pruneRows);
             }
             break;
         }
@@ -803,6 +1277,10 @@ bool LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
             continue;
         }
 
+        if (lagging && !skipReaders(element)) {
+            ++it;
+            continue;
+        }
         it = erase(it);
         pruneRows--;
     }
@@ -824,16 +1302,17 @@ bool LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
             }
 
             if (oldest && (oldest->mStart <= element->getSequence())) {
-                busy = true;
-                if (stats.sizes(id) > (2 * log_buffer_size(id))) {
-                    // kick a misbehaving log reader client off the island
-                    oldest->release_Locked();
-                } else if (oldest->mTimeout.tv_sec || oldest->mTimeout.tv_nsec) {
-                    oldest->triggerReader_Locked();
-                } else {
-                    oldest->triggerSkip_Locked(id, pruneRows);
+                if (!readersLagging(id)) {
+                    busy = true;
+                    if (oldest->mTimeout.tv_sec || oldest->mTimeout.tv_nsec) {
+                        oldest->triggerReader_Locked();
+                    }
+                    break;
+                }
+                if (!skipReaders(element)) {
+                    ++it;
+                    continue;
                 }
-                break;
             }
 
             it = erase(it);
@@ -846,53 +1325,25 @@ bool LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
     return (pruneRows > 0) && busy;
 }
 
-// clear all rows of type "id" from the buffer.
+// clear all rows of type "id" from the buffer, readers are told how much
+// they did not get to.
 bool LogBuffer::clear(log_id_t id, uid_t uid) {
-    bool busy = true;
-    // If it takes more than 4 tries (seconds) to clear, then kill reader(s)
-    for (int retry = 4;;) {
-        if (retry == 1) { // last pass
-            // Check if it is still busy after the sleep, we say prune
-            // one entry, not another clear run, so we are looking for
-            // the quick side effect of the return value to tell us if
-            // we have a _blocked_ reader.
-            pthread_mutex_lock(&mLogElementsLock);
-            busy = prune(id, 1, uid);
-            pthread_mutex_unlock(&mLogElementsLock);
-            // It is still busy, blocked reader(s), lets kill them all!
-            // otherwise, lets be a good citizen and preserve the slow
-            // readers and let the clear run (below) deal with determining
-            // if we are still blocked and return an error code to caller.
-            if (busy) {
-                LogTimeEntry::lock();
-                LastLogTimes::iterator times = mTimes.begin();
-                while (times != mTimes.end()) {
-                    LogTimeEntry *entry = (*times);
-                    // Killer punch
-                    if (entry->owned_Locked() && entry->isWatching(id)) {
-                        entry->release_Locked();
-                    }
-                    times++;
-                }
-                LogTimeEntry::unlock();
-            }
-        }
-        pthread_mutex_lock(&mLogElementsLock);
-        busy = prune(id, ULONG_MAX, uid);
-        pthread_mutex_unlock(&mLogElementsLock);
-        if (!busy || !--retry) {
-            break;
-        }
-        sleep (1); // Let reader(s) catch up after notification
+    pthread_rwlock_wrlock(&mLogElementsLock);
+    if (uid == AID_ROOT) {
+        mRing.clear(id);
     }
+    bool busy = prune(id, ULONG_MAX, uid);
+    pthread_rwlock_unlock(&mLogElementsLock);
     return busy;
 }
 
 // get the used space associated with "id".
 unsigned long LogBuffer::getSizeUsed(log_id_t id) {
-    pthread_mutex_lock(&mLogElementsLock);
-    size_t retval = stats.sizes(id);
-    pthread_mutex_unlock(&mLogElementsLock);
+    pthread_rwlock_rdlock(&mLogElementsLock);
+    // as held, compressed or not
+    size_t retval = (uint64_t)stats.sizes(id) * log_buffer_size(id)
+                  / maxSizes(id);
+    pthread_rwlock_unlock(&mLogElementsLock);
     return retval;
 }
 
@@ -902,20 +1353,105 @@ int LogBuffer::setSize(log_id_t id, unsigned long size) {
     if (!valid_size(size)) {
         return -1;
     }
-    pthread_mutex_lock(&mLogElementsLock);
+    pthread_rwlock_wrlock(&mLogElementsLock);
     log_buffer_size(id) = size;
-    pthread_mutex_unlock(&mLogElementsLock);
+    pthread_rwlock_unlock(&mLogElementsLock);
     return 0;
 }
 
 // get the total space allocated to "id"
 unsigned long LogBuffer::getSize(log_id_t id) {
-    pthread_mutex_lock(&mLogElementsLock);
+    pthread_rwlock_rdlock(&mLogElementsLock);
     size_t retval = log_buffer_size(id);
-    pthread_mutex_unlock(&mLogElementsLock);
+    pthread_rwlock_unlock(&mLogElementsLock);
     return retval;
 }
 
+// First element that may have a sequence greater than start, found from
+// the nearest index entry.
+//
+// mLogElementsLock must be held when this function is called.
+LogBufferElementCollection::iterator LogBuffer::seek(uint64_t start) {
+    if (start <= 1) {
+        // client wants to start from the beginning
+        return mLogElements.begin();
+    }
+
+    LogBufferElementCollection::iterator it = mLogElements.begin();
+    std::deque<LogBufferElement *>::iterator found = std::upper_bound(
+        mIndex.begin(), mIndex.end(), start,
+        [](uint64_t s, const LogBufferElement *e) {
+            return s < e->getSequence();
+        });
+    if (found != mIndex.begin()) {
+        --found;
+        it = LogBufferElementCollection::iterator(*found);
+    }
+    while ((it != mLogElements.end()) && ((*it)->getSequence() <= start)) {
+        ++it;
+    }
+    return it;
+}
+
+uint64_t LogBuffer::seekTime(const log_time &start) {
+    uint64_t sequence = 1;
+
+    pthread_rwlock_rdlock(&mLogElementsLock);
+    std::deque<LogBufferElement *>::iterator found = std::lower_bound(
+        mIndex.begin(), mIndex.end(), start,
+        [](const LogBufferElement *e, const log_time &t) {
+            return e->getRealTime() < t;
+        });
+    if (found != mIndex.begin()) {
+        sequence = (*--found)->getSequence();
+    }
+    pthread_rwlock_unlock(&mLogElementsLock);
+
+    return sequence;
+}
+
+uint64_t LogBuffer::seekTail(uint64_t start, unsigned long tail,
+                             unsigned int logMask, pid_t pid, uid_t uid,
+                             bool privileged, bool security) {
+    uint64_t sequence = start;
+
+    pthread_rwlock_rdlock(&mLogElementsLock);
+    // Count back from the newest, the same selection flushTo applies.
+    // Dropped (chatty) elements are not counted, so that the reader does
+    // not begin with one.
+    LogBufferElementCollection::iterator it = mLogElements.end();
+    unsigned long count = 0;
+    while (it != mLogElements.begin()) {
+        --it;
+        LogBufferElement *element = *it;
+        if (element->getSequence() <= start) {
+            break;
+        }
+        if (!privileged && (element->getUid() != uid)) {
+            continue;
+        }
+        if (!security && (element->getLogId() == LOG_ID_SECURITY)) {
+            continue;
+        }
+        if (!(logMask & (1 << element->getLogId()))) {
+            continue;
+        }
+        if (pid && (pid != element->getPid())) {
+            continue;
+        }
+        if (element->getDropped()) {
+            continue;
+        }
+        if (++count >= tail) {
+            sequence = element->getSequence() - 1;
+            break;
+        }
+    }
+    pthread_rwlock_unlock(&mLogElementsLock);
+
+    return (sequence > start) ? sequence : start;
+}
+
 uint64_t LogBuffer::flushTo(
         SocketClient *reader, const uint64_t start,
         bool privileged, bool security,
@@ -923,74 +1459,163 @@ uint64_t LogBuffer::flushTo(
     LogBufferElementCollection::iterator it;
     uint64_t max = start;
     uid_t uid = reader->getUid();
+    // Heap rather than reader thread stack, this is a fair size
+    std::unique_ptr<uint64_t[]> batch(
+        new uint64_t[flushBatchSize / sizeof(uint64_t)]);
+    std::unique_ptr<LogBufferElementFlush[]> flush(
+        new LogBufferElementFlush[flushBatchCount]);
+    std::unique_ptr<struct mmsghdr[]> msgs(new struct mmsghdr[flushBatchCount]);
+    // inflated payloads of compressed chunks
+    LogBufferArena::Cache cache;
+
+    pthread_rwlock_rdlock(&mLogElementsLock);
+
+    it = seek(start);
+
+    // Largest record LogListener can deliver, a batch is closed once it can
+    // no longer hold one. Anything larger (eg: LogAudit) is sent from a
+    // dedicated copy.
+    static const size_t recordMax = sizeof(LogBufferElement)
+                                  + LOGGER_ENTRY_MAX_PAYLOAD;
+
+    bool done = false;
+    while (!done) {
+        // Snapshot a batch of elements while holding the read lock
+        char *copies = reinterpret_cast<char *>(batch.get());
+        size_t used = 0;
+        LogBufferElement *oversize = NULL;
+
+        for (; it != mLogElements.end(); ++it) {
+            LogBufferElement *element = *it;
 
-    pthread_mutex_lock(&mLogElementsLock);
+            if (!privileged && (element->getUid() != uid)) {
+                continue;
+            }
+
+            if (!security && (element->getLogId() == LOG_ID_SECURITY)) {
+                continue;
+            }
 
-    if (start <= 1) {
-        // client wants to start from the beginning
-        it = mLogElements.begin();
-    } else {
-        // Client wants to start from some specified time. Chances are
-        // we are better off starting from the end of the time sorted list.
-        for (it = mLogElements.end(); it != mLogElements.begin(); /* do nothing */) {
-            --it;
-            LogBufferElement *element = *it;
             if (element->getSequence() <= start) {
-                it++;
-                break;
+                continue;
             }
-        }
-    }
 
-    for (; it != mLogElements.end(); ++it) {
-        LogBufferElement *element = *it;
+            // NB: calling out to another object with mLogElementsLock held (safe)
+            if (filter) {
+                int ret = (*filter)(element, arg);
+                if (ret == false) {
+                    continue;
+                }
+                if (ret != true) {
+                    done = true;
+                    break;
+                }
+            }
 
-        if (!privileged && (element->getUid() != uid)) {
-            continue;
-        }
+            const char *msg = element->mMsg;
+            if (msg && !(msg = mArena[element->getLogId()].read(msg, cache))) {
+                continue;
+            }
 
-        if (!security && (element->getLogId() == LOG_ID_SECURITY)) {
-            continue;
+            size_t size = element->getRecordSize();
+            if (size > (flushBatchSize - used)) {
+                void *record = malloc(size);
+                if (!record) {
+                    continue;
+                }
+                oversize = element->copy(record, msg);
+                break;
+            }
+            element->copy(copies + used, msg);
+            used += size;
+            if ((flushBatchSize - used) < recordMax) {
+                break;
+            }
         }
-
-        if (element->getSequence() <= start) {
-            continue;
+        if (it == mLogElements.end()) {
+            done = true;
         }
 
-        // NB: calling out to another object with mLogElementsLock held (safe)
-        if (filter) {
-            int ret = (*filter)(element, arg);
-            if (ret == false) {
-                continue;
+        pthread_rwlock_unlock(&mLogElementsLock);
+
+        // Format the batch, then hand it to the socket in one go. Each
+        // record remains a packet of its own, readers expect one entry
+        // per SOCK_SEQPACKET recv.
+        size_t count = 0;
+        for (size_t offset = 0; offset < used; ) {
+            LogBufferElement *element =
+                reinterpret_cast<LogBufferElement *>(copies + offset);
+            offset += element->getRecordSize();
+            max = element->getSequence();
+            if (element->populateFlush(flush[count], this, privileged)) {
+                ++count;
             }
-            if (ret != true) {
-                break;
+        }
+        if (oversize) {
+            max = oversize->getSequence();
+            if (oversize->populateFlush(flush[count], this, privileged)) {
+                ++count;
             }
         }
 
-        pthread_mutex_unlock(&mLogElementsLock);
+        for (size_t i = 0; i < count; ++i) {
+            struct msghdr &hdr = msgs[i].msg_hdr;
+            memset(&hdr, 0, sizeof(hdr));
+            hdr.msg_iov = flush[i].iovec;
+            hdr.msg_iovlen = 2;
+        }
+        int rc = count ? reader->sendMultipleDatav(msgs.get(), count) : 0;
 
-        // range locking in LastLogTimes looks after us
-        max = element->flushTo(reader, this, privileged);
+        for (size_t i = 0; i < count; ++i) {
+            free(flush[i].buffer);
+        }
+        free(oversize);
+        if (rc) {
+            return LogBufferElement::FLUSH_ERROR;
+        }
 
-        if (max == element->FLUSH_ERROR) {
-            return max;
+        if (done) {
+            break;
         }
 
-        pthread_mutex_lock(&mLogElementsLock);
+        pthread_rwlock_rdlock(&mLogElementsLock);
+
+        // Resume after the last element sent, range locking in LastLogTimes
+        // (or skipReaders() once the reader lags) looks after it while we
+        // were unlocked.
+        ++it;
     }
-    pthread_mutex_unlock(&mLogElementsLock);
 
     return max;
 }
 
+void LogBuffer::overrun(log_id_t id, size_t count) {
+    pthread_rwlock_wrlock(&mLogElementsLock);
+    stats.overrun(id, count);
+    pthread_rwlock_unlock(&mLogElementsLock);
+}
+
 std::string LogBuffer::formatStatistics(uid_t uid, pid_t pid,
                                         unsigned int logMask) {
-    pthread_mutex_lock(&mLogElementsLock);
+    // Look up the names that logging left pending, /proc is read with no
+    // lock held so that logging does not wait on it.
+    LogStatistics::nameList_t pids, tids;
+    pthread_rwlock_rdlock(&mLogElementsLock);
+    stats.pendingNames(pids, tids);
+    pthread_rwlock_unlock(&mLogElementsLock);
+
+    if (!pids.empty() || !tids.empty()) {
+        LogStatistics::lookupNames(pids, tids);
+        pthread_rwlock_wrlock(&mLogElementsLock);
+        stats.setNames(pids, tids);
+        pthread_rwlock_unlock(&mLogElementsLock);
+    }
+
+    pthread_rwlock_rdlock(&mLogElementsLock);
 
     std::string ret = stats.format(uid, pid, logMask);
 
-    pthread_mutex_unlock(&mLogElementsLock);
+    pthread_rwlock_unlock(&mLogElementsLock);
 
     return ret;
 }
@@ -18,8 +18,9 @@
 #define _LOGD_LOG_BUFFER_H__
 
 #include <sys/types.h>
+#include <sys/uio.h>
 
-#include <list>
+#include <deque>
 #include <string>
 
 #include <log/log.h>
@@ -27,7 +28,10 @@
 
 #include <private/android_filesystem_config.h>
 
+#include "LogBufferArena.h"
 #include "LogBufferElement.h"
+#include "LogRateLimit.h"
+#include "LogRing.h"
 #include "LogTimes.h"
 #include "LogStatistics.h"
 #include "LogWhiteBlackList.h"
@@ -73,15 +77,23 @@ static bool isMonotonic(const log_time &mono) {
 
 }
 
-typedef std::list<LogBufferElement *> LogBufferElementCollection;
-
 class LogBuffer {
     LogBufferElementCollection mLogElements;
-    pthread_mutex_t mLogElementsLock;
+    // Writers (log, prune, clear) hold this exclusively. Readers hold it
+    // shared only while copying a batch of elements, the socket writes are
+    // performed with no lock held.
+    pthread_rwlock_t mLogElementsLock;
+    // element storage, one arena per log id keeps each log contiguous
+    LogBufferArena mArena[LOG_ID_MAX];
+    // Sparse index into mLogElements, every indexInterval'th element that
+    // was appended in time order. Sorted by both sequence and time.
+    std::deque<LogBufferElement *> mIndex;
+    size_t mIndexCountdown;
 
     LogStatistics stats;
 
     PruneList mPrune;
+    LogRateLimit mRateLimit;
     // watermark for last per log id
     LogBufferElementCollection::iterator mLast[LOG_ID_MAX];
     bool mLastSet[LOG_ID_MAX];
@@ -95,9 +107,16 @@ class LogBuffer {
                                LogBufferElementCollection::iterator>
                 LogBufferPidIteratorMap;
     LogBufferPidIteratorMap mLastWorstPidOfSystem[LOG_ID_MAX];
+    // every element, by log id and UID, for chatty worst UID pruning
+    typedef std::unordered_map<uid_t, LogBufferElementChain>
+                LogBufferUidChainMap;
+    LogBufferUidChainMap mUidChains[LOG_ID_MAX];
 
     unsigned long mMaxSize[LOG_ID_MAX];
 
+    // optional on-disk mirror of what is logged, survives a restart
+    LogRing mRing;
+
     bool monotonic;
 
 public:
@@ -110,10 +129,23 @@ public:
     int log(log_id_t log_id, log_time realtime,
             uid_t uid, pid_t pid, pid_t tid,
             const char *msg, unsigned short len);
+    // As above, the message gathered from vec straight into the element
+    // storage, truncated to USHRT_MAX.
+    int log(log_id_t log_id, log_time realtime,
+            uid_t uid, pid_t pid, pid_t tid,
+            const struct iovec *vec, size_t count);
     uint64_t flushTo(SocketClient *writer, const uint64_t start,
                      bool privileged, bool security,
                      int (*filter)(const LogBufferElement *element, void *arg) = NULL,
                      void *arg = NULL);
+    // Sequence to start a search for entries at or after start from, all
+    // entries up to and including it were logged earlier. 1 if none.
+    uint64_t seekTime(const log_time &start);
+    // Sequence after which the last tail entries flushTo would deliver
+    // for this selection begin, start if there are no more than tail.
+    uint64_t seekTail(uint64_t start, unsigned long tail,
+                      unsigned int logMask, pid_t pid, uid_t uid,
+                      bool privileged, bool security);
 
     bool clear(log_id_t id, uid_t uid = AID_ROOT);
     unsigned long getSize(log_id_t id);
@@ -122,6 +154,10 @@ public:
     // *strp uses malloc, use free to release.
     std::string formatStatistics(uid_t uid, pid_t pid, unsigned int logMask);
 
+    // datagrams liblog could not send to a full logdw socket, as reported
+    // in log id
+    void overrun(log_id_t id, size_t count);
+
     void enableStatistics() {
         stats.enableStatistics();
     }
@@ -129,20 +165,52 @@ public:
     int initPrune(const char *cp) { return mPrune.init(cp); }
     std::string formatPrune() { return mPrune.format(); }
 
+    int initRateLimit(const char *cp) { return mRateLimit.init(cp); }
+
     // helper must be protected directly or implicitly by lock()/unlock()
     const char *pidToName(pid_t pid) { return stats.pidToName(pid); }
     uid_t pidToUid(pid_t pid) { return stats.pidToUid(pid); }
     const char *uidToName(uid_t uid) { return stats.uidToName(uid); }
-    void lock() { pthread_mutex_lock(&mLogElementsLock); }
-    void unlock() { pthread_mutex_unlock(&mLogElementsLock); }
+    void lock() { pthread_rwlock_wrlock(&mLogElementsLock); }
+    void unlock() { pthread_rwlock_unlock(&mLogElementsLock); }
 
 private:
 
     static constexpr size_t minPrune = 4;
     static constexpr size_t maxPrune = 256;
-
+    // upper bound on what a reader copies per acquisition of the read lock,
+    // the batch then goes out to the reader in one sendmmsg
+    static constexpr size_t flushBatchSize = 64 * 1024;
+    // records that fit in a batch, plus an oversize one that closes it
+    static constexpr size_t flushBatchCount =
+        flushBatchSize / sizeof(LogBufferElement) + 1;
+
+    static constexpr size_t indexInterval = 64;
+
+    LogBufferElementCollection::iterator seek(uint64_t start);
+    unsigned long maxSizes(log_id_t id);
+    void initRing(unsigned long size);
+    static int replayRing(void *arg, log_id_t log_id, log_time realtime,
+                          uid_t uid, pid_t pid, pid_t tid,
+                          const char *msg, unsigned short len);
+    // Store an entry log() let through, len bytes gathered from vec
+    int insert(log_id_t log_id, log_time realtime,
+               uid_t uid, pid_t pid, pid_t tid,
+               const struct iovec *vec, size_t count, unsigned short len);
+    void logSuppressed(log_id_t log_id, log_time realtime,
+                       uid_t uid, pid_t pid, pid_t tid,
+                       const char *tag, uint32_t key, uint32_t count);
+    void logEvicted(log_time realtime);
     void maybePrune(log_id_t id);
+    bool readersLagging(log_id_t id);
+    bool skipReaders(LogBufferElement *element);
     bool prune(log_id_t id, unsigned long pruneRows, uid_t uid = AID_ROOT);
+    void setLastWorst(log_id_t id, LogBufferElementCollection::iterator it,
+                      pid_t worstPid);
+    bool pruneWorstUid(log_id_t id, uid_t worst, pid_t worstPid,
+                       size_t worst_sizes, size_t second_worst_sizes,
+                       unsigned long &pruneRows, LogTimeEntry *oldest,
+                       bool &busy);
     LogBufferElementCollection::iterator erase(
         LogBufferElementCollection::iterator it, bool coalesce = false);
 };
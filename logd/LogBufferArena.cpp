@@ -0,0 +1,304 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+#include "LogBufferArena.h"
+
+// Unique across arenas, a Cache must never mistake a recycled mapping
+// for the chunk it inflated.
+static atomic_uint_fast64_t serial(1);
+
+static inline size_t align(size_t size) {
+    return (size + LogBufferArena::alignment - 1)
+         & ~(LogBufferArena::alignment - 1);
+}
+
+LogBufferArena::Cache::Cache() : mNext(0) {
+    for (size_t i = 0; i < slots; ++i) {
+        mSlot[i].mChunk = NULL;
+        mSlot[i].mSerial = 0;
+        mSlot[i].mData = NULL;
+    }
+}
+
+LogBufferArena::Cache::~Cache() {
+    for (size_t i = 0; i < slots; ++i) {
+        free(mSlot[i].mData);
+    }
+}
+
+LogBufferArena::LogBufferArena() :
+        mCurrent(NULL),
+        mSpare(NULL),
+        mFootprint(0),
+        mRecords(0),
+        mPayloads(0),
+        mCompress(false),
+        mCompressedIn(0),
+        mCompressedOut(0) {
+}
+
+LogBufferArena::~LogBufferArena() {
+    // Any chunk still holding live records belongs to the caller's elements
+    if (mCurrent && !mCurrent->mLive) {
+        deleteChunk(mCurrent);
+    }
+    if (mSpare) {
+        deleteChunk(mSpare);
+    }
+}
+
+// Chunks are mapped directly rather than taken from the heap, aligned
+// allocations of this size fragment the heap and hold on to pages long
+// after the chunk is returned.
+LogBufferArena::Chunk *LogBufferArena::newChunk(size_t size) {
+    size = (size + chunkSize - 1) & ~(chunkSize - 1);
+    // Alignment is what lets toChunk() find the header from any record
+    // that starts within the first chunkSize bytes, oversize ones included.
+    // Over-map by one chunk and trim the excess on either side.
+    size_t mapSize = size + chunkSize;
+    void *memory = mmap(NULL, mapSize, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        return NULL;
+    }
+    uintptr_t start = reinterpret_cast<uintptr_t>(memory);
+    uintptr_t aligned = (start + chunkSize - 1) & ~(uintptr_t)(chunkSize - 1);
+    if (aligned != start) {
+        munmap(memory, aligned - start);
+    }
+    size_t tail = (start + mapSize) - (aligned + size);
+    if (tail) {
+        munmap(reinterpret_cast<void *>(aligned + size), tail);
+    }
+    Chunk *chunk = reinterpret_cast<Chunk *>(aligned);
+    chunk->mSize = size;
+    chunk->mLive = 0;
+    chunk->mCompressed = NULL;
+    chunk->mCompressedSize = 0;
+    resetChunk(chunk);
+    mFootprint += size;
+    return chunk;
+}
+
+void LogBufferArena::deleteChunk(Chunk *chunk) {
+    unseal(chunk);
+    mFootprint -= chunk->mSize;
+    munmap(chunk, chunk->mSize);
+}
+
+void LogBufferArena::resetChunk(Chunk *chunk) {
+    chunk->mUsed = align(sizeof(Chunk));
+    chunk->mPayload = chunk->mSize;
+    chunk->mSerial = serial.fetch_add(1, memory_order_relaxed);
+}
+
+// Whole pages of the payloads, from start to the end of the chunk
+size_t LogBufferArena::releasable(const Chunk *chunk, size_t &start) {
+    static const size_t page = sysconf(_SC_PAGESIZE);
+    start = (chunk->mPayload + page - 1) & ~(page - 1);
+    return (start < chunk->mSize) ? (chunk->mSize - start) : 0;
+}
+
+// Deflate the payloads and give back their pages. The mapping stays, so
+// that the payload addresses held by the elements keep their meaning.
+void LogBufferArena::seal(Chunk *chunk) {
+    size_t start;
+    size_t pages = releasable(chunk, start);
+    if (!pages) {
+        return;
+    }
+
+    size_t region = chunk->mSize - chunk->mPayload;
+    uLongf len = compressBound(region);
+    Bytef *compressed = static_cast<Bytef *>(malloc(len));
+    if (!compressed) {
+        return;
+    }
+    const Bytef *payloads = reinterpret_cast<const Bytef *>(chunk)
+                          + chunk->mPayload;
+    if ((compress2(compressed, &len, payloads, region, Z_BEST_SPEED) != Z_OK)
+            || (len >= pages)) {
+        free(compressed);
+        return;
+    }
+    void *shrunk = realloc(compressed, len);
+    chunk->mCompressed = shrunk ? shrunk : compressed;
+    chunk->mCompressedSize = len;
+
+    madvise(reinterpret_cast<char *>(chunk) + start, pages, MADV_DONTNEED);
+    mFootprint -= pages;
+    mFootprint += len;
+    mCompressedIn += region;
+    mCompressedOut += len;
+}
+
+// Payloads are no longer needed, only the accounting is put right, pages
+// given back come back zero filled when the chunk is next used.
+void LogBufferArena::unseal(Chunk *chunk) {
+    if (!chunk->mCompressed) {
+        return;
+    }
+    size_t start;
+    size_t pages = releasable(chunk, start);
+    mFootprint += pages;
+    mFootprint -= chunk->mCompressedSize;
+    mCompressedIn -= chunk->mSize - chunk->mPayload;
+    mCompressedOut -= chunk->mCompressedSize;
+    free(chunk->mCompressed);
+    chunk->mCompressed = NULL;
+    chunk->mCompressedSize = 0;
+}
+
+LogBufferArena::Chunk *LogBufferArena::toChunk(const void *record) {
+    return reinterpret_cast<Chunk *>(
+        reinterpret_cast<uintptr_t>(record) & ~(uintptr_t)(chunkSize - 1));
+}
+
+void *LogBufferArena::allocate(size_t size, size_t payloadSize,
+                               char *&payload) {
+    size = align(size);
+    payloadSize = align(payloadSize);
+
+    if (!mCurrent
+            || ((mCurrent->mUsed + size + payloadSize) > mCurrent->mPayload)) {
+        size_t header = align(sizeof(Chunk));
+        if ((header + size + payloadSize) > chunkSize) {
+            // Oversize, a dedicated chunk that is never made current nor
+            // sealed. Payload follows the record, within reach of toChunk().
+            Chunk *chunk = newChunk(header + size + payloadSize);
+            if (!chunk) {
+                return NULL;
+            }
+            char *record = reinterpret_cast<char *>(chunk) + header;
+            chunk->mUsed += size + payloadSize;
+            ++chunk->mLive;
+            ++mRecords;
+            mPayloads += payloadSize;
+            payload = record + size;
+            return record;
+        }
+
+        Chunk *chunk = mSpare;
+        if (chunk) {
+            mSpare = NULL;
+        } else if (!(chunk = newChunk(chunkSize))) {
+            return NULL;
+        }
+        if (mCurrent) {
+            // Retired chunk is reclaimed by release() of its last record
+            if (!mCurrent->mLive) {
+                deleteChunk(mCurrent);
+            } else if (mCompress) {
+                seal(mCurrent);
+            }
+        }
+        mCurrent = chunk;
+    }
+
+    char *record = reinterpret_cast<char *>(mCurrent) + mCurrent->mUsed;
+    mCurrent->mUsed += size;
+    mCurrent->mPayload -= payloadSize;
+    payload = reinterpret_cast<char *>(mCurrent) + mCurrent->mPayload;
+    ++mCurrent->mLive;
+    ++mRecords;
+    mPayloads += payloadSize;
+    return record;
+}
+
+void LogBufferArena::release(void *record, size_t size, size_t payloadSize) {
+    if (!record) {
+        return;
+    }
+
+    size = align(size);
+    payloadSize = align(payloadSize);
+    Chunk *chunk = toChunk(record);
+    --mRecords;
+    mPayloads -= payloadSize;
+
+    if (chunk == mCurrent) {
+        // Most recent allocation (eg: rejected by __android_log_is_loggable)
+        if ((reinterpret_cast<char *>(record) + size)
+                == (reinterpret_cast<char *>(chunk) + chunk->mUsed)) {
+            chunk->mUsed -= size;
+            chunk->mPayload += payloadSize;
+        }
+        if (!--chunk->mLive) {
+            resetChunk(chunk);
+        }
+        return;
+    }
+
+    if (--chunk->mLive) {
+        return;
+    }
+
+    unseal(chunk);
+    if (!mSpare && (chunk->mSize == chunkSize)) {
+        resetChunk(chunk);
+        mSpare = chunk;
+        return;
+    }
+    deleteChunk(chunk);
+}
+
+const char *LogBufferArena::read(const char *payload, Cache &cache) const {
+    const Chunk *chunk = toChunk(payload);
+    if (!chunk->mCompressed) {
+        return payload;
+    }
+
+    Cache::Slot *slot = NULL;
+    for (size_t i = 0; i < Cache::slots; ++i) {
+        if ((cache.mSlot[i].mChunk == chunk)
+                && (cache.mSlot[i].mSerial == chunk->mSerial)) {
+            slot = &cache.mSlot[i];
+            break;
+        }
+    }
+
+    const char *payloads = reinterpret_cast<const char *>(chunk)
+                         + chunk->mPayload;
+    if (!slot) {
+        slot = &cache.mSlot[cache.mNext];
+        cache.mNext = (cache.mNext + 1) % Cache::slots;
+        slot->mChunk = NULL;
+        if (!slot->mData) {
+            slot->mData = static_cast<char *>(malloc(chunkSize));
+            if (!slot->mData) {
+                return NULL;
+            }
+        }
+        size_t region = chunk->mSize - chunk->mPayload;
+        uLongf len = region;
+        if ((uncompress(reinterpret_cast<Bytef *>(slot->mData), &len,
+                        static_cast<const Bytef *>(chunk->mCompressed),
+                        chunk->mCompressedSize) != Z_OK)
+                || (len != region)) {
+            return NULL;
+        }
+        slot->mChunk = chunk;
+        slot->mSerial = chunk->mSerial;
+    }
+    return slot->mData + (payload - payloads);
+}
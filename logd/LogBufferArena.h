@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LOGD_LOG_BUFFER_ARENA_H__
+#define _LOGD_LOG_BUFFER_ARENA_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// Per log id record storage. Records (a LogBufferElement header and its
+// payload) are bump allocated from large aligned chunks so that elements
+// logged back to back are neighbours in memory. Headers grow up from the
+// front of a chunk and payloads down from the back. A chunk is handed
+// back once the last record in it is released; since the log buffers are
+// expired oldest first, chunks are recycled in roughly FIFO order. Records
+// that would not fit in a chunk get one of their own.
+//
+// With compression enabled, the payloads of a chunk are deflated when it
+// is sealed (a newer chunk takes over) and their pages handed back to the
+// system. Headers stay in place, payloads are read through a Cache.
+//
+// Not thread safe, caller must hold mLogElementsLock.
+class LogBufferArena {
+    struct Chunk {
+        size_t mSize;      // bytes mapped for this chunk, header included
+        size_t mUsed;      // headers bump offset, header included
+        size_t mPayload;   // payloads bump offset, grows down from mSize
+        size_t mLive;      // number of records not yet released
+        uint64_t mSerial;  // identifies this use of the chunk to a Cache
+        void *mCompressed; // deflated payloads once sealed, or NULL
+        size_t mCompressedSize;
+    };
+
+    Chunk *mCurrent;
+    Chunk *mSpare;     // one empty chunk held back to avoid mmap churn
+    size_t mFootprint; // bytes held by all chunks, including spare
+    size_t mRecords;
+    size_t mPayloads;  // payload bytes held, as logged
+    bool mCompress;
+    size_t mCompressedIn;  // payload bytes held in compressed chunks
+    size_t mCompressedOut; // what they were compressed to
+
+    Chunk *newChunk(size_t size);
+    void deleteChunk(Chunk *chunk);
+    void resetChunk(Chunk *chunk);
+    void seal(Chunk *chunk);
+    void unseal(Chunk *chunk);
+    static size_t releasable(const Chunk *chunk, size_t &start);
+    static Chunk *toChunk(const void *record);
+
+public:
+    // power of two, chunks are aligned to this so that a record can find
+    // its chunk header by masking its own address.
+    static const size_t chunkSize = 32 * 1024;
+    static const size_t alignment = sizeof(uint64_t);
+
+    // A reader's inflated copies of recently visited compressed chunks
+    class Cache {
+        friend LogBufferArena;
+
+        static const size_t slots = 4; // enough for interleaved log ids
+        struct Slot {
+            const Chunk *mChunk;
+            uint64_t mSerial;
+            char *mData;
+        } mSlot[slots];
+        size_t mNext;
+
+        // not copyable, owns the slot buffers
+        Cache(const Cache &);
+        void operator=(const Cache &);
+
+    public:
+        Cache();
+        ~Cache();
+    };
+
+    LogBufferArena();
+    ~LogBufferArena();
+
+    // header is size bytes, payloadSize bytes at payload are for its use
+    void *allocate(size_t size, size_t payloadSize, char *&payload);
+    void release(void *record, size_t size, size_t payloadSize);
+
+    void setCompress(bool compress) { mCompress = compress; }
+    // Where payload, as handed out by allocate(), can be read from. Itself
+    // unless its chunk is compressed. NULL if it could not be inflated.
+    const char *read(const char *payload, Cache &cache) const;
+
+    size_t footprint() const { return mFootprint; }
+    size_t records() const { return mRecords; }
+    size_t payloads() const { return mPayloads; }
+    size_t compressedIn() const { return mCompressedIn; }
+    size_t compressedOut() const { return mCompressedOut; }
+};
+
+#endif // _LOGD_LOG_BUFFER_ARENA_H__
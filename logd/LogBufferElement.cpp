@@ -22,10 +22,13 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <new>
+
 #include <log/logger.h>
 #include <private/android_logger.h>
 
 #include "LogBuffer.h"
+#include "LogBufferArena.h"
 #include "LogBufferElement.h"
 #include "LogCommand.h"
 #include "LogReader.h"
@@ -36,28 +39,79 @@ atomic_int_fast64_t LogBufferElement::sequence(1);
 
 LogBufferElement::LogBufferElement(log_id_t log_id, log_time realtime,
                                    uid_t uid, pid_t pid, pid_t tid,
-                                   const char *msg, unsigned short len) :
+                                   char *payload, unsigned short len) :
         mLogId(log_id),
         mUid(uid),
         mPid(pid),
         mTid(tid),
+        mMsg(payload),
         mMsgLen(len),
+        mRecordLen(len),
+        mTag(getTag(log_id, payload, len)),
         mSequence(sequence.fetch_add(1, memory_order_relaxed)),
         mRealTime(realtime) {
-    mMsg = new char[len];
-    memcpy(mMsg, msg, len);
+    mPrev = mNext = NULL;
+    mUidPrev = mUidNext = NULL;
+}
+
+LogBufferElement *LogBufferElement::create(LogBufferArena &arena,
+                                           log_id_t log_id, log_time realtime,
+                                           uid_t uid, pid_t pid, pid_t tid,
+                                           const char *msg,
+                                           unsigned short len) {
+    struct iovec vec = { const_cast<char *>(msg), len };
+    return create(arena, log_id, realtime, uid, pid, tid, &vec, 1, len);
+}
+
+LogBufferElement *LogBufferElement::create(LogBufferArena &arena,
+                                           log_id_t log_id, log_time realtime,
+                                           uid_t uid, pid_t pid, pid_t tid,
+                                           const struct iovec *vec,
+                                           size_t count,
+                                           unsigned short len) {
+    char *payload;
+    void *record = arena.allocate(sizeof(LogBufferElement), len, payload);
+    if (!record) {
+        return NULL;
+    }
+    size_t used = 0;
+    for (size_t i = 0; (i < count) && (used < len); ++i) {
+        size_t n = vec[i].iov_len;
+        if (n > (size_t)(len - used)) {
+            n = len - used;
+        }
+        memcpy(payload + used, vec[i].iov_base, n);
+        used += n;
+    }
+    return new (record) LogBufferElement(log_id, realtime,
+                                         uid, pid, tid, payload, len);
 }
 
-LogBufferElement::~LogBufferElement() {
-    delete [] mMsg;
+void LogBufferElement::destroy(LogBufferArena &arena,
+                               LogBufferElement *element) {
+    size_t len = element->mRecordLen;
+    element->~LogBufferElement();
+    arena.release(element, sizeof(LogBufferElement), len);
 }
 
-uint32_t LogBufferElement::getTag() const {
-    if (((mLogId != LOG_ID_EVENTS) && (mLogId != LOG_ID_SECURITY)) ||
-            !mMsg || (mMsgLen < sizeof(uint32_t))) {
+LogBufferElement *LogBufferElement::copy(void *record, const char *msg) const {
+    LogBufferElement *element = new (record) LogBufferElement(*this);
+    element->mPrev = element->mNext = NULL;
+    element->mUidPrev = element->mUidNext = NULL;
+    if (mMsg) {
+        element->mMsg = reinterpret_cast<char *>(element + 1);
+        memcpy(element->mMsg, msg, mMsgLen);
+    }
+    return element;
+}
+
+uint32_t LogBufferElement::getTag(log_id_t log_id, const char *msg,
+                                  unsigned short len) {
+    if (((log_id != LOG_ID_EVENTS) && (log_id != LOG_ID_SECURITY)) ||
+            !msg || (len < sizeof(uint32_t))) {
         return 0;
     }
-    return le32toh(reinterpret_cast<android_event_header_t *>(mMsg)->tag);
+    return le32toh(reinterpret_cast<const android_event_header_t *>(msg)->tag);
 }
 
 // caller must own and free character string
@@ -199,9 +253,9 @@ size_t LogBufferElement::populateDroppedMessage(char *&buffer,
     return retval;
 }
 
-uint64_t LogBufferElement::flushTo(SocketClient *reader, LogBuffer *parent,
-                                   bool privileged) {
-    struct logger_entry_v4 entry;
+bool LogBufferElement::populateFlush(LogBufferElementFlush &flush,
+                                     LogBuffer *parent, bool privileged) {
+    struct logger_entry_v4 &entry = flush.entry;
 
     memset(&entry, 0, sizeof(struct logger_entry_v4));
 
@@ -215,29 +269,22 @@ uint64_t LogBufferElement::flushTo(SocketClient *reader, LogBuffer *parent,
     entry.sec = mRealTime.tv_sec;
     entry.nsec = mRealTime.tv_nsec;
 
-    struct iovec iovec[2];
-    iovec[0].iov_base = &entry;
-    iovec[0].iov_len = entry.hdr_size;
+    flush.iovec[0].iov_base = &entry;
+    flush.iovec[0].iov_len = entry.hdr_size;
 
-    char *buffer = NULL;
+    flush.buffer = NULL;
 
     if (!mMsg) {
-        entry.len = populateDroppedMessage(buffer, parent);
+        entry.len = populateDroppedMessage(flush.buffer, parent);
         if (!entry.len) {
-            return mSequence;
+            return false;
         }
-        iovec[1].iov_base = buffer;
+        flush.iovec[1].iov_base = flush.buffer;
     } else {
         entry.len = mMsgLen;
-        iovec[1].iov_base = mMsg;
+        flush.iovec[1].iov_base = mMsg;
     }
-    iovec[1].iov_len = entry.len;
-
-    uint64_t retval = reader->sendDatav(iovec, 2) ? FLUSH_ERROR : mSequence;
+    flush.iovec[1].iov_len = entry.len;
 
-    if (buffer) {
-        free(buffer);
-    }
-
-    return retval;
+    return true;
 }
@@ -20,12 +20,16 @@
 #include <stdatomic.h>
 #include <stdlib.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #include <sysutils/SocketClient.h>
 #include <log/log.h>
 #include <log/log_read.h>
+#include <log/logger.h>
 
 class LogBuffer;
+class LogBufferArena;
+class LogBufferElementCollection;
 
 #define EXPIRE_HOUR_THRESHOLD 24 // Only expire chatty UID logs to preserve
                                  // non-chatty UIDs less than this age in hours
@@ -33,19 +37,44 @@ class LogBuffer;
                                  // chatty for the temporal expire messages
 #define EXPIRE_RATELIMIT 10      // maximum rate in seconds to report expiration
 
-class LogBufferElement {
+// A record formatted for a reader, iovec[0] covers the header in entry and
+// iovec[1] the payload. buffer, if set, holds the payload and is the
+// caller's to free.
+struct LogBufferElementFlush {
+    struct logger_entry_v4 entry;
+    struct iovec iovec[2];
+    char *buffer;
+};
+
+// Linkage for the intrusive LogBufferElementCollection below
+struct LogBufferElementLink {
+    LogBufferElementLink *mPrev;
+    LogBufferElementLink *mNext;
+};
+
+// Linkage for LogBufferElementChain below
+struct LogBufferElementUidLink {
+    LogBufferElementUidLink *mUidPrev;
+    LogBufferElementUidLink *mUidNext;
+};
+
+class LogBufferElement : public LogBufferElementLink,
+                         public LogBufferElementUidLink {
 
     friend LogBuffer;
+    friend LogBufferElementCollection;
 
     const log_id_t mLogId;
     const uid_t mUid;
     const pid_t mPid;
     const pid_t mTid;
-    char *mMsg;
+    char *mMsg;                   // payload in arena, or NULL
     union {
         const unsigned short mMsgLen; // mMSg != NULL
         unsigned short mDropped;      // mMsg == NULL
     };
+    const unsigned short mRecordLen; // payload bytes reserved in arena
+    const uint32_t mTag;          // the payload may be compressed
     const uint64_t mSequence;
     log_time mRealTime;
     static atomic_int_fast64_t sequence;
@@ -54,22 +83,43 @@ class LogBufferElement {
     size_t populateDroppedMessage(char *&buffer,
                                   LogBuffer *parent);
 
-public:
+    // payload already holds the len bytes of the message
     LogBufferElement(log_id_t log_id, log_time realtime,
                      uid_t uid, pid_t pid, pid_t tid,
-                     const char *msg, unsigned short len);
-    virtual ~LogBufferElement();
+                     char *payload, unsigned short len);
+    ~LogBufferElement() { }
+
+public:
+    // Element and its payload are carved out of arena as a single record
+    static LogBufferElement *create(LogBufferArena &arena,
+                                    log_id_t log_id, log_time realtime,
+                                    uid_t uid, pid_t pid, pid_t tid,
+                                    const char *msg, unsigned short len);
+    // As above, the payload gathered from the first len bytes of vec
+    static LogBufferElement *create(LogBufferArena &arena,
+                                    log_id_t log_id, log_time realtime,
+                                    uid_t uid, pid_t pid, pid_t tid,
+                                    const struct iovec *vec, size_t count,
+                                    unsigned short len);
+    static void destroy(LogBufferArena &arena, LogBufferElement *element);
+
+    // Snapshot, with the payload read from msg inline behind it, into
+    // getRecordSize() bytes of suitably aligned caller storage. The copy
+    // is not linked into any collection.
+    size_t getRecordSize() const {
+        return (sizeof(LogBufferElement) + getMsgLen() + sizeof(uint64_t) - 1)
+             & ~(sizeof(uint64_t) - 1);
+    }
+    LogBufferElement *copy(void *record, const char *msg) const;
 
     log_id_t getLogId() const { return mLogId; }
     uid_t getUid(void) const { return mUid; }
     pid_t getPid(void) const { return mPid; }
     pid_t getTid(void) const { return mTid; }
     unsigned short getDropped(void) const { return mMsg ? 0 : mDropped; }
+    // Payload space stays with the record until it is destroyed
     unsigned short setDropped(unsigned short value) {
-        if (mMsg) {
-            delete [] mMsg;
-            mMsg = NULL;
-        }
+        mMsg = NULL;
         return mDropped = value;
     }
     unsigned short getMsgLen() const { return mMsg ? mMsgLen : 0; }
@@ -77,10 +127,119 @@ public:
     static uint64_t getCurrentSequence(void) { return sequence.load(memory_order_relaxed); }
     log_time getRealTime(void) const { return mRealTime; }
 
-    uint32_t getTag(void) const;
+    uint32_t getTag(void) const { return mMsg ? mTag : 0; }
+    static uint32_t getTag(log_id_t log_id, const char *msg,
+                           unsigned short len);
 
     static const uint64_t FLUSH_ERROR;
-    uint64_t flushTo(SocketClient *writer, LogBuffer *parent, bool privileged);
+    // false if there is nothing to send for this element
+    bool populateFlush(LogBufferElementFlush &flush, LogBuffer *parent,
+                       bool privileged);
+};
+
+// Circular doubly linked list threaded through the elements themselves,
+// mirrors the subset of std::list<LogBufferElement *> LogBuffer relies on.
+// Iterators stay valid until the element they reference is erased.
+class LogBufferElementCollection {
+    LogBufferElementLink mHead;
+
+    // not copyable, elements are linked to mHead
+    LogBufferElementCollection(const LogBufferElementCollection &);
+    void operator=(const LogBufferElementCollection &);
+
+public:
+    class iterator {
+        LogBufferElementLink *mLink;
+
+    public:
+        iterator() : mLink(NULL) { }
+        explicit iterator(LogBufferElementLink *link) : mLink(link) { }
+
+        LogBufferElement *operator*() const {
+            return static_cast<LogBufferElement *>(mLink);
+        }
+        iterator &operator++() { mLink = mLink->mNext; return *this; }
+        iterator &operator--() { mLink = mLink->mPrev; return *this; }
+        iterator operator++(int) {
+            iterator it(*this);
+            mLink = mLink->mNext;
+            return it;
+        }
+        iterator operator--(int) {
+            iterator it(*this);
+            mLink = mLink->mPrev;
+            return it;
+        }
+        bool operator==(const iterator &rhs) const { return mLink == rhs.mLink; }
+        bool operator!=(const iterator &rhs) const { return mLink != rhs.mLink; }
+
+        friend LogBufferElementCollection;
+    };
+
+    LogBufferElementCollection() { mHead.mPrev = mHead.mNext = &mHead; }
+
+    iterator begin() { return iterator(mHead.mNext); }
+    iterator end() { return iterator(&mHead); }
+    bool empty() const { return mHead.mNext == &mHead; }
+
+    // insert element before it
+    iterator insert(iterator it, LogBufferElement *element) {
+        LogBufferElementLink *next = it.mLink;
+        element->mNext = next;
+        element->mPrev = next->mPrev;
+        next->mPrev->mNext = element;
+        next->mPrev = element;
+        return iterator(element);
+    }
+    void push_back(LogBufferElement *element) { insert(end(), element); }
+
+    // unlink, caller owns the element, returns the next iterator
+    iterator erase(iterator it) {
+        LogBufferElementLink *link = it.mLink;
+        LogBufferElementLink *next = link->mNext;
+        link->mPrev->mNext = next;
+        next->mPrev = link->mPrev;
+        link->mPrev = link->mNext = NULL;
+        return iterator(next);
+    }
+};
+
+// Elements of one log id and UID in sequence order, threaded through the
+// elements so that the worst UID can be pruned oldest first without
+// visiting any of the elements around them in LogBufferElementCollection.
+// Circular, elements unlink themselves without reference to the chain.
+class LogBufferElementChain {
+    LogBufferElementUidLink mHead;
+
+    // not copyable, elements are linked to mHead
+    LogBufferElementChain(const LogBufferElementChain &);
+    void operator=(const LogBufferElementChain &);
+
+public:
+    LogBufferElementChain() { mHead.mUidPrev = mHead.mUidNext = &mHead; }
+
+    // oldest, or NULL if empty
+    LogBufferElement *front() const { return next(&mHead); }
+    // following element, or NULL at the end of the chain
+    LogBufferElement *next(const LogBufferElementUidLink *link) const {
+        if (link->mUidNext == &mHead) {
+            return NULL;
+        }
+        return static_cast<LogBufferElement *>(link->mUidNext);
+    }
+
+    void push_back(LogBufferElement *element) {
+        element->mUidNext = &mHead;
+        element->mUidPrev = mHead.mUidPrev;
+        mHead.mUidPrev->mUidNext = element;
+        mHead.mUidPrev = element;
+    }
+
+    static void erase(LogBufferElement *element) {
+        element->mUidPrev->mUidNext = element->mUidNext;
+        element->mUidNext->mUidPrev = element->mUidPrev;
+        element->mUidPrev = element->mUidNext = NULL;
+    }
 };
 
 #endif
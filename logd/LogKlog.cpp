@@ -305,6 +305,10 @@ void LogKlog::calculateCorrection(const log_time &monotonic,
 static const char suspendStr[] = "PM: suspend entry ";
 static const char resumeStr[] = "PM: suspend exit ";
 static const char suspendedStr[] = "Suspended for ";
+static const char healthdStr[] = "healthd";
+static const char batteryStr[] = ": battery ";
+static const char auditStr[] = " audit(";
+static const char klogdStr[] = "logd.klogd: ";
 
 static const char *strnstr(const char *s, size_t len, const char *needle) {
     char c;
@@ -327,17 +331,76 @@ static const char *strnstr(const char *s, size_t len, const char *needle) {
     return s;
 }
 
+// s if needle, a string literal, is found there and ends before end
+template <size_t N>
+static inline const char *match(const char *s, const char *end,
+                                const char (&needle)[N]) {
+    return (((size_t)(end - s) >= (N - 1)) && !fast<memcmp>(s, needle, N - 1))
+        ? s : NULL;
+}
+
+// Marker of size characters if it lies within the len bytes at s, what
+// strnstr(s, len, <marker>) would have returned.
+static inline const char *within(const char *marker,
+                                 const char *s, size_t len, size_t size) {
+    return (marker && (marker >= s) && ((marker + size) <= (s + len)))
+        ? marker : NULL;
+}
+
+// One pass over the line, in place of a strnstr for each of the markers.
+// All but audit start with a letter, which a <PRI>[<TIME>] prefix does not
+// have, so they can be sought from the start of the line.
+void LogKlog::findMarkers(const char *buf, size_t len, Markers &markers) {
+    memset(&markers, 0, sizeof(markers));
+    const char *end = buf + len;
+    for (const char *s = buf; s < end; ++s) {
+        switch (*s) {
+        case ' ':
+            if (!markers.audit) {
+                markers.audit = match(s, end, auditStr);
+            }
+            break;
+        case 'l':
+            if (!markers.klogd) {
+                markers.klogd = match(s, end, klogdStr);
+            }
+            break;
+        case 'P':
+            if (!markers.suspend) {
+                markers.suspend = match(s, end, suspendStr);
+            }
+            if (!markers.resume) {
+                markers.resume = match(s, end, resumeStr);
+            }
+            break;
+        case 'h':
+            if (!markers.healthd) {
+                markers.healthd = match(s, end, healthdStr);
+            }
+            break;
+        case ':':
+            if (markers.healthd && !markers.battery
+                    && (s >= (markers.healthd + sizeof(healthdStr) - 1))) {
+                markers.battery = match(s, end, batteryStr);
+            }
+            break;
+        case 'S':
+            if (!markers.suspended) {
+                markers.suspended = match(s, end, suspendedStr);
+            }
+            break;
+        }
+    }
+}
+
 void LogKlog::sniffTime(log_time &now,
                         const char **buf, size_t len,
-                        bool reverse) {
+                        bool reverse, const Markers *markers) {
     const char *cp = now.strptime(*buf, "[ %s.%q]");
     if (cp && (cp >= &(*buf)[len])) {
         cp = NULL;
     }
     if (cp) {
-        static const char healthd[] = "healthd";
-        static const char battery[] = ": battery ";
-
         len -= cp - *buf;
         if (len && isspace(*cp)) {
             ++cp;
@@ -349,26 +412,36 @@ void LogKlog::sniffTime(log_time &now,
             return;
         }
 
+        Markers found;
+        if (!markers) {
+            findMarkers(cp, len, found);
+            markers = &found;
+        }
+
         const char *b;
-        if (((b = strnstr(cp, len, suspendStr)))
+        if (((b = within(markers->suspend, cp, len, sizeof(suspendStr) - 1)))
                 && ((size_t)((b += sizeof(suspendStr) - 1) - cp) < len)) {
             len -= b - cp;
             calculateCorrection(now, b, len);
-        } else if (((b = strnstr(cp, len, resumeStr)))
+        } else if (((b = within(markers->resume, cp, len,
+                                sizeof(resumeStr) - 1)))
                 && ((size_t)((b += sizeof(resumeStr) - 1) - cp) < len)) {
             len -= b - cp;
             calculateCorrection(now, b, len);
-        } else if (((b = strnstr(cp, len, healthd)))
-                && ((size_t)((b += sizeof(healthd) - 1) - cp) < len)
-                && ((b = strnstr(b, len -= b - cp, battery)))
-                && ((size_t)((b += sizeof(battery) - 1) - cp) < len)) {
+        } else if (((b = within(markers->healthd, cp, len,
+                                sizeof(healthdStr) - 1)))
+                && ((size_t)((b += sizeof(healthdStr) - 1) - cp) < len)
+                && ((b = within(markers->battery, b, len -= b - cp,
+                                sizeof(batteryStr) - 1)))
+                && ((size_t)((b += sizeof(batteryStr) - 1) - cp) < len)) {
             // NB: healthd is roughly 150us late, so we use it instead to
             //     trigger a check for ntp-induced or hardware clock drift.
             log_time real(CLOCK_REALTIME);
             log_time mono(CLOCK_MONOTONIC);
             correction = (real < mono) ? log_time::EPOCH : (real - mono);
-        } else if (((b = strnstr(cp, len, suspendedStr)))
-                && ((size_t)((b += sizeof(suspendStr) - 1) - cp) < len)) {
+        } else if (((b = within(markers->suspended, cp, len,
+                                sizeof(suspendedStr) - 1)))
+                && ((size_t)((b += sizeof(suspendedStr) - 1) - cp) < len)) {
             len -= b - cp;
             log_time real;
             char *endp;
@@ -402,6 +475,37 @@ void LogKlog::sniffTime(log_time &now,
     }
 }
 
+// Same as sscanf(s - 1, "[%d:%*[a-z_./0-9:A-Z]]%c", &pid, &c) == 2, for
+// what would be in most lines a needless trip through stdio.
+static pid_t sniffMediatekPid(const char *s) {
+    while (isspace(*s)) {
+        ++s;
+    }
+    bool negative = (*s == '-');
+    if ((*s == '-') || (*s == '+')) {
+        ++s;
+    }
+    if (!isdigit(*s)) {
+        return 0;
+    }
+    int pid = 0;
+    while (isdigit(*s)) {
+        pid = (pid * 10) + (*s++ - '0');
+    }
+    if (*s++ != ':') {
+        return 0;
+    }
+    const char *name = s;
+    while (isalnum(*s) || (*s == '_') || (*s == '.')
+            || (*s == '/') || (*s == ':')) {
+        ++s;
+    }
+    if ((s == name) || (*s++ != ']') || !*s) {
+        return 0;
+    }
+    return negative ? -pid : pid;
+}
+
 pid_t LogKlog::sniffPid(const char **buf, size_t len) {
     const char *cp = *buf;
     // HTC kernels with modified printk "c0   1648 "
@@ -428,18 +532,10 @@ pid_t LogKlog::sniffPid(const char **buf, size_t len) {
             }
         }
     }
-    while (len) {
-        // Mediatek kernels with modified printk
-        if (*cp == '[') {
-            int pid = 0;
-            char dummy;
-            if (sscanf(cp, "[%d:%*[a-z_./0-9:A-Z]]%c", &pid, &dummy) == 2) {
-                return pid;
-            }
-            break; // Only the first one
-        }
-        ++cp;
-        --len;
+    // Mediatek kernels with modified printk, only the first [ counts
+    cp = static_cast<const char *>(memchr(cp, '[', len));
+    if (cp) {
+        return sniffMediatekPid(cp + 1);
     }
     return 0;
 }
@@ -582,7 +678,10 @@ static const char *strnrchr(const char *s, size_t len, char c) {
 // return -1 if message logd.klogd: <signature>
 //
 int LogKlog::log(const char *buf, size_t len) {
-    if (auditd && strnstr(buf, len, " audit(")) {
+    Markers markers;
+    findMarkers(buf, len, markers);
+
+    if (auditd && markers.audit) {
         return 0;
     }
 
@@ -590,13 +689,13 @@ int LogKlog::log(const char *buf, size_t len) {
     int pri = parseKernelPrio(&p, len);
 
     log_time now;
-    sniffTime(now, &p, len - (p - buf), false);
+    sniffTime(now, &p, len - (p - buf), false, &markers);
 
     // sniff for start marker
-    const char klogd_message[] = "logd.klogd: ";
-    const char *start = strnstr(p, len - (p - buf), klogd_message);
+    const char *start = within(markers.klogd, p, len - (p - buf),
+                               sizeof(klogdStr) - 1);
     if (start) {
-        uint64_t sig = strtoll(start + sizeof(klogd_message) - 1, NULL, 10);
+        uint64_t sig = strtoll(start + sizeof(klogdStr) - 1, NULL, 10);
         if (sig == signature.nsec()) {
             if (initialized) {
                 enableLogging = true;
@@ -797,28 +896,17 @@ twoWord:    while (--taglen && !isspace(*++cp) && (*cp != ':'));
         return -EINVAL;
     }
 
-    // Careful.
-    // We are using the stack to house the log buffer for speed reasons.
-    // If we malloc'd this buffer, we could get away without n's USHRT_MAX
-    // test above, but we would then required a max(n, USHRT_MAX) as
-    // truncating length argument to logbuf->log() below. Gain is protection
-    // of stack sanity and speedup, loss is truncated long-line content.
-    char newstr[n];
-    char *np = newstr;
-
-    // Convert priority into single-byte Android logger priority
-    *np = convertKernelPrioToAndroidPrio(pri);
-    ++np;
-
-    // Copy parsed tag following priority
-    memcpy(np, tag, taglen);
-    np += taglen;
-    *np = '\0';
-    ++np;
-
-    // Copy main message to the remainder
-    memcpy(np, p, b);
-    np[b] = '\0';
+    // The priority, tag and message are gathered straight from the line
+    // into the log buffer, no copy is assembled here.
+    char prio = convertKernelPrioToAndroidPrio(pri);
+    static const char nul = '\0';
+    struct iovec vec[] = {
+        { &prio, 1 },
+        { const_cast<char *>(tag), taglen },
+        { const_cast<char *>(&nul), 1 },
+        { const_cast<char *>(p), b },
+        { const_cast<char *>(&nul), 1 },
+    };
 
     if (!isMonotonic()) {
         // Watch out for singular race conditions with timezone causing near
@@ -846,8 +934,8 @@ twoWord:    while (--taglen && !isspace(*++cp) && (*cp != ':'));
     }
 
     // Log message
-    int rc = logbuf->log(LOG_ID_KERNEL, now, uid, pid, tid, newstr,
-                         (unsigned short) n);
+    int rc = logbuf->log(LOG_ID_KERNEL, now, uid, pid, tid,
+                         vec, sizeof(vec) / sizeof(vec[0]));
 
     // notify readers
     if (!rc) {
@@ -50,7 +50,22 @@ public:
     static void convertRealToMonotonic(log_time &real) { real -= correction; }
 
 protected:
-    void sniffTime(log_time &now, const char **buf, size_t len, bool reverse);
+    // First occurrence in a line of each of the strings the parse of
+    // it depends on, or NULL.
+    struct Markers {
+        const char *audit;     // " audit("
+        const char *klogd;     // "logd.klogd: "
+        const char *suspend;   // "PM: suspend entry "
+        const char *resume;    // "PM: suspend exit "
+        const char *healthd;   // "healthd"
+        const char *battery;   // ": battery ", after healthd
+        const char *suspended; // "Suspended for "
+    };
+    static void findMarkers(const char *buf, size_t len, Markers &markers);
+
+    // markers, if set, were found in a line that includes *buf
+    void sniffTime(log_time &now, const char **buf, size_t len, bool reverse,
+                   const Markers *markers = NULL);
     pid_t sniffPid(const char **buf, size_t len);
     void calculateCorrection(const log_time &monotonic,
                              const char *real_string, size_t len);
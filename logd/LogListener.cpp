@@ -14,6 +14,8 @@
  * limitations under the License.
  */
 
+#include <endian.h>
+#include <errno.h>
 #include <limits.h>
 #include <sys/cdefs.h>
 #include <sys/prctl.h>
@@ -32,39 +34,75 @@
 #include "LogUtils.h"
 
 LogListener::LogListener(LogBuffer *buf, LogReader *reader) :
-        SocketListener(getLogSocket(), false),
+        LogListener(buf, reader, getLogSocket()) {
+}
+
+LogListener::LogListener(LogBuffer *buf, LogReader *reader, int sock) :
+        SocketListener(sock, false),
         logbuf(buf),
-        reader(reader) {
+        reader(reader),
+        mSock(sock) {
 }
 
-bool LogListener::onDataAvailable(SocketClient *cli) {
+// What one recvmmsg fills
+struct LogListener::Batch {
+    char buffer[batchSize][sizeof_log_id_t + sizeof(uint16_t)
+        + sizeof(log_time) + LOGGER_ENTRY_MAX_PAYLOAD];
+    char control[batchSize][CMSG_SPACE(sizeof(struct ucred))] __aligned(4);
+    struct iovec iov[batchSize];
+    struct mmsghdr msgs[batchSize];
+};
+
+bool LogListener::onDataAvailable(SocketClient * /* cli */) {
     static bool name_set;
+    static Batch *batch;
     if (!name_set) {
         prctl(PR_SET_NAME, "logd.writer");
         name_set = true;
+        batch = new Batch;
     }
 
-    char buffer[sizeof_log_id_t + sizeof(uint16_t) + sizeof(log_time)
-        + LOGGER_ENTRY_MAX_PAYLOAD];
-    struct iovec iov = { buffer, sizeof(buffer) };
-
-    char control[CMSG_SPACE(sizeof(struct ucred))] __aligned(4);
-    struct msghdr hdr = {
-        NULL,
-        0,
-        &iov,
-        1,
-        control,
-        sizeof(control),
-        0,
-    };
+    // One receiving thread, so each sender's lines go in the order sent
+    return receive(*batch) > 0;
+}
 
-    int socket = cli->getSocket();
+// Returns the number of datagrams received, or -1 and errno
+int LogListener::receive(Batch &batch) {
+    for (unsigned i = 0; i < batchSize; ++i) {
+        batch.iov[i].iov_base = batch.buffer[i];
+        batch.iov[i].iov_len = sizeof(batch.buffer[i]);
+
+        struct msghdr &hdr = batch.msgs[i].msg_hdr;
+        hdr.msg_name = NULL;
+        hdr.msg_namelen = 0;
+        hdr.msg_iov = &batch.iov[i];
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = batch.control[i];
+        hdr.msg_controllen = sizeof(batch.control[i]);
+        hdr.msg_flags = 0;
+    }
 
     // To clear the entire buffer is secure/safe, but this contributes to 1.68%
     // overhead under logging load. We are safe because we check counts.
     // memset(buffer, 0, sizeof(buffer));
-    ssize_t n = recvmsg(socket, &hdr, 0);
+    int count = recvmmsg(mSock, batch.msgs, batchSize, MSG_DONTWAIT, NULL);
+    if (count <= 0) {
+        return count;
+    }
+
+    bool notify = false;
+    for (int i = 0; i < count; ++i) {
+        notify |= log(batch.buffer[i], batch.msgs[i].msg_len,
+                      batch.msgs[i].msg_hdr);
+    }
+    if (notify) {
+        reader->notifyNewLog();
+    }
+    return count;
+}
+
+// true if the datagram made it into the log buffer
+bool LogListener::log(char *buffer, ssize_t n, struct msghdr &hdr) {
     if (n <= (ssize_t)(sizeof(android_log_header_t))) {
         return false;
     }
@@ -106,16 +144,28 @@ bool LogListener::onDataAvailable(SocketClient *cli) {
     char *msg = ((char *)buffer) + sizeof(android_log_header_t);
     n -= sizeof(android_log_header_t);
 
+    // liblog reports the writes it lost to a full logdw socket (EAGAIN) in
+    // the events log, and those of them that were security in its own.
+    // Anyone can send such an event, only those with log credentials count.
+    if (((header->id == LOG_ID_EVENTS) || (header->id == LOG_ID_SECURITY))
+            && (n == sizeof(android_log_event_int_t))
+            && clientHasLogCredentials(cred->uid, cred->gid, cred->pid)) {
+        android_log_event_int_t *event =
+            reinterpret_cast<android_log_event_int_t *>(msg);
+        if ((le32toh(event->header.tag) == LIBLOG_LOG_TAG)
+                && (event->payload.type == EVENT_TYPE_INT)
+                && ((int32_t)le32toh(event->payload.data) > 0)) {
+            logbuf->overrun((log_id_t)header->id,
+                            le32toh(event->payload.data));
+        }
+    }
+
     // NB: hdr.msg_flags & MSG_TRUNC is not tested, silently passing a
     // truncated message to the logs.
 
-    if (logbuf->log((log_id_t)header->id, header->realtime,
+    return logbuf->log((log_id_t)header->id, header->realtime,
             cred->uid, cred->pid, header->tid, msg,
-            ((size_t) n <= USHRT_MAX) ? (unsigned short) n : USHRT_MAX) >= 0) {
-        reader->notifyNewLog();
-    }
-
-    return true;
+            ((size_t) n <= USHRT_MAX) ? (unsigned short) n : USHRT_MAX) >= 0;
 }
 
 int LogListener::getLogSocket() {
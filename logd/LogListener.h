@@ -23,6 +23,9 @@
 class LogListener : public SocketListener {
     LogBuffer *logbuf;
     LogReader *reader;
+    int mSock;
+
+    LogListener(LogBuffer *buf, LogReader *reader, int sock);
 
 public:
     LogListener(LogBuffer *buf, LogReader *reader);
@@ -31,7 +34,13 @@ protected:
     virtual bool onDataAvailable(SocketClient *cli);
 
 private:
+    // datagrams taken by one recvmmsg, and logged per reader wakeup
+    static const unsigned batchSize = 8;
+    struct Batch;
+
     static int getLogSocket();
+    int receive(Batch &batch);
+    bool log(char *buffer, ssize_t n, struct msghdr &hdr);
 };
 
 #endif
@@ -0,0 +1,226 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <string>
+
+#include <cutils/properties.h>
+
+#include "LogRateLimit.h"
+
+static uint64_t monotonicNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * LogRateLimit::nsPerSec + ts.tv_nsec;
+}
+
+LogRateLimit::LogRateLimit() :
+        mHaveEvicted(false),
+        mRate(0),
+        mBurst(0),
+        mSample(0) {
+    pthread_mutex_init(&mLock, NULL);
+    init(NULL);
+}
+
+LogRateLimit::~LogRateLimit() {
+    pthread_mutex_destroy(&mLock);
+}
+
+static bool parseNumber(const char *&str, uint32_t &value) {
+    if (!isdigit(*str)) {
+        return false;
+    }
+    char *end;
+    unsigned long v = strtoul(str, &end, 10);
+    if (v > UINT32_MAX) {
+        return false;
+    }
+    value = v;
+    str = end;
+    return true;
+}
+
+int LogRateLimit::init(const char *str) {
+    std::string limit;
+    if (str) {
+        limit = str;
+    } else {
+        char property[PROPERTY_VALUE_MAX];
+        property_get("ro.logd.ratelimit", property, "");
+        limit = property;
+        property_get("persist.logd.ratelimit", property, limit.c_str());
+        limit = property;
+    }
+
+    uint32_t rate = 0;
+    uint32_t burst = 0;
+    uint32_t sample = 0;
+    int rc = 0;
+    str = limit.c_str();
+    if (*str && strcmp(str, "disable")) {
+        if (!parseNumber(str, rate)) {
+            rc = 1;
+        } else if ((*str == ',') && !parseNumber(++str, burst)) {
+            rc = 1;
+        } else if ((*str == ',') && !parseNumber(++str, sample)) {
+            rc = 1;
+        } else if (*str) {
+            rc = 1;
+        }
+    }
+    if (!rc && rate && !burst) {
+        // default to riding out four seconds of spam at full budget
+        burst = 4 * rate;
+    } else if (burst < rate) {
+        // a bucket must hold at least a second's worth
+        rc = 1;
+    }
+    if (rc) {
+        rate = burst = sample = 0;
+    }
+
+    pthread_mutex_lock(&mLock);
+    atomic_store_explicit(&mRate, rate, memory_order_relaxed);
+    mBurst = burst;
+    mSample = sample;
+    forget();
+    pthread_mutex_unlock(&mLock);
+
+    return rc;
+}
+
+// mLock must be held when this function is called.
+void LogRateLimit::refill(Bucket &bucket, uint64_t now) {
+    uint64_t rate = atomic_load_explicit(&mRate, memory_order_relaxed);
+    uint64_t full = (uint64_t)mBurst * nsPerSec;
+    uint64_t elapsed = now - bucket.mRefilled;
+    bucket.mRefilled = now;
+    // long idle, also keeps elapsed * rate from overflowing
+    if (elapsed >= (full / rate)) {
+        bucket.mTokens = full;
+        return;
+    }
+    bucket.mTokens += elapsed * rate;
+    if (bucket.mTokens > full) {
+        bucket.mTokens = full;
+    }
+}
+
+// Forget buckets that have refilled and have nothing left to report.
+//
+// mLock must be held when this function is called.
+void LogRateLimit::evict(uint64_t now) {
+    uint64_t full = (uint64_t)mBurst * nsPerSec;
+    for (BucketMap::iterator it = mBuckets.begin(); it != mBuckets.end();) {
+        Bucket &bucket = it->second;
+        refill(bucket, now);
+        if ((bucket.mTokens >= full) && !bucket.mSuppressed) {
+            it = mBuckets.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    // still all busy, start over rather than grow without bound
+    if (mBuckets.size() >= maxBuckets) {
+        forget();
+    }
+}
+
+// Drop all buckets, keeping what they had suppressed for takeEvicted().
+//
+// mLock must be held when this function is called.
+void LogRateLimit::forget() {
+    for (BucketMap::iterator it = mBuckets.begin(); it != mBuckets.end(); ++it) {
+        if (it->second.mSuppressed) {
+            Evicted evicted;
+            evicted.logId = it->first.logId;
+            evicted.uid = it->first.uid;
+            evicted.tag = it->first.tag;
+            memcpy(evicted.name, it->second.mName, sizeof(evicted.name));
+            evicted.suppressed = it->second.mSuppressed;
+            mEvicted.push_back(evicted);
+        }
+    }
+    mBuckets.clear();
+    if (!mEvicted.empty()) {
+        atomic_store_explicit(&mHaveEvicted, true, memory_order_relaxed);
+    }
+}
+
+void LogRateLimit::takeEvicted(std::vector<Evicted> &evicted) {
+    evicted.clear();
+    pthread_mutex_lock(&mLock);
+    evicted.swap(mEvicted);
+    atomic_store_explicit(&mHaveEvicted, false, memory_order_relaxed);
+    pthread_mutex_unlock(&mLock);
+}
+
+bool LogRateLimit::check(log_id_t log_id, uid_t uid, uint32_t tag,
+                         const char *name, uint32_t &suppressed) {
+    suppressed = 0;
+    if (!enabled()) {
+        return true;
+    }
+
+    uint64_t now = monotonicNs();
+    Key key = { log_id, uid, tag };
+
+    pthread_mutex_lock(&mLock);
+    if (!enabled()) {
+        pthread_mutex_unlock(&mLock);
+        return true;
+    }
+
+    BucketMap::iterator it = mBuckets.find(key);
+    if (it == mBuckets.end()) {
+        if (mBuckets.size() >= maxBuckets) {
+            evict(now);
+        }
+        Bucket fresh = { now, (uint64_t)mBurst * nsPerSec, 0, 0, { '\0' } };
+        if (name) {
+            strncpy(fresh.mName, name, sizeof(fresh.mName) - 1);
+        }
+        it = mBuckets.insert(std::make_pair(key, fresh)).first;
+    } else {
+        refill(it->second, now);
+    }
+
+    Bucket &bucket = it->second;
+    bool pass;
+    if (bucket.mTokens >= nsPerSec) {
+        bucket.mTokens -= nsPerSec;
+        bucket.mExcess = 0;
+        pass = true;
+    } else {
+        // deterministic, every mSample'th line over budget gets through
+        ++bucket.mExcess;
+        pass = mSample && !(bucket.mExcess % mSample);
+    }
+    if (pass) {
+        suppressed = bucket.mSuppressed;
+        bucket.mSuppressed = 0;
+    } else {
+        ++bucket.mSuppressed;
+    }
+    pthread_mutex_unlock(&mLock);
+
+    return pass;
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LOGD_LOG_RATE_LIMIT_H__
+#define _LOGD_LOG_RATE_LIMIT_H__
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <unordered_map>
+#include <vector>
+
+#include <log/log.h>
+
+// Token bucket per log id, UID and tag, checked before a log entry is allocated or
+// accounted. A bucket holds up to burst lines and refills at rate lines
+// per second. Lines beyond that are suppressed, except every sample'th
+// one, and the count of those suppressed is handed back with the next
+// line the bucket lets through so that a summary can be logged. Should
+// a bucket be forgotten first, its count is kept for takeEvicted().
+//
+// Thread safe, log() is called from the listener, LogAudit and LogKlog
+// threads.
+class LogRateLimit {
+public:
+    // of a tag name kept for a summary, longer ones are cut short
+    static const size_t maxNameLen = 32;
+
+    // lines a forgotten bucket had suppressed
+    struct Evicted {
+        log_id_t logId;
+        uid_t uid;
+        uint32_t tag;
+        char name[maxNameLen]; // empty if the tag has none
+        uint32_t suppressed;
+    };
+
+private:
+    struct Key {
+        log_id_t logId;
+        uid_t uid;
+        uint32_t tag;
+
+        bool operator==(const Key &rhs) const {
+            return (logId == rhs.logId) && (uid == rhs.uid)
+                && (tag == rhs.tag);
+        }
+    };
+    struct KeyHash {
+        size_t operator()(const Key &key) const {
+            return std::hash<uint64_t>()(((uint64_t)key.uid << 32)
+                                         ^ key.tag ^ key.logId);
+        }
+    };
+    struct Bucket {
+        uint64_t mRefilled;   // CLOCK_MONOTONIC ns of the last top up
+        uint64_t mTokens;     // lines, in units of 1/nsPerSec
+        uint32_t mExcess;     // lines over budget, for sampling
+        uint32_t mSuppressed; // lines dropped since the last summary
+        char mName[maxNameLen]; // of the tag, for the summary
+    };
+    typedef std::unordered_map<Key, Bucket, KeyHash> BucketMap;
+
+    pthread_mutex_t mLock;
+    BucketMap mBuckets;
+    std::vector<Evicted> mEvicted;
+    atomic_bool mHaveEvicted;
+    // lines per second, 0 when disabled. Changed under mLock, but looked
+    // at without it on the way in.
+    atomic_uint_fast32_t mRate;
+    uint32_t mBurst;
+    uint32_t mSample;
+
+    void refill(Bucket &bucket, uint64_t now);
+    void evict(uint64_t now);
+    void forget();
+
+public:
+    static const uint64_t nsPerSec = 1000000000ULL;
+    // buckets kept before idle ones are swept
+    static const size_t maxBuckets = 1024;
+
+    LogRateLimit();
+    ~LogRateLimit();
+
+    // "<lines per second>[,<burst>[,<sample>]]", NULL for the properties.
+    // A burst below lines per second is rejected.
+    int init(const char *str);
+
+    bool enabled() const {
+        return atomic_load_explicit(&mRate, memory_order_relaxed) != 0;
+    }
+    // false if this line is over budget, else suppressed is set to the
+    // lines dropped since the last one let through for the same key.
+    // name is that of tag, or NULL.
+    bool check(log_id_t log_id, uid_t uid, uint32_t tag, const char *name,
+               uint32_t &suppressed);
+
+    bool haveEvicted() const {
+        return atomic_load_explicit(&mHaveEvicted, memory_order_relaxed);
+    }
+    // Hand over the counts of buckets forgotten with lines suppressed
+    void takeEvicted(std::vector<Evicted> &evicted);
+};
+
+#endif // _LOGD_LOG_RATE_LIMIT_H__
@@ -119,6 +119,13 @@ bool LogReader::onDataAvailable(SocketClient *cli) {
     uint64_t sequence = 1;
     // Convert realtime to sequence number
     if (start != log_time::EPOCH) {
+        bool isMonotonic = logbuf().isMonotonic()
+                        && android::isMonotonic(start);
+        // Skip over what is known to be older, rather than filter it all
+        if (!isMonotonic) {
+            sequence = logbuf().seekTime(start);
+        }
+
         class LogFindStart {
             const pid_t mPid;
             const unsigned mLogMask;
@@ -163,9 +170,7 @@ bool LogReader::onDataAvailable(SocketClient *cli) {
             }
 
             bool found() { return startTimeSet; }
-        } logFindStart(logMask, pid, start, sequence,
-                       logbuf().isMonotonic() && android::isMonotonic(start));
-
+        } logFindStart(logMask, pid, start, sequence, isMonotonic);
         logbuf().flushTo(cli, sequence, FlushCommand::hasReadLogs(cli),
                          FlushCommand::hasSecurityLogs(cli),
                          logFindStart.callback, &logFindStart);
@@ -0,0 +1,360 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include <zlib.h>
+
+#include "LogRing.h"
+
+// On disk layout, native byte order, the file never leaves the device.
+
+static const uint32_t ringMagic = 0x676e6972;    // "ring"
+static const uint32_t ringVersion = 1;
+static const uint32_t segmentMagic = 0x746d6773; // "sgmt"
+
+// First page of the file, segments follow it
+static const size_t headerSize = 4096;
+
+struct RingHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t segmentSize;
+    uint32_t segments;
+};
+
+struct SegmentHeader {
+    uint32_t magic;
+    uint32_t crc;        // of generation
+    uint64_t generation;
+};
+
+struct RingRecord {
+    uint8_t kind;        // kindEnd terminates the segment
+    uint8_t logId;
+    uint16_t len;        // payload bytes that follow
+    uint32_t crc;        // generation, then the record with crc zero
+    uint32_t uid;
+    int32_t pid;
+    int32_t tid;
+    uint32_t sec;
+    uint32_t nsec;
+};
+
+static const size_t recordAlignment = sizeof(uint32_t);
+
+static inline size_t recordSize(size_t len) {
+    return (sizeof(RingRecord) + len + recordAlignment - 1)
+         & ~(recordAlignment - 1);
+}
+
+static uint32_t generationCrc(uint64_t generation) {
+    return crc32(0, reinterpret_cast<const Bytef *>(&generation),
+                 sizeof(generation));
+}
+
+static uint32_t recordCrc(uint64_t generation, const RingRecord *record) {
+    RingRecord copy = *record;
+    copy.crc = 0;
+    uLong crc = generationCrc(generation);
+    crc = crc32(crc, reinterpret_cast<const Bytef *>(&copy), sizeof(copy));
+    return crc32(crc, reinterpret_cast<const Bytef *>(record + 1), copy.len);
+}
+
+// Next valid record at offset in a segment of the given generation, NULL
+// at the end of the segment or at the first record that fails its check.
+static const RingRecord *nextRecord(const char *segment, size_t &offset,
+                                    uint64_t generation) {
+    if ((offset + sizeof(RingRecord)) > LogRing::segmentSize) {
+        return NULL;
+    }
+    const RingRecord *record =
+        reinterpret_cast<const RingRecord *>(segment + offset);
+    if ((record->kind == 0) || (record->logId >= LOG_ID_MAX)
+            || ((offset + recordSize(record->len)) > LogRing::segmentSize)
+            || (record->crc != recordCrc(generation, record))) {
+        return NULL;
+    }
+    offset += recordSize(record->len);
+    return record;
+}
+
+LogRing::LogRing() :
+        mBase(NULL),
+        mSize(0),
+        mSegments(0),
+        mSegment(0),
+        mGeneration(0),
+        mWrite(0),
+        mSynced(0),
+        mAppending(false) {
+}
+
+LogRing::~LogRing() {
+    close();
+}
+
+char *LogRing::segment(size_t index) const {
+    return mBase + headerSize + (index * segmentSize);
+}
+
+int LogRing::open(const char *path, size_t size) {
+    close();
+
+    size_t segments = size / segmentSize;
+    if (segments < minSegments) {
+        segments = minSegments;
+    }
+    size_t fileSize = headerSize + (segments * segmentSize);
+
+    int fd = TEMP_FAILURE_RETRY(::open(path,
+        O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW, S_IRUSR | S_IWUSR
+                                                   | S_IRGRP | S_IWGRP));
+    if (fd < 0) {
+        return -errno;
+    }
+    // Blocks are reserved up front, a store to a hole in a mapping of a
+    // full filesystem would be a SIGBUS.
+    int rc = posix_fallocate(fd, 0, fileSize);
+    if (rc) {
+        ::close(fd);
+        return -rc;
+    }
+    struct stat st;
+    if (!fstat(fd, &st) && ((size_t)st.st_size > fileSize)
+            && ftruncate(fd, fileSize)) {
+        rc = -errno;
+        ::close(fd);
+        return rc;
+    }
+    void *base = mmap(NULL, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      fd, 0);
+    rc = (base == MAP_FAILED) ? -errno : 0;
+    ::close(fd);
+    if (rc) {
+        return rc;
+    }
+
+    mBase = static_cast<char *>(base);
+    mSize = fileSize;
+    mSegments = segments;
+
+    const RingHeader *header = reinterpret_cast<const RingHeader *>(mBase);
+    if ((header->magic != ringMagic) || (header->version != ringVersion)
+            || (header->segmentSize != segmentSize)
+            || (header->segments != segments)) {
+        format();
+    }
+
+    // newest segment, the one a restart continues after
+    mSegment = mSegments - 1;
+    mGeneration = 0;
+    for (size_t i = 0; i < mSegments; ++i) {
+        const SegmentHeader *s =
+            reinterpret_cast<const SegmentHeader *>(segment(i));
+        if ((s->magic == segmentMagic)
+                && (s->crc == generationCrc(s->generation))
+                && (s->generation > mGeneration)) {
+            mGeneration = s->generation;
+            mSegment = i;
+        }
+    }
+    return 0;
+}
+
+void LogRing::format() {
+    for (size_t i = 0; i < mSegments; ++i) {
+        memset(segment(i), 0, sizeof(SegmentHeader) + sizeof(RingRecord));
+    }
+    RingHeader *header = reinterpret_cast<RingHeader *>(mBase);
+    header->magic = ringMagic;
+    header->version = ringVersion;
+    header->segmentSize = segmentSize;
+    header->segments = mSegments;
+    msync(mBase, mSize, MS_SYNC);
+}
+
+void LogRing::close() {
+    if (!mBase) {
+        return;
+    }
+    sync(true);
+    munmap(mBase, mSize);
+    mBase = NULL;
+    mSize = 0;
+    mSegments = 0;
+    mWrite = mSynced = 0;
+    mAppending = false;
+}
+
+size_t LogRing::recover(Replay replay, void *arg) {
+    if (!mBase) {
+        return 0;
+    }
+
+    // valid segments, oldest first
+    std::vector<std::pair<uint64_t, size_t> > order;
+    for (size_t i = 0; i < mSegments; ++i) {
+        const SegmentHeader *s =
+            reinterpret_cast<const SegmentHeader *>(segment(i));
+        if ((s->magic == segmentMagic)
+                && (s->crc == generationCrc(s->generation))) {
+            order.push_back(std::make_pair(s->generation, i));
+        }
+    }
+    std::sort(order.begin(), order.end());
+
+    // First pass finds the last clear of each log id, records before
+    // it are not replayed.
+    uint64_t clearedAt[LOG_ID_MAX] = { 0 };
+    uint64_t ordinal = 0;
+    for (size_t i = 0; i < order.size(); ++i) {
+        const char *s = segment(order[i].second);
+        size_t offset = sizeof(SegmentHeader);
+        const RingRecord *record;
+        while ((record = nextRecord(s, offset, order[i].first))) {
+            ++ordinal;
+            if (record->kind == kindClear) {
+                clearedAt[record->logId] = ordinal;
+            }
+        }
+    }
+
+    size_t replayed = 0;
+    ordinal = 0;
+    for (size_t i = 0; i < order.size(); ++i) {
+        const char *s = segment(order[i].second);
+        size_t offset = sizeof(SegmentHeader);
+        const RingRecord *record;
+        while ((record = nextRecord(s, offset, order[i].first))) {
+            ++ordinal;
+            if ((record->kind != kindLog)
+                    || (ordinal <= clearedAt[record->logId])) {
+                continue;
+            }
+            log_time realtime;
+            realtime.tv_sec = record->sec;
+            realtime.tv_nsec = record->nsec;
+            if ((*replay)(arg, static_cast<log_id_t>(record->logId), realtime,
+                          record->uid, record->pid, record->tid,
+                          reinterpret_cast<const char *>(record + 1),
+                          record->len) >= 0) {
+                ++replayed;
+            }
+        }
+    }
+    return replayed;
+}
+
+void LogRing::start() {
+    if (mBase && !mAppending) {
+        nextSegment();
+        mAppending = true;
+    }
+}
+
+// Retire the current segment and take over the oldest one.
+void LogRing::nextSegment() {
+    sync(false);
+
+    mSegment = (mSegment + 1) % mSegments;
+    ++mGeneration;
+
+    char *s = segment(mSegment);
+    RingRecord *end = reinterpret_cast<RingRecord *>(s + sizeof(SegmentHeader));
+    end->kind = kindEnd;
+    SegmentHeader *header = reinterpret_cast<SegmentHeader *>(s);
+    header->generation = mGeneration;
+    header->crc = generationCrc(mGeneration);
+    header->magic = segmentMagic;
+
+    mWrite = (s - mBase) + sizeof(SegmentHeader);
+    mSynced = s - mBase;
+}
+
+// Ask for the pages appended to since the last call to be written back.
+void LogRing::sync(bool wait) {
+    if (!mBase || (mWrite <= mSynced)) {
+        return;
+    }
+    size_t page = getpagesize();
+    size_t begin = mSynced & ~(page - 1);
+    msync(mBase + begin, mWrite - begin, wait ? MS_SYNC : MS_ASYNC);
+    mSynced = mWrite;
+}
+
+void LogRing::append(uint8_t kind, log_id_t log_id, log_time realtime,
+                     uid_t uid, pid_t pid, pid_t tid,
+                     const struct iovec *vec, size_t count,
+                     unsigned short len) {
+    // oversize payloads are truncated to what a segment can hold
+    static const size_t maxLen = segmentSize - sizeof(SegmentHeader)
+                               - sizeof(RingRecord);
+    if (len > maxLen) {
+        len = maxLen;
+    }
+    size_t size = recordSize(len);
+    size_t segmentEnd = (segment(mSegment) - mBase) + segmentSize;
+    if ((mWrite + size) > segmentEnd) {
+        nextSegment();
+        segmentEnd = (segment(mSegment) - mBase) + segmentSize;
+    }
+
+    RingRecord *record = reinterpret_cast<RingRecord *>(mBase + mWrite);
+    record->logId = log_id;
+    record->len = len;
+    record->crc = 0;
+    record->uid = uid;
+    record->pid = pid;
+    record->tid = tid;
+    record->sec = realtime.tv_sec;
+    record->nsec = realtime.tv_nsec;
+    record->kind = kind;
+
+    char *payload = reinterpret_cast<char *>(record + 1);
+    size_t used = 0;
+    for (size_t i = 0; (i < count) && (used < len); ++i) {
+        size_t n = std::min(vec[i].iov_len, (size_t)(len - used));
+        memcpy(payload + used, vec[i].iov_base, n);
+        used += n;
+    }
+    record->crc = recordCrc(mGeneration, record);
+
+    mWrite += size;
+    if ((mWrite + sizeof(RingRecord)) <= segmentEnd) {
+        reinterpret_cast<RingRecord *>(mBase + mWrite)->kind = kindEnd;
+    }
+
+    if ((mWrite - mSynced) >= syncBytes) {
+        sync(false);
+    }
+}
+
+void LogRing::clear(log_id_t log_id) {
+    if (mAppending) {
+        append(kindClear, log_id, log_time(CLOCK_REALTIME), 0, 0, 0,
+               NULL, 0, 0);
+    }
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LOGD_LOG_RING_H__
+#define _LOGD_LOG_RING_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <log/log.h>
+#include <log/log_read.h>
+
+// Fixed size, memory mapped file that mirrors what is logged, so that the
+// log buffers can be repopulated after logd restarts. The file is a ring
+// of segments, each stamped with an increasing generation as it is
+// (re)started, holding records appended back to back. Every record carries
+// a checksum seeded with its segment's generation, a torn write or a stale
+// record left over from a previous lap fails it and ends the segment.
+// Dirty pages are handed to msync in batches, the page cache already
+// carries a logd crash.
+//
+// Not thread safe, caller must hold mLogElementsLock, except for
+// recover() which must be called before start().
+class LogRing {
+    char *mBase;           // mapping, file header included
+    size_t mSize;          // bytes mapped
+    size_t mSegments;
+    size_t mSegment;       // index of the newest segment
+    uint64_t mGeneration;  // of the newest segment
+    size_t mWrite;         // append offset in the mapping
+    size_t mSynced;        // offset up to which msync has been asked for
+    bool mAppending;
+
+    char *segment(size_t index) const;
+    void format();
+    void nextSegment();
+    void sync(bool wait);
+    void append(uint8_t kind, log_id_t log_id, log_time realtime,
+                uid_t uid, pid_t pid, pid_t tid,
+                const struct iovec *vec, size_t count, unsigned short len);
+
+    // not copyable, owns the mapping
+    LogRing(const LogRing &);
+    void operator=(const LogRing &);
+
+public:
+    static const size_t segmentSize = 64 * 1024;
+    static const size_t minSegments = 4;
+    // msync after this many bytes have been appended
+    static const size_t syncBytes = 32 * 1024;
+
+    typedef int (*Replay)(void *arg, log_id_t log_id, log_time realtime,
+                          uid_t uid, pid_t pid, pid_t tid,
+                          const char *msg, unsigned short len);
+
+    LogRing();
+    ~LogRing();
+
+    // Map path, rounded to size bytes of segments. The content is kept if
+    // the file was laid out for the same size, otherwise it is discarded.
+    int open(const char *path, size_t size);
+    void close();
+    bool isOpen() const { return mBase != NULL; }
+
+    // Hand the records of the previous run to replay, oldest first, less
+    // any that a later clear() covered. Returns the number replayed.
+    size_t recover(Replay replay, void *arg);
+    // Start mirroring, in a new segment past the newest one
+    void start();
+
+    void append(log_id_t log_id, log_time realtime,
+                uid_t uid, pid_t pid, pid_t tid,
+                const struct iovec *vec, size_t count, unsigned short len) {
+        if (mAppending) {
+            append(kindLog, log_id, realtime, uid, pid, tid, vec, count, len);
+        }
+    }
+    // Records of log_id up to now are not to be recovered
+    void clear(log_id_t log_id);
+
+private:
+    static const uint8_t kindEnd = 0;
+    static const uint8_t kindLog = 1;
+    static const uint8_t kindClear = 2;
+};
+
+#endif // _LOGD_LOG_RING_H__
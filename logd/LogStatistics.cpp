@@ -25,11 +25,14 @@
 
 LogStatistics::LogStatistics() : enable(false) {
     log_id_for_each(id) {
+        mOverruns[id] = 0;
         mSizes[id] = 0;
         mElements[id] = 0;
         mDroppedElements[id] = 0;
         mSizesTotal[id] = 0;
         mElementsTotal[id] = 0;
+        mCompressedIn[id] = 0;
+        mCompressedOut[id] = 0;
     }
 }
 
@@ -494,6 +497,59 @@ std::string LogStatistics::format(uid_t uid, pid_t pid,
         spaces += spaces_total;
     }
 
+    bool compressed = false;
+    log_id_for_each(id) {
+        compressed |= (logMask & (1 << id)) && mCompressedIn[id];
+    }
+    if (compressed) {
+        spaces = 3;
+        output += "\nPacked";
+
+        log_id_for_each(id) {
+            if (!(logMask & (1 << id))) {
+                continue;
+            }
+
+            if (mCompressedIn[id]) {
+                oldLength = output.length();
+                if (spaces < 0) {
+                    spaces = 0;
+                }
+                output += android::base::StringPrintf("%*s%zu/%zu", spaces, "",
+                                                      mCompressedOut[id],
+                                                      mCompressedIn[id]);
+                spaces -= output.length() - oldLength;
+            }
+            spaces += spaces_total;
+        }
+    }
+
+    bool overrun = false;
+    log_id_for_each(id) {
+        overrun |= (logMask & (1 << id)) && mOverruns[id];
+    }
+    if (overrun) {
+        spaces = 2;
+        output += "\nOverrun";
+
+        log_id_for_each(id) {
+            if (!(logMask & (1 << id))) {
+                continue;
+            }
+
+            if (mOverruns[id]) {
+                oldLength = output.length();
+                if (spaces < 0) {
+                    spaces = 0;
+                }
+                output += android::base::StringPrintf("%*s%zu", spaces, "",
+                                                      mOverruns[id]);
+                spaces -= output.length() - oldLength;
+            }
+            spaces += spaces_total;
+        }
+    }
+
     // Report on Chattiest
 
     std::string name;
@@ -565,17 +621,118 @@ uid_t pidToUid(pid_t pid) {
 
 }
 
+// A pid not seen before has its uid read from /proc, once
 uid_t LogStatistics::pidToUid(pid_t pid) {
-    return pidTable.add(pid)->second.getUid();
+    pidTable_t::iterator found = pidTable.find(pid);
+    if (found != pidTable.end()) {
+        return found->second.getUid();
+    }
+    return pidTable.add(pid, android::pidToUid(pid))->second.getUid();
 }
 
 // caller must free character string
 const char *LogStatistics::pidToName(pid_t pid) const {
     // An inconvenient truth ... getName() can alter the object
     pidTable_t &writablePidTable = const_cast<pidTable_t &>(pidTable);
-    const char *name = writablePidTable.add(pid)->second.getName();
+    pidTable_t::iterator found = writablePidTable.find(pid);
+    if (found == writablePidTable.end()) {
+        found = writablePidTable.add(pid, android::pidToUid(pid));
+    }
+    PidEntry &entry = found->second;
+    entry.resolve();
+    const char *name = entry.getName();
     if (!name) {
         return NULL;
     }
     return strdup(name);
 }
+
+void LogStatistics::pendingNames(nameList_t &pids, nameList_t &tids) const {
+    for (pidTable_t::const_iterator it = pidTable.begin();
+            it != pidTable.end(); ++it) {
+        if (!it->second.isNamed()) {
+            pids.push_back(std::make_pair(it->first, (char *)NULL));
+        }
+    }
+    log_id_for_each(id) {
+        for (pidSystemTable_t::const_iterator it = pidSystemTable[id].begin();
+                it != pidSystemTable[id].end(); ++it) {
+            if (!it->second.isNamed()) {
+                pids.push_back(std::make_pair(it->first, (char *)NULL));
+            }
+        }
+    }
+    std::sort(pids.begin(), pids.end());
+    pids.erase(std::unique(pids.begin(), pids.end()), pids.end());
+
+    for (tidTable_t::const_iterator it = tidTable.begin();
+            it != tidTable.end(); ++it) {
+        if (!it->second.isNamed()) {
+            tids.push_back(std::make_pair(it->first, (char *)NULL));
+        }
+    }
+}
+
+// No name for a pid that is still about (eg: "<pre-initialized>") is
+// dropped from the list, to be tried again. That of one that is gone is
+// kept, NULL, so it is not looked for again.
+static void keepFound(LogStatistics::nameList_t &list) {
+    LogStatistics::nameList_t::iterator keep = list.begin();
+    for (LogStatistics::nameList_t::iterator it = list.begin();
+            it != list.end(); ++it) {
+        if (!it->second) {
+            char path[32];
+            snprintf(path, sizeof(path), "/proc/%u", it->first);
+            if (!access(path, F_OK)) {
+                continue;
+            }
+        }
+        *keep++ = *it;
+    }
+    list.erase(keep, list.end());
+}
+
+void LogStatistics::lookupNames(nameList_t &pids, nameList_t &tids) {
+    for (nameList_t::iterator it = pids.begin(); it != pids.end(); ++it) {
+        it->second = android::pidToName(it->first);
+    }
+    keepFound(pids);
+    for (nameList_t::iterator it = tids.begin(); it != tids.end(); ++it) {
+        it->second = android::tidToName(it->first);
+    }
+    keepFound(tids);
+}
+
+// Entries may have come and gone since pendingNames(), only those that
+// are still about are named.
+void LogStatistics::setNames(nameList_t &pids, nameList_t &tids) {
+    for (nameList_t::iterator it = pids.begin(); it != pids.end(); ++it) {
+        pid_t pid = it->first;
+        char *name = it->second;
+        it->second = NULL;
+
+        log_id_for_each(id) {
+            pidSystemTable_t::iterator found = pidSystemTable[id].find(pid);
+            if (found != pidSystemTable[id].end()) {
+                found->second.setName(name ? strdup(name) : NULL);
+            }
+        }
+        pidTable_t::iterator found = pidTable.find(pid);
+        if (found != pidTable.end()) {
+            found->second.setName(name);
+        } else {
+            free(name);
+        }
+    }
+    for (nameList_t::iterator it = tids.begin(); it != tids.end(); ++it) {
+        char *name = it->second;
+        it->second = NULL;
+
+        tidTable_t::iterator found = tidTable.find(it->first);
+        if (found != tidTable.end()) {
+            found->second.setName(name);
+        } else {
+            free(name);
+        }
+    }
+}
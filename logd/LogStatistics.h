@@ -24,6 +24,8 @@
 #include <algorithm> // std::max
 #include <string>    // std::string
 #include <unordered_map>
+#include <utility>   // std::pair
+#include <vector>
 
 #include <android-base/stringprintf.h>
 #include <log/log.h>
@@ -95,10 +97,10 @@ public:
         return it;
     }
 
-    inline iterator add(TKey key) {
+    inline iterator add(TKey key, uid_t uid) {
         iterator it = map.find(key);
         if (it == map.end()) {
-            it = map.insert(std::make_pair(key, TEntry(key))).first;
+            it = map.insert(std::make_pair(key, TEntry(key, uid))).first;
         } else {
             it->second.add(key);
         }
@@ -119,6 +121,8 @@ public:
         }
     }
 
+    inline iterator find(TKey key) { return map.find(key); }
+
     inline iterator begin() { return map.begin(); }
     inline const_iterator begin() const { return map.begin(); }
     inline iterator end() { return map.end(); }
@@ -251,28 +255,35 @@ namespace android {
 uid_t pidToUid(pid_t pid);
 }
 
+// Names are read from /proc, far too slow for the logging path. Entries
+// only note that their name is due a (re)read, see resolve() and
+// LogStatistics::setNames(). That of a pid that is gone stays NULL.
 struct PidEntry : public EntryBaseDropped {
     const pid_t pid;
     uid_t uid;
     char *name;
+    bool named;
 
-    PidEntry(pid_t pid):
+    PidEntry(pid_t pid, uid_t uid):
             EntryBaseDropped(),
             pid(pid),
-            uid(android::pidToUid(pid)),
-            name(android::pidToName(pid)) {
+            uid(uid),
+            name(NULL),
+            named(false) {
     }
     PidEntry(LogBufferElement *element):
             EntryBaseDropped(element),
             pid(element->getPid()),
             uid(element->getUid()),
-            name(android::pidToName(pid)) {
+            name(NULL),
+            named(false) {
     }
     PidEntry(const PidEntry &element):
             EntryBaseDropped(element),
             pid(element.pid),
             uid(element.uid),
-            name(element.name ? strdup(element.name) : NULL) {
+            name(element.name ? strdup(element.name) : NULL),
+            named(element.named) {
     }
     ~PidEntry() { free(name); }
 
@@ -280,14 +291,23 @@ struct PidEntry : public EntryBaseDropped {
     const pid_t&getPid() const { return getKey(); }
     const uid_t&getUid() const { return uid; }
     const char*getName() const { return name; }
+    bool isNamed() const { return named; }
 
-    inline void add(pid_t newPid) {
-        if (name && !fast<strncmp>(name, "zygote", 6)) {
-            free(name);
-            name = NULL;
+    // takes ownership of newName
+    void setName(char *newName) {
+        free(name);
+        name = newName;
+        named = true;
+    }
+    void resolve() {
+        if (!named) {
+            setName(android::pidToName(pid));
         }
-        if (!name) {
-            name = android::pidToName(newPid);
+    }
+
+    inline void add(pid_t /* newPid */) {
+        if (name && !fast<strncmp>(name, "zygote", 6)) {
+            named = false;
         }
     }
 
@@ -295,8 +315,7 @@ struct PidEntry : public EntryBaseDropped {
         uid_t incomingUid = element->getUid();
         if (getUid() != incomingUid) {
             uid = incomingUid;
-            free(name);
-            name = android::pidToName(element->getPid());
+            named = false;
         } else {
             add(element->getPid());
         }
@@ -312,27 +331,23 @@ struct TidEntry : public EntryBaseDropped {
     pid_t pid;
     uid_t uid;
     char *name;
+    bool named;
 
-    TidEntry(pid_t tid, pid_t pid):
-            EntryBaseDropped(),
-            tid(tid),
-            pid(pid),
-            uid(android::pidToUid(tid)),
-            name(android::tidToName(tid)) {
-    }
     TidEntry(LogBufferElement *element):
             EntryBaseDropped(element),
             tid(element->getTid()),
             pid(element->getPid()),
             uid(element->getUid()),
-            name(android::tidToName(tid)) {
+            name(NULL),
+            named(false) {
     }
     TidEntry(const TidEntry &element):
             EntryBaseDropped(element),
             tid(element.tid),
             pid(element.pid),
             uid(element.uid),
-            name(element.name ? strdup(element.name) : NULL) {
+            name(element.name ? strdup(element.name) : NULL),
+            named(element.named) {
     }
     ~TidEntry() { free(name); }
 
@@ -341,14 +356,18 @@ struct TidEntry : public EntryBaseDropped {
     const pid_t&getPid() const { return pid; }
     const uid_t&getUid() const { return uid; }
     const char*getName() const { return name; }
+    bool isNamed() const { return named; }
+
+    // takes ownership of newName
+    void setName(char *newName) {
+        free(name);
+        name = newName;
+        named = true;
+    }
 
-    inline void add(pid_t incomingTid) {
+    inline void add(pid_t /* incomingTid */) {
         if (name && !fast<strncmp>(name, "zygote", 6)) {
-            free(name);
-            name = NULL;
-        }
-        if (!name) {
-            name = android::tidToName(incomingTid);
+            named = false;
         }
     }
 
@@ -358,8 +377,7 @@ struct TidEntry : public EntryBaseDropped {
         if ((getUid() != incomingUid) || (getPid() != incomingPid)) {
             uid = incomingUid;
             pid = incomingPid;
-            free(name);
-            name = android::tidToName(element->getTid());
+            named = false;
         } else {
             add(element->getTid());
         }
@@ -410,6 +428,12 @@ class LogStatistics {
     size_t mDroppedElements[LOG_ID_MAX];
     size_t mSizesTotal[LOG_ID_MAX];
     size_t mElementsTotal[LOG_ID_MAX];
+    // payload bytes held compressed, and what they were compressed to
+    size_t mCompressedIn[LOG_ID_MAX];
+    size_t mCompressedOut[LOG_ID_MAX];
+    // datagrams lost to a full logdw socket, as reported by liblog in the
+    // events log, and for security alone in the security log
+    size_t mOverruns[LOG_ID_MAX];
     bool enable;
 
     // uid to size list
@@ -460,6 +484,14 @@ public:
         return pidSystemTable[id].sort(uid, pid, len);
     }
 
+    // reported by the log buffer as chunks are (un)compressed
+    void compressed(log_id_t id, size_t in, size_t out) {
+        mCompressedIn[id] = in;
+        mCompressedOut[id] = out;
+    }
+
+    void overrun(log_id_t id, size_t count) { mOverruns[id] += count; }
+
     // fast track current value by id only
     size_t sizes(log_id_t id) const { return mSizes[id]; }
     size_t elements(log_id_t id) const { return mElements[id]; }
@@ -471,6 +503,13 @@ public:
 
     std::string format(uid_t uid, pid_t pid, unsigned int logMask) const;
 
+    // Pid and tid names due a lookup, done by lookupNames() without any
+    // lock held, then handed back to setNames() to take ownership of.
+    typedef std::vector<std::pair<pid_t, char *>> nameList_t;
+    void pendingNames(nameList_t &pids, nameList_t &tids) const;
+    static void lookupNames(nameList_t &pids, nameList_t &tids);
+    void setNames(nameList_t &pids, nameList_t &tids);
+
     // helper (must be locked directly or implicitly by mLogElementsLock)
     const char *pidToName(pid_t pid) const;
     uid_t pidToUid(pid_t pid);
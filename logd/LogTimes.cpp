@@ -14,8 +14,16 @@
  * limitations under the License.
  */
 
+#include <endian.h>
 #include <errno.h>
+#include <stdio.h>
+#include <string.h>
 #include <sys/prctl.h>
+#include <unistd.h>
+
+#include <log/logger.h>
+#include <private/android_filesystem_config.h>
+#include <private/android_logger.h>
 
 #include "FlushCommand.h"
 #include "LogBuffer.h"
@@ -36,6 +44,8 @@ LogTimeEntry::LogTimeEntry(LogReader &reader, SocketClient *client,
         mReader(reader),
         mLogMask(logMask),
         mPid(pid),
+        mPrivileged(false),
+        mSecurity(false),
         mCount(0),
         mTail(tail),
         mIndex(0),
@@ -46,7 +56,9 @@ LogTimeEntry::LogTimeEntry(LogReader &reader, SocketClient *client,
     mTimeout.tv_sec = timeout / NS_PER_SEC;
     mTimeout.tv_nsec = timeout % NS_PER_SEC;
     pthread_cond_init(&threadTriggeredCondition, NULL);
-    cleanSkip_Locked();
+    for (log_id_t i = LOG_ID_MIN; i < LOG_ID_MAX; i = (log_id_t) (i + 1)) {
+        mSkipped[i] = 0;
+    }
 }
 
 void LogTimeEntry::startReader_Locked(void) {
@@ -132,6 +144,9 @@ void *LogTimeEntry::threadStart(void *obj) {
 
     lock();
 
+    me->mPrivileged = privileged;
+    me->mSecurity = security;
+
     uint64_t start = me->mStart;
 
     while (me->threadRunning && !me->isError_Locked()) {
@@ -148,13 +163,31 @@ void *LogTimeEntry::threadStart(void *obj) {
             }
         }
 
+        unsigned long skipped[LOG_ID_MAX];
+        log_time skippedTime[LOG_ID_MAX];
+        for (log_id_t i = LOG_ID_MIN; i < LOG_ID_MAX; i = (log_id_t) (i + 1)) {
+            skipped[i] = me->mSkipped[i];
+            skippedTime[i] = me->mSkippedTime[i];
+            me->mSkipped[i] = 0;
+        }
+
         unlock();
 
-        if (me->mTail) {
-            logbuf.flushTo(client, start, privileged, security, FilterFirstPass, me);
-            me->leadingDropped = true;
+        if (!flushSkipped(client, skipped, skippedTime, privileged)) {
+            start = LogBufferElement::FLUSH_ERROR;
+        } else {
+            if (me->mTail) {
+                // Count only what is near enough the end to matter
+                start = logbuf.seekTail(start, me->mTail, me->mLogMask,
+                                        me->mPid, client->getUid(),
+                                        privileged, security);
+                logbuf.flushTo(client, start, privileged, security,
+                               FilterFirstPass, me);
+                me->leadingDropped = true;
+            }
+            start = logbuf.flushTo(client, start, privileged, security,
+                                   FilterSecondPass, me);
         }
-        start = logbuf.flushTo(client, start, privileged, security, FilterSecondPass, me);
 
         lock();
 
@@ -169,8 +202,6 @@ void *LogTimeEntry::threadStart(void *obj) {
             break;
         }
 
-        me->cleanSkip_Locked();
-
         if (!me->mTimeout.tv_sec && !me->mTimeout.tv_nsec) {
             pthread_cond_wait(&me->threadTriggeredCondition, &timesLock);
         }
@@ -219,11 +250,6 @@ int LogTimeEntry::FilterSecondPass(const LogBufferElement *element, void *obj) {
 
     me->mStart = element->getSequence();
 
-    if (me->skipAhead[element->getLogId()]) {
-        me->skipAhead[element->getLogId()]--;
-        goto skip;
-    }
-
     if (me->leadingDropped) {
         if (element->getDropped()) {
             goto skip;
@@ -263,11 +289,8 @@ int LogTimeEntry::FilterSecondPass(const LogBufferElement *element, void *obj) {
     }
 
 ok:
-    if (!me->skipAhead[element->getLogId()]) {
-        LogTimeEntry::unlock();
-        return true;
-    }
-    // FALLTHRU
+    LogTimeEntry::unlock();
+    return true;
 
 skip:
     LogTimeEntry::unlock();
@@ -278,8 +301,88 @@ stop:
     return -1;
 }
 
-void LogTimeEntry::cleanSkip_Locked(void) {
+void LogTimeEntry::skip_Locked(const LogBufferElement *element) {
+    log_id_t id = element->getLogId();
+
+    if (!isWatching(id) || (mPid && (mPid != element->getPid()))) {
+        return;
+    }
+    // Not owed anything ahead of the tail it has yet to reach
+    if (mTail) {
+        return;
+    }
+    if (!mPrivileged && (element->getUid() != mClient->getUid())) {
+        return;
+    }
+    if ((id == LOG_ID_SECURITY) && !mSecurity) {
+        return;
+    }
+
+    ++mSkipped[id];
+    mSkippedTime[id] = element->getRealTime();
+}
+
+// A synthetic entry telling the reader how many entries of log id it
+// missed, in place of them. Returns false if the reader is gone.
+bool LogTimeEntry::flushSkipped(SocketClient *client, log_id_t id,
+                                unsigned long skipped, log_time realtime,
+                                bool privileged) {
+    static const char tag[] = "logd";
+    static const char format[] = "reader fell behind, %lu entr%s skipped";
+
+    char message[64];
+    size_t len = snprintf(message, sizeof(message), format, skipped,
+                          (skipped > 1) ? "ies" : "y");
+
+    char buffer[sizeof(android_log_event_string_t) + sizeof(message)];
+    size_t hdrLen;
+    if ((id == LOG_ID_EVENTS) || (id == LOG_ID_SECURITY)) {
+        android_log_event_string_t *event =
+            reinterpret_cast<android_log_event_string_t *>(buffer);
+
+        event->header.tag = htole32(LOGD_LOG_TAG);
+        event->type = EVENT_TYPE_STRING;
+        event->length = htole32(len);
+        hdrLen = sizeof(android_log_event_string_t);
+    } else {
+        buffer[0] = ANDROID_LOG_INFO;
+        strcpy(buffer + 1, tag);
+        hdrLen = 1 + sizeof(tag);
+        ++len; // nul terminated
+    }
+    memcpy(buffer + hdrLen, message, len);
+
+    struct logger_entry_v4 entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.hdr_size = privileged ?
+                         sizeof(struct logger_entry_v4) :
+                         sizeof(struct logger_entry_v3);
+    entry.len = hdrLen + len;
+    entry.lid = id;
+    entry.pid = getpid();
+    entry.tid = gettid();
+    entry.uid = AID_LOGD;
+    entry.sec = realtime.tv_sec;
+    entry.nsec = realtime.tv_nsec;
+
+    struct iovec iovec[2];
+    iovec[0].iov_base = &entry;
+    iovec[0].iov_len = entry.hdr_size;
+    iovec[1].iov_base = buffer;
+    iovec[1].iov_len = entry.len;
+
+    return !client->sendDatav(iovec, 2);
+}
+
+bool LogTimeEntry::flushSkipped(SocketClient *client,
+                                const unsigned long skipped[LOG_ID_MAX],
+                                const log_time skippedTime[LOG_ID_MAX],
+                                bool privileged) {
     for (log_id_t i = LOG_ID_MIN; i < LOG_ID_MAX; i = (log_id_t) (i + 1)) {
-        skipAhead[i] = 0;
+        if (skipped[i] && !flushSkipped(client, i, skipped[i],
+                                        skippedTime[i], privileged)) {
+            return false;
+        }
     }
+    return true;
 }
@@ -41,9 +41,21 @@ class LogTimeEntry {
     LogReader &mReader;
     static void *threadStart(void *me);
     static void threadStop(void *me);
+    static bool flushSkipped(SocketClient *client, log_id_t id,
+                             unsigned long skipped, log_time realtime,
+                             bool privileged);
+    static bool flushSkipped(SocketClient *client,
+                             const unsigned long skipped[LOG_ID_MAX],
+                             const log_time skippedTime[LOG_ID_MAX],
+                             bool privileged);
     const unsigned int mLogMask;
     const pid_t mPid;
-    unsigned int skipAhead[LOG_ID_MAX];
+    bool mPrivileged;
+    bool mSecurity;
+    // entries pruned before this reader got to them, and the time of the
+    // most recent, reported and reset each time the reader is run
+    unsigned long mSkipped[LOG_ID_MAX];
+    log_time mSkippedTime[LOG_ID_MAX];
     unsigned long mCount;
     unsigned long mTail;
     unsigned long mIndex;
@@ -72,8 +84,8 @@ public:
         pthread_cond_signal(&threadTriggeredCondition);
     }
 
-    void triggerSkip_Locked(log_id_t id, unsigned int skip) { skipAhead[id] = skip; }
-    void cleanSkip_Locked(void);
+    // element is being pruned from under this reader
+    void skip_Locked(const LogBufferElement *element);
 
     // These called after LogTimeEntry removed from list, lock implicitly held
     void release_nodelete_Locked(void) {
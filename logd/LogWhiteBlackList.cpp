@@ -50,6 +50,24 @@ std::string Prune::format() {
     return std::string("/");
 }
 
+void PruneTable::compile(const PruneCollection &list) {
+    mUids.clear();
+    mPids.clear();
+    mUidPids.clear();
+    for (PruneCollection::const_iterator it = list.begin();
+            it != list.end(); ++it) {
+        uid_t uid = (*it).getUid();
+        pid_t pid = (*it).getPid();
+        if (pid == Prune::pid_all) {
+            mUids.insert(uid);
+        } else if (uid == Prune::uid_all) {
+            mPids.insert(pid);
+        } else {
+            mUidPids.insert(key(uid, pid));
+        }
+    }
+}
+
 PruneList::PruneList() {
     init(NULL);
 }
@@ -113,6 +131,7 @@ int PruneList::init(const char *str) {
     mWorstUidEnabled = false;
     mWorstPidOfSystemEnabled = false;
 
+    int rc = 0;
     for(str = filter.c_str(); *str; ++str) {
         if (isspace(*str)) {
             continue;
@@ -129,7 +148,8 @@ int PruneList::init(const char *str) {
                     break;
                 }
                 if (!isspace(*str)) {
-                    return 1;
+                    rc = 1;
+                    break;
                 }
                 continue;
             }
@@ -142,12 +162,14 @@ int PruneList::init(const char *str) {
                     break;
                 }
                 if (!isspace(*str)) {
-                    return 1;
+                    rc = 1;
+                    break;
                 }
                 continue;
             }
             if (!*str) {
-                return 1;
+                rc = 1;
+                break;
             }
             list = &mNaughty;
         } else {
@@ -174,11 +196,13 @@ int PruneList::init(const char *str) {
         }
 
         if ((uid == Prune::uid_all) && (pid == Prune::pid_all)) {
-            return 1;
+            rc = 1;
+            break;
         }
 
         if (*str && !isspace(*str)) {
-            return 1;
+            rc = 1;
+            break;
         }
 
         // insert sequentially into list
@@ -212,7 +236,10 @@ int PruneList::init(const char *str) {
         }
     }
 
-    return 0;
+    mNaughtyTable.compile(mNaughty);
+    mNiceTable.compile(mNice);
+
+    return rc;
 }
 
 std::string PruneList::format() {
@@ -246,26 +273,10 @@ std::string PruneList::format() {
     return string;
 }
 
-// ToDo: Lists are in sorted order, Prune->cmp() returns + or -
-// If there is scaling issues, resort to a better algorithm than linear
-// based on these assumptions.
-
 bool PruneList::naughty(LogBufferElement *element) {
-    PruneCollection::iterator it;
-    for (it = mNaughty.begin(); it != mNaughty.end(); ++it) {
-        if (!(*it).cmp(element)) {
-            return true;
-        }
-    }
-    return false;
+    return mNaughtyTable.match(element->getUid(), element->getPid());
 }
 
 bool PruneList::nice(LogBufferElement *element) {
-    PruneCollection::iterator it;
-    for (it = mNice.begin(); it != mNice.end(); ++it) {
-        if (!(*it).cmp(element)) {
-            return true;
-        }
-    }
-    return false;
+    return mNiceTable.match(element->getUid(), element->getPid());
 }
@@ -17,10 +17,12 @@
 #ifndef _LOGD_LOG_WHITE_BLACK_LIST_H__
 #define _LOGD_LOG_WHITE_BLACK_LIST_H__
 
+#include <stdint.h>
 #include <sys/types.h>
 
 #include <list>
 #include <string.h>
+#include <unordered_set>
 
 #include "LogBufferElement.h"
 
@@ -49,9 +51,33 @@ public:
 
 typedef std::list<Prune> PruneCollection;
 
+// A PruneCollection compiled into hashed lookups, one per rule form,
+// so that a match costs the same however many rules there are.
+class PruneTable {
+    std::unordered_set<uid_t> mUids;       // uid
+    std::unordered_set<pid_t> mPids;       // /pid
+    std::unordered_set<uint64_t> mUidPids; // uid/pid
+
+    static uint64_t key(uid_t uid, pid_t pid) {
+        return ((uint64_t)uid << 32) | (uint32_t)pid;
+    }
+
+public:
+    void compile(const PruneCollection &list);
+
+    bool match(uid_t uid, pid_t pid) const {
+        return (!mUids.empty() && mUids.count(uid))
+            || (!mPids.empty() && mPids.count(pid))
+            || (!mUidPids.empty() && mUidPids.count(key(uid, pid)));
+    }
+};
+
 class PruneList {
     PruneCollection mNaughty;
     PruneCollection mNice;
+    // Rebuilt from the above each time init() runs
+    PruneTable mNaughtyTable;
+    PruneTable mNiceTable;
     bool mWorstUidEnabled;
     bool mWorstPidOfSystemEnabled;
 
@@ -272,6 +272,7 @@ static void *reinit_thread_start(void * /*obj*/) {
         if (logBuf) {
             logBuf->init();
             logBuf->initPrune(NULL);
+            logBuf->initRateLimit(NULL);
         }
     }
 
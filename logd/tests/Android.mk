@@ -23,6 +23,49 @@ LOCAL_PATH := $(call my-dir)
 test_module_prefix := logd-
 test_tags := tests
 
+# Same as ../Android.mk
+event_flag := -DAUDITD_LOG_TAG=1003 -DLOGD_LOG_TAG=1004
+
+benchmark_c_flags := \
+    -I$(LOCAL_PATH)/../../liblog/tests \
+    -Wall -Wextra \
+    -Werror \
+    -fno-builtin \
+    -std=gnu++11 \
+    $(event_flag)
+
+# The parts of logd that the benchmarks and unit tests drive directly
+logd_src_files := \
+    ../LogCommand.cpp \
+    ../LogReader.cpp \
+    ../FlushCommand.cpp \
+    ../LogBuffer.cpp \
+    ../LogBufferArena.cpp \
+    ../LogBufferElement.cpp \
+    ../LogRateLimit.cpp \
+    ../LogRing.cpp \
+    ../LogTimes.cpp \
+    ../LogStatistics.cpp \
+    ../LogWhiteBlackList.cpp \
+    ../libaudit.c \
+    ../LogAudit.cpp \
+    ../LogKlog.cpp
+
+benchmark_src_files := \
+    ../../liblog/tests/benchmark_main.cpp \
+    logd_benchmark.cpp \
+    $(logd_src_files)
+
+# Build benchmarks for the device. Run with:
+#   adb shell /data/nativetest/logd-benchmarks/logd-benchmarks
+include $(CLEAR_VARS)
+LOCAL_MODULE := $(test_module_prefix)benchmarks
+LOCAL_MODULE_TAGS := $(test_tags)
+LOCAL_CFLAGS += $(benchmark_c_flags)
+LOCAL_SHARED_LIBRARIES += libsysutils liblog libcutils libbase libpackagelistparser libz
+LOCAL_SRC_FILES := $(benchmark_src_files)
+include $(BUILD_NATIVE_TEST)
+
 # -----------------------------------------------------------------------------
 # Unit tests.
 # -----------------------------------------------------------------------------
@@ -33,9 +76,11 @@ test_c_flags := \
     -Wall -Wextra \
     -Werror \
     -fno-builtin \
+    $(event_flag)
 
 test_src_files := \
-    logd_test.cpp
+    logd_test.cpp \
+    $(logd_src_files)
 
 # Build tests for the logger. Run with:
 #   adb shell /data/nativetest/logd-unit-tests/logd-unit-tests
@@ -43,6 +88,6 @@ include $(CLEAR_VARS)
 LOCAL_MODULE := $(test_module_prefix)unit-tests
 LOCAL_MODULE_TAGS := $(test_tags)
 LOCAL_CFLAGS += $(test_c_flags)
-LOCAL_SHARED_LIBRARIES := libbase libcutils liblog
+LOCAL_SHARED_LIBRARIES := libbase libcutils liblog libsysutils libpackagelistparser libz
 LOCAL_SRC_FILES := $(test_src_files)
 include $(BUILD_NATIVE_TEST)
@@ -0,0 +1,672 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <new>
+
+#include <log/log.h>
+#include <log/logger.h>
+
+#include "benchmark.h"
+
+#include "../LogAudit.h"
+#include "../LogBuffer.h"
+#include "../LogKlog.h"
+#include "../LogReader.h"
+#include "../LogTimes.h"
+#include "../LogUtils.h"
+#include "../LogWhiteBlackList.h"
+
+// Drive the logd LogBuffer in-process, no sockets or daemon involved.
+
+// Furnished in main.cpp for logd, stand-ins here.
+bool property_get_bool(const char * /*key*/, int flag) {
+    return (flag & BOOL_DEFAULT_FLAG_TRUE_FALSE) != 0;
+}
+
+char *android::uidToName(uid_t /*uid*/) {
+    return NULL;
+}
+
+const char *android::tagToName(uint32_t /*tag*/) {
+    return NULL;
+}
+
+static LastLogTimes *times;
+static LogBuffer *logbuf;
+static LogReader *reader; // never started, LogTimeEntry wants one
+
+static LogBuffer &getLogBuffer() {
+    if (!logbuf) {
+        times = new LastLogTimes();
+        logbuf = new LogBuffer(times);
+        reader = new LogReader(logbuf);
+    }
+    return *logbuf;
+}
+
+// Heap traffic of the code under test. Only C++ allocations are seen,
+// records in the LogBufferArena are mmap'd and are not heap traffic.
+static std::atomic<uint64_t> allocations;
+static std::atomic<uint64_t> allocatedBytes;
+
+void *operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    void *p = malloc(size ? size : 1);
+    if (!p) {
+        abort();
+    }
+    return p;
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    free(p);
+}
+
+static uint64_t nanoTime() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return static_cast<uint64_t>(t.tv_sec) * 1000000000ULL + t.tv_nsec;
+}
+
+// Operations per second and allocations per operation of the last (and
+// longest) run of each benchmark, reported on the way out so that they do
+// not interleave with the ns per iteration table.
+struct Measurement {
+    const char *name;
+    uint64_t ops;
+    uint64_t ns;
+    uint64_t allocations;
+    uint64_t bytes;
+};
+
+static Measurement measurements[32];
+static size_t measured;
+
+static uint64_t measureStartNs;
+static uint64_t measureStartAllocations;
+static uint64_t measureStartBytes;
+
+// Report resident set high watermark, the element store dominates the RSS
+// of this process.
+static void reportRss() {
+    FILE *fp = fopen("/proc/self/status", "r");
+    if (!fp) {
+        return;
+    }
+    char buffer[256];
+    while (fgets(buffer, sizeof(buffer), fp)) {
+        if (!strncmp(buffer, "VmHWM:", 6) || !strncmp(buffer, "VmRSS:", 6)) {
+            fprintf(stderr, "%s", buffer);
+        }
+    }
+    fclose(fp);
+}
+
+static void report() {
+    fprintf(stderr, "%-32s %12s %10s %10s\n",
+            "", "ops/s", "allocs/op", "bytes/op");
+    for (size_t i = 0; i < measured; ++i) {
+        Measurement &m = measurements[i];
+        if (!m.ops || !m.ns) {
+            continue;
+        }
+        fprintf(stderr, "%-32s %12.0f %10.2f %10.1f\n", m.name,
+                m.ops * 1e9 / m.ns,
+                static_cast<double>(m.allocations) / m.ops,
+                static_cast<double>(m.bytes) / m.ops);
+    }
+    reportRss();
+}
+
+// Bracket the timed section of a benchmark, in place of Start and
+// StopBenchmarkTiming, to have it show up in the exit report.
+static void startMeasure() {
+    static bool registered;
+    if (!registered) {
+        atexit(report);
+        registered = true;
+    }
+    measureStartAllocations = allocations.load(std::memory_order_relaxed);
+    measureStartBytes = allocatedBytes.load(std::memory_order_relaxed);
+    measureStartNs = nanoTime();
+    StartBenchmarkTiming();
+}
+
+static void stopMeasure(const char *name, uint64_t ops) {
+    StopBenchmarkTiming();
+    uint64_t ns = nanoTime() - measureStartNs;
+    uint64_t allocs = allocations.load(std::memory_order_relaxed)
+                    - measureStartAllocations;
+    uint64_t bytes = allocatedBytes.load(std::memory_order_relaxed)
+                   - measureStartBytes;
+
+    size_t i = 0;
+    while ((i < measured) && strcmp(measurements[i].name, name)) {
+        ++i;
+    }
+    if (i >= (sizeof(measurements) / sizeof(measurements[0]))) {
+        return;
+    }
+    if (i == measured) {
+        ++measured;
+    }
+    measurements[i].name = name;
+    measurements[i].ops = ops;
+    measurements[i].ns = ns;
+    measurements[i].allocations = allocs;
+    measurements[i].bytes = bytes;
+}
+
+// A synthetic producer, a handful of UIDs, PIDs and TIDs, with a spread of
+// message lengths somewhat representative of the main log buffer.
+static unsigned short synthesize(char *buffer, size_t len, int i) {
+    static const char *tags[] = {
+        "ActivityManager", "chatty", "NetworkController", "BM_log_buffer",
+    };
+    buffer[0] = ANDROID_LOG_INFO;
+    size_t tagLen = strlcpy(buffer + 1, tags[i % 4], len - 1) + 1;
+    int n = snprintf(buffer + 1 + tagLen, len - 1 - tagLen,
+                     "%d %.*s", i, (i * 7) % 96,
+                     "0123456789abcdef0123456789abcdef"
+                     "0123456789abcdef0123456789abcdef"
+                     "0123456789abcdef0123456789abcdef");
+    return 1 + tagLen + n + 1;
+}
+
+static void log_buffer_log(const char *name, int iters) {
+    LogBuffer &buf = getLogBuffer();
+    char buffer[LOGGER_ENTRY_MAX_PAYLOAD];
+    uint64_t bytes = 0;
+
+    startMeasure();
+    for (int i = 0; i < iters; ++i) {
+        unsigned short len = synthesize(buffer, sizeof(buffer), i);
+        log_time now(CLOCK_REALTIME);
+        buf.log(LOG_ID_MAIN, now, 10000 + (i % 7), 1000 + (i % 13),
+                1000 + (i % 29), buffer, len);
+        bytes += len;
+    }
+    stopMeasure(name, iters);
+    SetBenchmarkBytesProcessed(bytes);
+}
+
+/*
+ *	Measure the cost of LogBuffer::log, including the pruning that a full
+ * buffer incurs. Reports ns per log entry, and resident memory at exit.
+ */
+static void BM_log_buffer_log(int iters) {
+    log_buffer_log(__func__, iters);
+}
+BENCHMARK(BM_log_buffer_log);
+
+/*
+ *	Measure LogBuffer::log into full buffers where a single UID is behind
+ * a third of the main log, with system log traffic interleaved. Pruning is
+ * dominated by chatty worst UID processing. Reports bytes logged per
+ * second, the inverse of the prune cost per MB.
+ */
+static void BM_log_buffer_prune_skewed(int iters) {
+    getLogBuffer();
+    static LogBuffer *skewed;
+    if (!skewed) {
+        skewed = new LogBuffer(times);
+        skewed->setSize(LOG_ID_MAIN, 2 * 1024 * 1024);
+        skewed->setSize(LOG_ID_SYSTEM, 2 * 1024 * 1024);
+    }
+    char buffer[LOGGER_ENTRY_MAX_PAYLOAD];
+    uint64_t bytes = 0;
+
+    startMeasure();
+    for (int i = 0; i < iters; ++i) {
+        unsigned short len = synthesize(buffer, sizeof(buffer), i);
+        log_time now(CLOCK_REALTIME);
+        if (i & 1) {
+            skewed->log(LOG_ID_SYSTEM, now, AID_SYSTEM, 1000 + (i % 13),
+                        1000 + (i % 29), buffer, len);
+        } else {
+            uid_t uid = ((i % 10) < 3) ? 10066 : 10000 + (i % 61);
+            skewed->log(LOG_ID_MAIN, now, uid, 2000 + (uid % 100),
+                        2000 + (i % 5), buffer, len);
+        }
+        bytes += len;
+    }
+    stopMeasure(__func__, iters);
+    SetBenchmarkBytesProcessed(bytes);
+}
+BENCHMARK(BM_log_buffer_prune_skewed);
+
+/*
+ *	Measure LogBuffer::log into a full main log buffer with an explicit
+ * white and black list, pruning walks the list for every element visited.
+ * Reports bytes logged per second.
+ */
+static void BM_log_buffer_prune_blacklist(int iters) {
+    getLogBuffer();
+    static LogBuffer *blacklisted;
+    if (!blacklisted) {
+        blacklisted = new LogBuffer(times);
+        blacklisted->setSize(LOG_ID_MAIN, 256 * 1024);
+        blacklisted->initPrune("~! ~1000/! ~10066 ~10031/2031 10001 10002/2002");
+    }
+    char buffer[LOGGER_ENTRY_MAX_PAYLOAD];
+    uint64_t bytes = 0;
+
+    startMeasure();
+    for (int i = 0; i < iters; ++i) {
+        unsigned short len = synthesize(buffer, sizeof(buffer), i);
+        log_time now(CLOCK_REALTIME);
+        uid_t uid = 10000 + (i % 71);
+        blacklisted->log(LOG_ID_MAIN, now, uid, 2000 + (uid % 100),
+                         2000 + (i % 5), buffer, len);
+        bytes += len;
+    }
+    stopMeasure(__func__, iters);
+    SetBenchmarkBytesProcessed(bytes);
+}
+BENCHMARK(BM_log_buffer_prune_blacklist);
+
+/*
+ *	Measure LogBuffer::log with logcat -S statistics enabled, for PIDs and
+ * TIDs that have no /proc entry (eg: exited). Reports ns per log entry.
+ */
+static LogBuffer *statistics;
+
+static LogBuffer &getStatistics() {
+    getLogBuffer();
+    if (!statistics) {
+        statistics = new LogBuffer(times);
+        statistics->enableStatistics();
+    }
+    return *statistics;
+}
+
+static void BM_log_buffer_log_statistics(int iters) {
+    getStatistics();
+    char buffer[LOGGER_ENTRY_MAX_PAYLOAD];
+    uint64_t bytes = 0;
+
+    startMeasure();
+    for (int i = 0; i < iters; ++i) {
+        unsigned short len = synthesize(buffer, sizeof(buffer), i);
+        log_time now(CLOCK_REALTIME);
+        uid_t uid = (i & 1) ? AID_SYSTEM : 10000 + (i % 7);
+        statistics->log((i & 1) ? LOG_ID_SYSTEM : LOG_ID_MAIN, now, uid,
+                        0x7FFF0000 + (i % 13), 0x7FFF0000 + (i % 29),
+                        buffer, len);
+        bytes += len;
+    }
+    stopMeasure(__func__, iters);
+    SetBenchmarkBytesProcessed(bytes);
+}
+BENCHMARK(BM_log_buffer_log_statistics);
+
+/*
+ *	Measure LogBuffer::formatStatistics, as logcat -S would request it, of
+ * a buffer with a few hundred UIDs, PIDs and TIDs in the tables. Reports
+ * ns per report.
+ */
+static void BM_log_buffer_formatStatistics(int iters) {
+    LogBuffer &buf = getStatistics();
+    char buffer[LOGGER_ENTRY_MAX_PAYLOAD];
+
+    for (int i = 0; i < 8192; ++i) {
+        unsigned short len = synthesize(buffer, sizeof(buffer), i);
+        log_time now(CLOCK_REALTIME);
+        uid_t uid = (i & 1) ? AID_SYSTEM : 10000 + (i % 127);
+        buf.log((i & 1) ? LOG_ID_SYSTEM : LOG_ID_MAIN, now, uid,
+                0x7FFF0000 + (i % 251), 0x7FFF0000 + (i % 509),
+                buffer, len);
+    }
+
+    uint64_t bytes = 0;
+    startMeasure();
+    for (int i = 0; i < iters; ++i) {
+        bytes += buf.formatStatistics(AID_ROOT, 0, -1).length();
+    }
+    stopMeasure(__func__, iters);
+    SetBenchmarkBytesProcessed(bytes);
+}
+BENCHMARK(BM_log_buffer_formatStatistics);
+
+/*
+ *	Measure LogBuffer::log for a single UID spamming one tag well past a
+ * rate limit of 100 lines per second. Nearly all lines are turned away by
+ * the token bucket, ahead of any allocation or statistics.
+ */
+static void BM_log_buffer_log_ratelimited(int iters) {
+    getLogBuffer();
+    static LogBuffer *limited;
+    if (!limited) {
+        limited = new LogBuffer(times);
+        limited->initRateLimit("100,100,1000");
+    }
+    char buffer[LOGGER_ENTRY_MAX_PAYLOAD];
+    unsigned short len = synthesize(buffer, sizeof(buffer), 0);
+    uint64_t bytes = 0;
+
+    startMeasure();
+    for (int i = 0; i < iters; ++i) {
+        log_time now(CLOCK_REALTIME);
+        limited->log(LOG_ID_MAIN, now, 10066, 2066, 2066, buffer, len);
+        bytes += len;
+    }
+    stopMeasure(__func__, iters);
+    SetBenchmarkBytesProcessed(bytes);
+}
+BENCHMARK(BM_log_buffer_log_ratelimited);
+
+// Reader threads that keep draining LogBuffer::flushTo into a socketpair,
+// with the far end of the socket drained by a companion thread. Each is
+// registered in LastLogTimes, as a logcat reader would be, so that its
+// region lock is honoured by prune.
+struct BenchmarkReader {
+    pthread_t thread;
+    pthread_t drain;
+    int fd[2];
+    SocketClient *client;
+    LogTimeEntry *entry;
+};
+
+static volatile bool readersRunning;
+
+static void *readerDrain(void *obj) {
+    BenchmarkReader *reader = static_cast<BenchmarkReader *>(obj);
+    char buffer[LOGGER_ENTRY_MAX_LEN];
+    while (read(reader->fd[1], buffer, sizeof(buffer)) > 0) {
+        ;
+    }
+    return NULL;
+}
+
+static void *readerFlush(void *obj) {
+    BenchmarkReader *me = static_cast<BenchmarkReader *>(obj);
+    LogTimeEntry *entry = me->entry;
+    uint64_t start = entry->mStart;
+    while (readersRunning) {
+        uint64_t max = logbuf->flushTo(me->client, start, true, false,
+                                       LogTimeEntry::FilterSecondPass, entry);
+        if (max == LogBufferElement::FLUSH_ERROR) {
+            break;
+        }
+        LogTimeEntry::lock();
+        entry->mStart = max + 1;
+        LogTimeEntry::unlock();
+        start = max;
+        usleep(1000);
+    }
+    return NULL;
+}
+
+/*
+ *	Measure LogBuffer::log while "count" readers are busy streaming out of
+ * the same buffer. Ingestion cost should stay flat as readers are added.
+ */
+static void log_with_readers(const char *name, int iters, size_t count) {
+    getLogBuffer();
+    BenchmarkReader *readers = new BenchmarkReader[count];
+
+    readersRunning = true;
+    for (size_t i = 0; i < count; ++i) {
+        socketpair(AF_UNIX, SOCK_SEQPACKET, 0, readers[i].fd);
+        readers[i].client = new SocketClient(readers[i].fd[0], true);
+        readers[i].entry = new LogTimeEntry(*reader, readers[i].client,
+                                            false, 0, -1, 0,
+                                            LogBufferElement::getCurrentSequence(),
+                                            0);
+        LogTimeEntry::lock();
+        times->push_front(readers[i].entry);
+        LogTimeEntry::unlock();
+        pthread_create(&readers[i].drain, NULL, readerDrain, &readers[i]);
+        pthread_create(&readers[i].thread, NULL, readerFlush, &readers[i]);
+    }
+
+    log_buffer_log(name, iters);
+
+    readersRunning = false;
+    for (size_t i = 0; i < count; ++i) {
+        pthread_join(readers[i].thread, NULL);
+        LogTimeEntry::lock();
+        times->remove(readers[i].entry);
+        readers[i].entry->release_nodelete_Locked();
+        readers[i].entry->decRef_Locked();
+        LogTimeEntry::unlock();
+        shutdown(readers[i].fd[0], SHUT_RDWR);
+        pthread_join(readers[i].drain, NULL);
+        close(readers[i].fd[1]);
+        readers[i].client->decRef();
+    }
+    delete [] readers;
+}
+
+static void BM_log_buffer_log_readers_1(int iters) {
+    log_with_readers(__func__, iters, 1);
+}
+BENCHMARK(BM_log_buffer_log_readers_1);
+
+static void BM_log_buffer_log_readers_4(int iters) {
+    log_with_readers(__func__, iters, 4);
+}
+BENCHMARK(BM_log_buffer_log_readers_4);
+
+static void BM_log_buffer_log_readers_16(int iters) {
+    log_with_readers(__func__, iters, 16);
+}
+BENCHMARK(BM_log_buffer_log_readers_16);
+
+/*
+ *	Measure LogBuffer::flushTo of the entire main log buffer to a
+ * SOCK_SEQPACKET reader, as logcat -d would. Reports ns per full read.
+ */
+static void BM_log_buffer_flushTo(int iters) {
+    LogBuffer &buf = getLogBuffer();
+    char buffer[LOGGER_ENTRY_MAX_PAYLOAD];
+
+    for (int i = 0; i < 8192; ++i) {
+        unsigned short len = synthesize(buffer, sizeof(buffer), i);
+        log_time now(CLOCK_REALTIME);
+        buf.log(LOG_ID_MAIN, now, 10000 + (i % 7), 1000 + (i % 13),
+                1000 + (i % 29), buffer, len);
+    }
+
+    BenchmarkReader me;
+    socketpair(AF_UNIX, SOCK_SEQPACKET, 0, me.fd);
+    me.client = new SocketClient(me.fd[0], true);
+    pthread_create(&me.drain, NULL, readerDrain, &me);
+
+    startMeasure();
+    for (int i = 0; i < iters; ++i) {
+        buf.flushTo(me.client, 1, true, false, NULL, NULL);
+    }
+    stopMeasure(__func__, iters);
+
+    shutdown(me.fd[0], SHUT_RDWR);
+    pthread_join(me.drain, NULL);
+    close(me.fd[1]);
+    me.client->decRef();
+}
+BENCHMARK(BM_log_buffer_flushTo);
+
+// Elements spread over UIDs and PIDs both on and off the list below, the
+// list itself is of a size that might be found on a device.
+static const char pruneList[] =
+    "~! ~1000/! ~10066 ~10031/2031 ~10040/2040 ~10050/2050"
+    " 10001 10002/2002 10003/2003 10004 10005/2005 1000/100";
+
+static LogBufferElement *pruneElements[64];
+
+static PruneList &getPruneList() {
+    static PruneList *prune;
+    if (!prune) {
+        static LogBufferArena arena;
+        char buffer[LOGGER_ENTRY_MAX_PAYLOAD];
+        static const size_t count = sizeof(pruneElements)
+                                  / sizeof(pruneElements[0]);
+        for (size_t i = 0; i < count; ++i) {
+            unsigned short len = synthesize(buffer, sizeof(buffer), i);
+            uid_t uid = (i & 3) ? 10000 + (i % 67) : AID_SYSTEM;
+            pruneElements[i] = LogBufferElement::create(arena, LOG_ID_MAIN,
+                log_time(CLOCK_REALTIME), uid, 2000 + (i % 59), 2000 + i,
+                buffer, len);
+        }
+        prune = new PruneList();
+        prune->init(pruneList);
+    }
+    return *prune;
+}
+
+/*
+ *	Measure PruneList::naughty, the black list check prune makes of every
+ * element it visits. Reports ns per element.
+ */
+static void BM_prune_list_naughty(int iters) {
+    PruneList &prune = getPruneList();
+    static const size_t count = sizeof(pruneElements) / sizeof(pruneElements[0]);
+
+    startMeasure();
+    for (int i = 0; i < iters; ++i) {
+        prune.naughty(pruneElements[i % count]);
+    }
+    stopMeasure(__func__, iters);
+}
+BENCHMARK(BM_prune_list_naughty);
+
+/*
+ *	Measure PruneList::nice, the white list check prune makes of every
+ * element it would otherwise expire. Reports ns per element.
+ */
+static void BM_prune_list_nice(int iters) {
+    PruneList &prune = getPruneList();
+    static const size_t count = sizeof(pruneElements) / sizeof(pruneElements[0]);
+
+    startMeasure();
+    for (int i = 0; i < iters; ++i) {
+        prune.nice(pruneElements[i % count]);
+    }
+    stopMeasure(__func__, iters);
+}
+BENCHMARK(BM_prune_list_nice);
+
+// Kernel log lines, as read from /proc/kmsg, of the kinds seen on devices.
+static const char *const dmesgCorpus[] = {
+    "<6>[    0.000000] Booting Linux on physical CPU 0x0",
+    "<6>[    1.234567] c0      1 init: starting service 'logd'...",
+    "<3>[    2.345678] [1:swapper/0] msm_thermal: cpu 0 offline",
+    "<4>[   12.000123] healthd: battery l=84 v=4112 t=31.0 h=2 st=3 c=-180 chg=u",
+    "<6>[   13.500000] PM: suspend entry 2016-03-01 10:12:13.000000000 UTC",
+    "<6>[   13.600000] PM: suspend exit 2016-03-01 10:12:43.000000000 UTC",
+    "<6>[   13.600100] Suspended for 30.012 seconds",
+    "<14>[   20.111111] binder: 1234:1250 transaction failed 29189, size 0-0",
+    "<6>[   21.000000] wlan: [2345:I :HDD] hdd_connect_result: 1231: connected",
+    "<5>[   22.222222] type=1400 audit(1456827133.111:42): avc: denied { read }"
+        " for pid=2345 comm=\"system_server\" name=\"wakeup\" dev=\"sysfs\""
+        " ino=1234 scontext=u:r:system_server:s0"
+        " tcontext=u:object_r:sysfs:s0 tclass=file permissive=0",
+};
+
+// Audit records, as they arrive on the NETLINK_AUDIT socket or in dmesg.
+static const char *const auditCorpus[] = {
+    "<5>[   22.222222] type=1400 audit(1456827133.111:42): avc: denied { read }"
+        " for pid=2345 comm=\"system_server\" name=\"wakeup\" dev=\"sysfs\""
+        " ino=1234 scontext=u:r:system_server:s0"
+        " tcontext=u:object_r:sysfs:s0 tclass=file permissive=0",
+    "<5>[   23.333333] type=1400 audit(1456827134.222:43): avc: denied"
+        " { search } for pid=3456 comm=\"Binder_2\" name=\"3456\""
+        " dev=\"proc\" ino=56789 scontext=u:r:untrusted_app:s0:c512,c768"
+        " tcontext=u:r:untrusted_app:s0:c512,c768 tclass=dir permissive=1",
+    "<5>[   24.444444] type=1400 audit(1456827135.333:44): avc:  granted"
+        "  { execute } for  pid=4567 comm=\"dex2oat\" path=\"/data/app/x\""
+        " dev=\"dm-0\" ino=98765 scontext=u:r:dex2oat:s0"
+        " tcontext=u:object_r:apk_data_file:s0 tclass=file",
+    "<5>[   25.555555] type=1403 audit(1456827136.444:45): policy loaded"
+        " auid=4294967295 ses=4294967295",
+};
+
+// A writable line, the parsers may edit the text they are handed.
+static size_t corpusLine(char *buffer, size_t len, const char *line) {
+    size_t n = strlcpy(buffer, line, len);
+    return (n < len) ? n : (len - 1);
+}
+
+/*
+ *	Measure LogKlog::log over a corpus of kernel log lines, from tag and
+ * time sniffing through to LogBuffer::log. Reports bytes of kmsg per
+ * second, and allocations per line, which should be none.
+ */
+static void BM_klog_log(int iters) {
+    LogBuffer &buf = getLogBuffer();
+    static LogKlog *klog;
+    if (!klog) {
+        klog = new LogKlog(&buf, reader, -1, -1, false);
+    }
+    static const size_t count = sizeof(dmesgCorpus) / sizeof(dmesgCorpus[0]);
+    char buffer[LOGGER_ENTRY_MAX_PAYLOAD];
+    uint64_t bytes = 0;
+
+    startMeasure();
+    for (int i = 0; i < iters; ++i) {
+        size_t len = corpusLine(buffer, sizeof(buffer), dmesgCorpus[i % count]);
+        klog->log(buffer, len);
+        bytes += len;
+    }
+    stopMeasure(__func__, iters);
+    SetBenchmarkBytesProcessed(bytes);
+}
+BENCHMARK(BM_klog_log);
+
+/*
+ *	Measure LogAudit::log over a corpus of avc denials, the path that
+ * dominates logd during an SELinux denial storm. Each record lands in both
+ * the events and main log buffers. Reports bytes of records per second.
+ */
+static void BM_audit_log(int iters) {
+    LogBuffer &buf = getLogBuffer();
+    static LogAudit *audit;
+    if (!audit) {
+        audit = new LogAudit(&buf, reader, -1, -1);
+    }
+    static const size_t count = sizeof(auditCorpus) / sizeof(auditCorpus[0]);
+    char buffer[LOGGER_ENTRY_MAX_PAYLOAD];
+    uint64_t bytes = 0;
+
+    startMeasure();
+    for (int i = 0; i < iters; ++i) {
+        size_t len = corpusLine(buffer, sizeof(buffer), auditCorpus[i % count]);
+        audit->log(buffer, len);
+        bytes += len;
+    }
+    stopMeasure(__func__, iters);
+    SetBenchmarkBytesProcessed(bytes);
+}
+BENCHMARK(BM_audit_log);
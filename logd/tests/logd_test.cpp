@@ -20,8 +20,11 @@
 #include <signal.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 #include <string>
+#include <vector>
 
 #include <gtest/gtest.h>
 
@@ -30,7 +33,10 @@
 #include <log/log.h>
 #include <log/logger.h>
 
+#include "../LogBuffer.h"
+#include "../LogKlog.h"
 #include "../LogReader.h" // pickup LOGD_SNDTIMEO
+#include "../LogRing.h"
 
 /*
  * returns statistics
@@ -768,3 +774,140 @@ TEST(logd, SNDTIMEO) {
 
     close(fd);
 }
+
+struct ring_entry {
+    log_id_t log_id;
+    log_time realtime;
+    uid_t uid;
+    pid_t pid;
+    pid_t tid;
+    std::string msg;
+};
+
+static int ring_collect(void *arg, log_id_t log_id, log_time realtime,
+                        uid_t uid, pid_t pid, pid_t tid,
+                        const char *msg, unsigned short len) {
+    ring_entry entry = { log_id, realtime, uid, pid, tid,
+                         std::string(msg, len) };
+    static_cast<std::vector<ring_entry> *>(arg)->push_back(entry);
+    return len;
+}
+
+static void ring_write(LogRing &ring, std::vector<ring_entry> &written,
+                       log_id_t log_id, int i) {
+    // priority, tag, message, gathered from two pieces as LogListener does
+    std::string head = android::base::StringPrintf("%cring", ANDROID_LOG_INFO);
+    head.push_back('\0');
+    std::string message = android::base::StringPrintf("entry %d", i);
+    message.push_back('\0');
+    ring_entry entry = { log_id, log_time(CLOCK_REALTIME),
+                         static_cast<uid_t>(10000 + (i % 7)),
+                         getpid(), 1000 + (i % 3), head + message };
+    struct iovec vec[] = {
+        { const_cast<char *>(head.data()), head.size() },
+        { const_cast<char *>(message.data()), message.size() },
+    };
+    ring.append(log_id, entry.realtime, entry.uid, entry.pid, entry.tid,
+                vec, sizeof(vec) / sizeof(vec[0]), entry.msg.size());
+    written.push_back(entry);
+}
+
+static void ring_compare(const std::vector<ring_entry> &written,
+                         const std::vector<ring_entry> &recovered) {
+    ASSERT_EQ(written.size(), recovered.size());
+    for (size_t i = 0; i < written.size(); ++i) {
+        EXPECT_EQ(written[i].log_id, recovered[i].log_id);
+        EXPECT_TRUE(written[i].realtime == recovered[i].realtime);
+        EXPECT_EQ(written[i].uid, recovered[i].uid);
+        EXPECT_EQ(written[i].pid, recovered[i].pid);
+        EXPECT_EQ(written[i].tid, recovered[i].tid);
+        EXPECT_EQ(written[i].msg, recovered[i].msg);
+    }
+}
+
+// What one run of logd mirrors into the ring file, the next recovers
+TEST(logd, ring_recover) {
+    std::string path = android::base::StringPrintf(
+        "/data/local/tmp/logd_ring_test.%d", getpid());
+    std::vector<ring_entry> written, recovered;
+    static const log_id_t ids[] = { LOG_ID_MAIN, LOG_ID_RADIO, LOG_ID_SYSTEM };
+
+    unlink(path.c_str());
+    {
+        LogRing ring;
+        ASSERT_EQ(0, ring.open(path.c_str(), 0));
+        EXPECT_EQ(0U, ring.recover(ring_collect, &recovered));
+        ring.start();
+        // several segments worth
+        for (int i = 0; i < 2000; ++i) {
+            ring_write(ring, written, ids[i % 3], i);
+            if (i == 1000) {
+                // a root logcat -c of radio, what it held is not recovered
+                ring.clear(LOG_ID_RADIO);
+                std::vector<ring_entry> kept;
+                for (size_t j = 0; j < written.size(); ++j) {
+                    if (written[j].log_id != LOG_ID_RADIO) {
+                        kept.push_back(written[j]);
+                    }
+                }
+                written.swap(kept);
+            }
+        }
+    } // logd restarts
+
+    {
+        LogRing ring;
+        ASSERT_EQ(0, ring.open(path.c_str(), 0));
+        EXPECT_EQ(written.size(), ring.recover(ring_collect, &recovered));
+        ring_compare(written, recovered);
+        ring.start();
+        ring_write(ring, written, LOG_ID_MAIN, 2000);
+    } // and again, both runs come back
+
+    recovered.clear();
+    {
+        LogRing ring;
+        ASSERT_EQ(0, ring.open(path.c_str(), 0));
+        EXPECT_EQ(written.size(), ring.recover(ring_collect, &recovered));
+        ring_compare(written, recovered);
+    }
+
+    unlink(path.c_str());
+}
+
+// sniffTime is protected, this lets a test feed it single lines
+class KlogSniffer : public LogKlog {
+public:
+    KlogSniffer(LogBuffer *buf) : LogKlog(buf, NULL, -1, -1, false) { }
+    using LogKlog::sniffTime;
+};
+
+// "Suspended for <seconds>" moves the monotonic to realtime correction on
+// by exactly the time suspended, and a reverse parse takes it back off.
+TEST(logd, klog_suspended) {
+    LastLogTimes times;
+    LogBuffer buf(&times);
+    KlogSniffer klog(&buf);
+    if (klog.isMonotonic()) {
+        fprintf(stderr, "Monotonic timestamps, no correction to test\n");
+        return;
+    }
+
+    static const char line[] = "[  100.000000] Suspended for 12.345678 seconds";
+    log_time before(log_time::EPOCH);
+    LogKlog::convertMonotonicToReal(before);
+
+    log_time now;
+    const char *cp = line;
+    klog.sniffTime(now, &cp, strlen(line), false);
+    log_time after(log_time::EPOCH);
+    LogKlog::convertMonotonicToReal(after);
+    EXPECT_EQ(12U, (after - before).tv_sec);
+    EXPECT_EQ(345678000U, (after - before).tv_nsec);
+
+    cp = line;
+    klog.sniffTime(now, &cp, strlen(line), true);
+    log_time restored(log_time::EPOCH);
+    LogKlog::convertMonotonicToReal(restored);
+    EXPECT_TRUE(restored == before);
+}